@@ -339,6 +339,8 @@ fi
 %{_localstatedir}/spool/plymouth
 %{_mandir}/man?/*
 %ghost %{_localstatedir}/lib/plymouth/boot-duration
+%ghost %{_localstatedir}/lib/plymouth/boot-readahead
+%ghost %{_localstatedir}/lib/plymouth/shutdown-readahead
 %{_prefix}/lib/systemd/system/*
 %{_prefix}/lib/systemd/system/
 
@@ -418,6 +420,7 @@ fi
 
 %files plugin-script
 %{_libdir}/plymouth/script.so
+%{_libexecdir}/plymouth/plymouth-script-cache
 
 %files theme-script
 %dir %{_datadir}/plymouth/themes/script
@@ -201,6 +201,7 @@ ply_boot_splash_load (ply_boot_splash_t *splash)
         ply_key_file_t *key_file;
         char *module_name;
         char *module_path;
+        char *image_dir;
 
         assert (splash != NULL);
 
@@ -215,6 +216,15 @@ ply_boot_splash_load (ply_boot_splash_t *splash)
 
         module_name = ply_key_file_get_value (key_file, "Plymouth Theme", "ModuleName");
 
+        /* Get the theme assets read in while the plugin loads, so
+         * decoding the first image overlaps with IO for the rest
+         */
+        image_dir = ply_key_file_get_value (key_file, module_name, "ImageDir");
+        if (image_dir != NULL) {
+                ply_prefetch_directory (image_dir);
+                free (image_dir);
+        }
+
         asprintf (&module_path, "%s%s.so",
                   splash->plugin_dir, module_name);
         free (module_name);
@@ -39,9 +39,19 @@
 
 #define ALPHA_MASK 0xff000000
 
+typedef struct
+{
+        uint32_t *bytes;
+        int       reference_count;
+
+        ply_pixel_buffer_unshared_handler_t unshared_handler;
+        void                               *unshared_handler_data;
+} ply_pixel_buffer_data_t;
+
 struct _ply_pixel_buffer
 {
         uint32_t       *bytes;
+        ply_pixel_buffer_data_t *data; /* possibly shared with other buffers */
 
         ply_rectangle_t area; /* in device pixels */
         ply_rectangle_t logical_area; /* in logical pixels */
@@ -299,6 +309,48 @@ static void ply_pixel_buffer_add_updated_area (ply_pixel_buffer_t *buffer,
         ply_region_add_rectangle (buffer->updated_areas, &updated_area);
 }
 
+/* Drops one user of @data.  Nothing may touch @data afterward, since
+ * the unshared handler is free to release the last user too.
+ */
+static void
+ply_pixel_buffer_data_release (ply_pixel_buffer_data_t *data)
+{
+        data->reference_count--;
+        if (data->reference_count == 0) {
+                free (data->bytes);
+                free (data);
+        } else if (data->reference_count == 1 && data->unshared_handler != NULL) {
+                data->unshared_handler (data->unshared_handler_data);
+        }
+}
+
+/* Pixel data may be shared between buffers, so before drawing into a
+ * buffer, give it its own copy if anybody else is still using the data.
+ */
+static void
+ply_pixel_buffer_unshare_data (ply_pixel_buffer_t *buffer)
+{
+        ply_pixel_buffer_data_t *old_data;
+        ply_pixel_buffer_data_t *data;
+        size_t size;
+
+        if (buffer->data->reference_count == 1)
+                return;
+
+        size = (size_t) buffer->area.width * buffer->area.height * sizeof(uint32_t);
+
+        data = calloc (1, sizeof(ply_pixel_buffer_data_t));
+        data->bytes = malloc (size);
+        memcpy (data->bytes, buffer->data->bytes, size);
+        data->reference_count = 1;
+
+        old_data = buffer->data;
+        buffer->data = data;
+        buffer->bytes = data->bytes;
+
+        ply_pixel_buffer_data_release (old_data);
+}
+
 static void
 ply_pixel_buffer_fill_area_with_pixel_value (ply_pixel_buffer_t *buffer,
                                              ply_rectangle_t    *fill_area,
@@ -307,6 +359,8 @@ ply_pixel_buffer_fill_area_with_pixel_value (ply_pixel_buffer_t *buffer,
         unsigned long row, column;
         ply_rectangle_t cropped_area;
 
+        ply_pixel_buffer_unshare_data (buffer);
+
         if (fill_area == NULL)
                 fill_area = &buffer->logical_area;
 
@@ -380,7 +434,10 @@ ply_pixel_buffer_new_with_device_rotation (unsigned long               width,
         buffer = calloc (1, sizeof(ply_pixel_buffer_t));
 
         buffer->updated_areas = ply_region_new ();
-        buffer->bytes = (uint32_t *) calloc (height, width * sizeof(uint32_t));
+        buffer->data = calloc (1, sizeof(ply_pixel_buffer_data_t));
+        buffer->data->bytes = (uint32_t *) calloc (height, width * sizeof(uint32_t));
+        buffer->data->reference_count = 1;
+        buffer->bytes = buffer->data->bytes;
         buffer->area.width = width;
         buffer->area.height = height;
         buffer->logical_area = buffer->area;
@@ -408,13 +465,63 @@ free_clip_areas (ply_pixel_buffer_t *buffer)
 void
 ply_pixel_buffer_free (ply_pixel_buffer_t *buffer)
 {
+        ply_pixel_buffer_data_t *data;
+
         if (buffer == NULL)
                 return;
 
         free_clip_areas (buffer);
-        free (buffer->bytes);
+
+        data = buffer->data;
         ply_region_free (buffer->updated_areas);
         free (buffer);
+
+        ply_pixel_buffer_data_release (data);
+}
+
+ply_pixel_buffer_t *
+ply_pixel_buffer_share (ply_pixel_buffer_t *buffer)
+{
+        ply_pixel_buffer_t *shared_buffer;
+
+        assert (buffer != NULL);
+
+        shared_buffer = calloc (1, sizeof(ply_pixel_buffer_t));
+
+        shared_buffer->data = buffer->data;
+        shared_buffer->data->reference_count++;
+        shared_buffer->bytes = shared_buffer->data->bytes;
+
+        shared_buffer->updated_areas = ply_region_new ();
+        shared_buffer->area = buffer->area;
+        shared_buffer->logical_area = buffer->logical_area;
+        shared_buffer->device_scale = buffer->device_scale;
+        shared_buffer->device_rotation = buffer->device_rotation;
+        shared_buffer->is_opaque = buffer->is_opaque;
+
+        shared_buffer->clip_areas = ply_list_new ();
+        ply_pixel_buffer_push_clip_area (shared_buffer, &shared_buffer->area);
+
+        return shared_buffer;
+}
+
+bool
+ply_pixel_buffer_is_shared (ply_pixel_buffer_t *buffer)
+{
+        assert (buffer != NULL);
+
+        return buffer->data->reference_count > 1;
+}
+
+void
+ply_pixel_buffer_set_unshared_handler (ply_pixel_buffer_t                 *buffer,
+                                       ply_pixel_buffer_unshared_handler_t handler,
+                                       void                               *user_data)
+{
+        assert (buffer != NULL);
+
+        buffer->data->unshared_handler = handler;
+        buffer->data->unshared_handler_data = user_data;
 }
 
 void
@@ -519,6 +626,8 @@ ply_pixel_buffer_fill_with_gradient (ply_pixel_buffer_t *buffer,
         uint32_t noise = 0x100001;
         ply_rectangle_t cropped_area;
 
+        ply_pixel_buffer_unshare_data (buffer);
+
         if (fill_area == NULL)
                 fill_area = &buffer->logical_area;
 
@@ -715,6 +824,8 @@ ply_pixel_buffer_fill_with_argb32_data_at_opacity_with_clip_and_scale (ply_pixel
 
         assert (buffer != NULL);
 
+        ply_pixel_buffer_unshare_data (buffer);
+
         if (fill_area == NULL) {
                 fill_area = &buffer->logical_area;
                 logical_fill_area = buffer->logical_area;
@@ -854,6 +965,8 @@ ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (ply_pixel_buffer_t *canv
         assert (canvas != NULL);
         assert (source != NULL);
 
+        ply_pixel_buffer_unshare_data (canvas);
+
         /* Fast path to memcpy if we need no blending or scaling */
         if (opacity == 1.0 && ply_pixel_buffer_is_opaque (source) &&
             canvas->device_scale == source->device_scale &&
@@ -1122,6 +1235,9 @@ ply_pixel_buffer_rotate_upright (ply_pixel_buffer_t *old_buffer)
         int x,y, width, height;
         uint32_t pixel;
 
+        if (old_buffer->device_rotation == PLY_PIXEL_BUFFER_ROTATE_UPRIGHT)
+                return ply_pixel_buffer_share (old_buffer);
+
         width = old_buffer->area.width;
         height = old_buffer->area.height;
 
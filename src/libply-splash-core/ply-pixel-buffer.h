@@ -30,6 +30,7 @@
 #include "ply-utils.h"
 
 typedef struct _ply_pixel_buffer ply_pixel_buffer_t;
+typedef void (*ply_pixel_buffer_unshared_handler_t) (void *user_data);
 
 #define PLY_PIXEL_BUFFER_COLOR_TO_PIXEL_VALUE(r, g, b, a)                        \
         (((uint8_t) (CLAMP (a * 255.0, 0.0, 255.0)) << 24)                        \
@@ -53,6 +54,21 @@ ply_pixel_buffer_new_with_device_rotation (unsigned long width,
                                            unsigned long height,
                                            ply_pixel_buffer_rotation_t device_rotation);
 void ply_pixel_buffer_free (ply_pixel_buffer_t *buffer);
+
+/* Returns a new buffer object that uses the same pixel data as @buffer.
+ * The data is copied on write, the first time either buffer is drawn
+ * into with one of the ply_pixel_buffer_fill_* functions.
+ */
+ply_pixel_buffer_t *ply_pixel_buffer_share (ply_pixel_buffer_t *buffer);
+bool ply_pixel_buffer_is_shared (ply_pixel_buffer_t *buffer);
+
+/* Calls @handler whenever all but one of the buffers sharing the pixel
+ * data of @buffer have been freed or drawn into, so the remaining owner
+ * can drop it once nobody else needs it.
+ */
+void ply_pixel_buffer_set_unshared_handler (ply_pixel_buffer_t                 *buffer,
+                                            ply_pixel_buffer_unshared_handler_t handler,
+                                            void                               *user_data);
 void ply_pixel_buffer_get_size (ply_pixel_buffer_t *buffer,
                                 ply_rectangle_t    *size);
 int  ply_pixel_buffer_get_device_scale (ply_pixel_buffer_t *buffer);
@@ -144,6 +160,9 @@ void ply_pixel_buffer_push_clip_area (ply_pixel_buffer_t *buffer,
                                       ply_rectangle_t    *clip_area);
 void ply_pixel_buffer_pop_clip_area (ply_pixel_buffer_t *buffer);
 
+/* Writing through the returned pointer bypasses copy on write, so only
+ * do that with buffers that are not shared.
+ */
 uint32_t *ply_pixel_buffer_get_argb32_data (ply_pixel_buffer_t *buffer);
 
 ply_pixel_buffer_t *ply_pixel_buffer_resize (ply_pixel_buffer_t *old_buffer,
@@ -159,7 +178,8 @@ ply_pixel_buffer_t *ply_pixel_buffer_tile (ply_pixel_buffer_t *old_buffer,
                                            long                width,
                                            long                height);
 
-/* Return the upright version of a buffer which is non upright.
+/* Return the upright version of a buffer which is non upright, or a
+ * buffer sharing its data if it already is upright.
  * This is the *only* ply_pixel_buffer function which works correctly with a
  * non upright buffer as source.
  */
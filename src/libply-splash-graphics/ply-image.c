@@ -47,6 +47,10 @@
 
 #include <linux/fb.h>
 
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include "ply-logger.h"
+#include "ply-readahead.h"
 #include "ply-utils.h"
 
 struct _ply_image
@@ -76,6 +80,36 @@ struct bmp_dib_header {
         uint32_t colors_important;
 } __attribute__((__packed__));
 
+typedef struct
+{
+        const uint8_t *data;
+        size_t         size;
+        size_t         offset;
+} ply_image_mapping_t;
+
+/* Images are cached by the contents of the file they were decoded from,
+ * so identical frames (hold frames at the end of an animation, the same
+ * asset loaded once per head, ...) only get decoded and stored once.
+ * Every ply_image_t still gets its own ply_pixel_buffer_t, but the pixel
+ * data behind it is shared and must be treated as read-only.  An entry
+ * is dropped as soon as the cache is the last user of its pixel data.
+ *
+ * Each entry keeps the file mapped, so a hit can be checked against the
+ * real contents.  Those pages belong to the page cache, not to plymouthd.
+ */
+typedef struct
+{
+        uint64_t            hash;
+        size_t              size;
+        const uint8_t      *contents;   /* the file, still mapped */
+        ply_pixel_buffer_t *buffer;
+} ply_image_cache_entry_t;
+
+static ply_hashtable_t *image_cache;
+static unsigned long image_cache_hits;
+static unsigned long image_cache_misses;
+static size_t image_cache_bytes_saved;
+
 const uint8_t png_header[8] = { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
 
 ply_image_t *
@@ -101,11 +135,120 @@ ply_image_free (ply_image_t *image)
 
         assert (image->filename != NULL);
 
-        ply_pixel_buffer_free (image->buffer);
+        if (image->buffer != NULL)
+                ply_pixel_buffer_free (image->buffer);
+
         free (image->filename);
         free (image);
 }
 
+static uint64_t
+hash_file_contents (const uint8_t *data,
+                    size_t         size)
+{
+        uint64_t hash = 14695981039346656037ULL;
+        size_t i;
+
+        /* 64-bit FNV-1a */
+        for (i = 0; i < size; i++) {
+                hash ^= data[i];
+                hash *= 1099511628211ULL;
+        }
+
+        return hash;
+}
+
+static unsigned int
+hash_image_cache_entry (void *element)
+{
+        ply_image_cache_entry_t *entry = element;
+
+        return (unsigned int) (entry->hash ^ (entry->hash >> 32));
+}
+
+static int
+compare_image_cache_entries (void *elementa,
+                             void *elementb)
+{
+        ply_image_cache_entry_t *entry_a = elementa;
+        ply_image_cache_entry_t *entry_b = elementb;
+
+        if (entry_a->hash != entry_b->hash)
+                return entry_a->hash < entry_b->hash ? -1 : 1;
+
+        if (entry_a->size != entry_b->size)
+                return entry_a->size < entry_b->size ? -1 : 1;
+
+        /* Different files can hash the same */
+        return memcmp (entry_a->contents, entry_b->contents, entry_a->size);
+}
+
+static void
+on_image_cache_entry_unshared (ply_image_cache_entry_t *entry)
+{
+        ply_hashtable_remove (image_cache, entry);
+        ply_pixel_buffer_free (entry->buffer);
+        munmap ((void *) entry->contents, entry->size);
+        free (entry);
+}
+
+static ply_pixel_buffer_t *
+look_up_image_in_cache (ply_image_mapping_t *mapping,
+                        uint64_t             hash)
+{
+        ply_image_cache_entry_t key, *entry;
+        ply_rectangle_t size;
+
+        if (image_cache == NULL)
+                return NULL;
+
+        key.hash = hash;
+        key.size = mapping->size;
+        key.contents = mapping->data;
+
+        entry = ply_hashtable_lookup (image_cache, &key);
+
+        if (entry == NULL) {
+                image_cache_misses++;
+                return NULL;
+        }
+
+        ply_pixel_buffer_get_size (entry->buffer, &size);
+
+        image_cache_hits++;
+        image_cache_bytes_saved += (size_t) size.width * size.height * sizeof(uint32_t);
+
+        ply_trace ("image cache: %lu hits, %lu misses, %zu bytes saved",
+                   image_cache_hits, image_cache_misses, image_cache_bytes_saved);
+
+        return ply_pixel_buffer_share (entry->buffer);
+}
+
+/* The entry takes over the mapping, which is unmapped with the entry */
+static void
+add_image_to_cache (ply_image_mapping_t *mapping,
+                    uint64_t             hash,
+                    ply_pixel_buffer_t  *buffer)
+{
+        ply_image_cache_entry_t *entry;
+
+        if (image_cache == NULL)
+                image_cache = ply_hashtable_new (hash_image_cache_entry,
+                                                 compare_image_cache_entries);
+
+        entry = calloc (1, sizeof(ply_image_cache_entry_t));
+        entry->hash = hash;
+        entry->size = mapping->size;
+        entry->contents = mapping->data;
+        entry->buffer = ply_pixel_buffer_share (buffer);
+        ply_pixel_buffer_set_unshared_handler (entry->buffer,
+                                               (ply_pixel_buffer_unshared_handler_t)
+                                               on_image_cache_entry_unshared,
+                                               entry);
+
+        ply_hashtable_insert (image_cache, entry, entry);
+}
+
 static void
 transform_to_argb32 (png_struct   *png,
                      png_row_info *row_info,
@@ -135,18 +278,39 @@ transform_to_argb32 (png_struct   *png,
         }
 }
 
+static void
+read_png_data_from_mapping (png_struct *png,
+                            png_byte   *data,
+                            png_size_t  length)
+{
+        ply_image_mapping_t *mapping;
+
+        mapping = png_get_io_ptr (png);
+
+        if (length > mapping->size - mapping->offset)
+                png_error (png, "read past end of file");
+
+        memcpy (data, mapping->data + mapping->offset, length);
+        mapping->offset += length;
+}
+
 static bool
-ply_image_load_png (ply_image_t *image, FILE *fp)
+ply_image_load_png (ply_image_t         *image,
+                    ply_image_mapping_t *mapping,
+                    ply_rectangle_t     *area)
 {
         png_struct *png;
         png_info *info;
         png_uint_32 width, height, row;
         int bits_per_pixel, color_type, interlace_method;
         png_byte **rows;
+        png_byte *row_data;
         uint32_t *bytes;
+        ply_rectangle_t band;
+        bool has_alpha;
 
         assert (image != NULL);
-        assert (fp != NULL);
+        assert (mapping != NULL);
 
         png = png_create_read_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
         assert (png != NULL);
@@ -154,16 +318,23 @@ ply_image_load_png (ply_image_t *image, FILE *fp)
         info = png_create_info_struct (png);
         assert (info != NULL);
 
-        png_init_io (png, fp);
+        png_set_read_fn (png, mapping, read_png_data_from_mapping);
 
-        if (setjmp (png_jmpbuf (png)) != 0)
+        if (setjmp (png_jmpbuf (png)) != 0) {
+                ply_pixel_buffer_free (image->buffer);
+                image->buffer = NULL;
+                png_destroy_read_struct (&png, &info, NULL);
                 return false;
+        }
 
         png_read_info (png, info);
         png_get_IHDR (png, info,
                       &width, &height, &bits_per_pixel,
                       &color_type, &interlace_method, NULL, NULL);
 
+        has_alpha = (color_type & PNG_COLOR_MASK_ALPHA) != 0
+                    || png_get_valid (png, info, PNG_INFO_tRNS);
+
         if (color_type == PNG_COLOR_TYPE_PALETTE)
                 png_set_palette_to_rgb (png);
 
@@ -192,41 +363,103 @@ ply_image_load_png (ply_image_t *image, FILE *fp)
 
         png_read_update_info (png, info);
 
-        rows = malloc (height * sizeof(png_byte *));
-        image->buffer = ply_pixel_buffer_new (width, height);
+        band.x = 0;
+        band.y = 0;
+        band.width = width;
+        band.height = height;
+
+        if (area != NULL)
+                ply_rectangle_intersect (&band, area, &band);
+
+        if (band.width == 0 || band.height == 0) {
+                png_destroy_read_struct (&png, &info, NULL);
+                return false;
+        }
+
+        /* Interlaced images can only be cropped after decoding them
+         * completely, everything else is streamed a row at a time,
+         * keeping only the part inside the requested band and never
+         * reading rows past it
+         */
+        if (area == NULL || interlace_method != PNG_INTERLACE_NONE) {
+                rows = malloc (height * sizeof(png_byte *));
+                image->buffer = ply_pixel_buffer_new (width, height);
+
+                bytes = ply_pixel_buffer_get_argb32_data (image->buffer);
+
+                for (row = 0; row < height; row++) {
+                        rows[row] = (png_byte *) &bytes[row * width];
+                }
+
+                png_read_image (png, rows);
+
+                free (rows);
+                png_read_end (png, info);
+
+                if (band.width != width || band.height != height) {
+                        ply_pixel_buffer_t *buffer = image->buffer;
+                        uint32_t *band_bytes;
+
+                        image->buffer = ply_pixel_buffer_new (band.width, band.height);
+                        band_bytes = ply_pixel_buffer_get_argb32_data (image->buffer);
 
-        bytes = ply_pixel_buffer_get_argb32_data (image->buffer);
+                        for (row = 0; row < band.height; row++) {
+                                memcpy (&band_bytes[row * band.width],
+                                        &bytes[(band.y + row) * width + band.x],
+                                        band.width * sizeof(uint32_t));
+                        }
 
-        for (row = 0; row < height; row++) {
-                rows[row] = (png_byte *) &bytes[row * width];
+                        ply_pixel_buffer_free (buffer);
+                }
+        } else {
+                row_data = malloc (png_get_rowbytes (png, info));
+                image->buffer = ply_pixel_buffer_new (band.width, band.height);
+
+                bytes = ply_pixel_buffer_get_argb32_data (image->buffer);
+
+                for (row = 0; row < band.y + band.height; row++) {
+                        png_read_row (png, row_data, NULL);
+
+                        if (row < band.y)
+                                continue;
+
+                        memcpy (&bytes[(row - band.y) * band.width],
+                                row_data + band.x * sizeof(uint32_t),
+                                band.width * sizeof(uint32_t));
+                }
+
+                free (row_data);
         }
 
-        png_read_image (png, rows);
+        /* The filler makes every pixel solid when there is no alpha in the file */
+        if (!has_alpha)
+                ply_pixel_buffer_set_opaque (image->buffer, true);
 
-        free (rows);
-        png_read_end (png, info);
         png_destroy_read_struct (&png, &info, NULL);
 
         return true;
 }
 
 static bool
-ply_image_load_bmp (ply_image_t *image, FILE *fp)
+ply_image_load_bmp (ply_image_t         *image,
+                    ply_image_mapping_t *mapping,
+                    ply_rectangle_t     *area)
 {
         uint32_t x, y, src_y, width, height, bmp_pitch, *dst;
         struct bmp_file_header file_header;
         struct bmp_dib_header dib_header;
-        uint8_t r, g, b, *buf, *src;
-        bool ret = false;
+        ply_rectangle_t band;
+        const uint8_t *src;
+        uint8_t r, g, b;
 
         assert (image != NULL);
-        assert (fp != NULL);
+        assert (mapping != NULL);
 
-        if (fread (&file_header, 1, sizeof(struct bmp_file_header), fp) != sizeof(struct bmp_file_header))
+        if (mapping->size < sizeof(struct bmp_file_header) + sizeof(struct bmp_dib_header))
                 return false;
 
-        if (fread (&dib_header, 1, sizeof(struct bmp_dib_header), fp) != sizeof(struct bmp_dib_header))
-                return false;
+        memcpy (&file_header, mapping->data, sizeof(struct bmp_file_header));
+        memcpy (&dib_header, mapping->data + sizeof(struct bmp_file_header), sizeof(struct bmp_dib_header));
 
         if (dib_header.dib_header_size != 40 || dib_header.width < 0 ||
             dib_header.planes != 1 || dib_header.bpp != 24 ||
@@ -237,28 +470,37 @@ ply_image_load_bmp (ply_image_t *image, FILE *fp)
         height = abs (dib_header.height);
         bmp_pitch = (3 * width + 3) & ~3;
 
-        buf = malloc (bmp_pitch * height);
-        assert (buf);
+        /* Rows are decoded straight out of the mapping, so make sure
+         * all of them are actually backed by the file first
+         */
+        if (file_header.bitmap_offset > mapping->size ||
+            (uint64_t) bmp_pitch * height > mapping->size - file_header.bitmap_offset)
+                return false;
+
+        band.x = 0;
+        band.y = 0;
+        band.width = width;
+        band.height = height;
+
+        if (area != NULL)
+                ply_rectangle_intersect (&band, area, &band);
 
-        if (fseek (fp, file_header.bitmap_offset, SEEK_SET) != 0)
-                goto out;
-        
-        if (fread (buf, 1, bmp_pitch * height, fp) != bmp_pitch * height)
-                goto out;
+        if (band.width == 0 || band.height == 0)
+                return false;
 
-        image->buffer = ply_pixel_buffer_new (width, height);
+        image->buffer = ply_pixel_buffer_new (band.width, band.height);
         dst = ply_pixel_buffer_get_argb32_data (image->buffer);
 
-        for (y = 0; y < height; y++) {
+        for (y = band.y; y < band.y + band.height; y++) {
                 /* Positive header height means upside down row order */
                 if (dib_header.height > 0)
                         src_y = (height - 1) - y;
                 else
                         src_y = y;
 
-                src = buf + src_y * bmp_pitch;
+                src = mapping->data + file_header.bitmap_offset + (size_t) src_y * bmp_pitch + band.x * 3;
 
-                for (x = 0; x < width; x++) {
+                for (x = 0; x < band.width; x++) {
                         b = *src++;
                         g = *src++;
                         r = *src++;
@@ -267,44 +509,89 @@ ply_image_load_bmp (ply_image_t *image, FILE *fp)
         }
 
         ply_pixel_buffer_set_opaque (image->buffer, true);
-        ret = true;
-out:
-        free (buf);
-        return ret;
+        return true;
 }
 
-bool
-ply_image_load (ply_image_t *image)
+static bool
+ply_image_load_with_area (ply_image_t     *image,
+                          ply_rectangle_t *area)
 {
-        uint8_t header[16];
+        ply_image_mapping_t mapping;
+        struct stat file_info;
+        uint64_t hash = 0;
+        void *data;
         bool ret = false;
-        FILE *fp;
+        int fd;
 
         assert (image != NULL);
 
-        fp = fopen (image->filename, "re");
-        if (fp == NULL)
+        fd = open (image->filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return false;
+
+        if (fstat (fd, &file_info) < 0 || file_info.st_size < 16) {
+                close (fd);
                 return false;
+        }
+
+        data = mmap (NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close (fd);
+
+        if (data == MAP_FAILED)
+                return false;
+
+        /* The whole file gets decoded front to back right away, so
+         * ask the kernel to read it in aggressively
+         */
+        madvise (data, file_info.st_size, MADV_SEQUENTIAL);
+        madvise (data, file_info.st_size, MADV_WILLNEED);
+
+        mapping.data = data;
+        mapping.size = file_info.st_size;
+        mapping.offset = 0;
 
-        if (fread (header, 1, 16, fp) != 16)
-                goto out;
+        /* Only complete images go in the cache */
+        if (area == NULL) {
+                hash = hash_file_contents (mapping.data, mapping.size);
+                image->buffer = look_up_image_in_cache (&mapping, hash);
+        }
+
+        if (image->buffer != NULL)
+                ret = true;
 
-        /* Rewind */
-        if (fseek (fp, 0, SEEK_SET) != 0)
-                goto out;
+        else if (memcmp (mapping.data, png_header, sizeof(png_header)) == 0)
+                ret = ply_image_load_png (image, &mapping, area);
 
-        if (memcmp (header, png_header, sizeof(png_header)) == 0)
-                ret = ply_image_load_png (image, fp);
+        else if (((struct bmp_file_header *) mapping.data)->id == 0x4d42 &&
+                 ((struct bmp_file_header *) mapping.data)->reserved == 0)
+                ret = ply_image_load_bmp (image, &mapping, area);
 
-        else if (((struct bmp_file_header *)header)->id == 0x4d42 &&
-                 ((struct bmp_file_header *)header)->reserved == 0)
-                ret = ply_image_load_bmp (image, fp);
+        if (ret && area == NULL && !ply_pixel_buffer_is_shared (image->buffer))
+                add_image_to_cache (&mapping, hash, image->buffer);
+        else
+                munmap (data, file_info.st_size);
+
+        if (ret)
+                ply_readahead_record_file (image->filename);
 
-out:
-        fclose (fp);
         return ret;
 }
 
+bool
+ply_image_load (ply_image_t *image)
+{
+        return ply_image_load_with_area (image, NULL);
+}
+
+bool
+ply_image_load_area (ply_image_t     *image,
+                     ply_rectangle_t *area)
+{
+        assert (area != NULL);
+
+        return ply_image_load_with_area (image, area);
+}
+
 uint32_t *
 ply_image_get_data (ply_image_t *image)
 {
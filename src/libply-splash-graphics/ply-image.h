@@ -33,7 +33,15 @@ typedef struct _ply_image ply_image_t;
 #ifndef PLY_HIDE_FUNCTION_DECLARATIONS
 ply_image_t *ply_image_new (const char *filename);
 void ply_image_free (ply_image_t *image);
+/* Images with identical file contents share their pixel data, so the
+ * data returned by ply_image_get_data () for a loaded image is read-only.
+ */
 bool ply_image_load (ply_image_t *image);
+/* Only decodes the part of the image inside @area, e.g. a single entry
+ * of a strip holding many pre-rendered labels
+ */
+bool ply_image_load_area (ply_image_t     *image,
+                          ply_rectangle_t *area);
 uint32_t *ply_image_get_data (ply_image_t *image);
 long ply_image_get_width (ply_image_t *image);
 long ply_image_get_height (ply_image_t *image);
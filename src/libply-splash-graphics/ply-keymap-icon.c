@@ -21,6 +21,7 @@
  */
 #include "config.h"
 
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -159,9 +160,19 @@ ply_keymap_icon_load (ply_keymap_icon_t *keymap_icon)
         free (filename);
 
         if (success) {
+                /* Only decode the part of the pre-rendered strip holding
+                 * the text for our keymap
+                 */
+                ply_rectangle_t keymap_area = {
+                        .x = keymap_icon->keymap_offset,
+                        .y = 0,
+                        .width = keymap_icon->keymap_width,
+                        .height = LONG_MAX
+                };
+
                 asprintf (&filename, "%s/keymap-render.png", keymap_icon->image_dir);
                 keymap_image = ply_image_new (filename);
-                success = ply_image_load (keymap_image);
+                success = ply_image_load_area (keymap_image, &keymap_area);
                 ply_trace("loading '%s': %s", filename, success ? "success" : "failed");
                 free (filename);
         }
@@ -250,14 +261,13 @@ ply_keymap_icon_draw_area (ply_keymap_icon_t  *keymap_icon,
         keymap_area.y = keymap_icon->y +
                         (keymap_icon->height - keymap_area.height) / 2;
 
-        /* Draw keyboard layout text, shift the pre-rendered image to the left
-         * so that the text we want lines out at the place we want it and set
-         * the area we want to draw to as clip-area to only draw what we want.
+        /* Draw keyboard layout text, only the text we want got loaded from
+         * the pre-rendered image, but still clip to the area we want to draw
          */
         ply_pixel_buffer_fill_with_buffer_with_clip (
                 buffer,
                 keymap_icon->keymap_buffer,
-                keymap_area.x - keymap_icon->keymap_offset,
+                keymap_area.x,
                 keymap_area.y,
                 &keymap_area);
 }
@@ -34,6 +34,7 @@
 
 #include "ply-label-plugin.h"
 #include "ply-event-loop.h"
+#include "ply-hashtable.h"
 #include "ply-list.h"
 #include "ply-logger.h"
 #include "ply-utils.h"
@@ -41,7 +42,6 @@
 struct _ply_label
 {
         ply_event_loop_t                   *loop;
-        ply_module_handle_t                *module_handle;
         const ply_label_plugin_interface_t *plugin_interface;
         ply_label_plugin_control_t         *control;
 
@@ -55,9 +55,28 @@ struct _ply_label
         float                               alpha;
 };
 
+typedef struct
+{
+        char               *key;
+        ply_pixel_buffer_t *buffer;
+        size_t              size;
+        ply_list_node_t    *node;
+} ply_label_rendered_text_t;
+
 typedef const ply_label_plugin_interface_t *
 (*get_plugin_interface_function_t) (void);
 
+/* The plugin is loaded by the first label and kept for the life of the
+ * process, since labels come and go often */
+static ply_module_handle_t *ply_label_module_handle;
+static const ply_label_plugin_interface_t *ply_label_plugin_interface;
+
+/* Text rendered by ply_label_render, most recently used first */
+#define PLY_LABEL_RENDERED_TEXT_BUDGET (4 * 1024 * 1024)
+static ply_hashtable_t *ply_label_rendered_text;
+static ply_list_t *ply_label_rendered_text_list;
+static size_t ply_label_rendered_text_size;
+
 static void ply_label_unload_plugin (ply_label_t *label);
 
 ply_label_t *
@@ -81,48 +100,62 @@ ply_label_free (ply_label_t *label)
         if (label == NULL)
                 return;
 
-        if (label->plugin_interface != NULL) {
-                ply_trace ("Unloading label control plugin");
+        if (label->plugin_interface != NULL)
                 ply_label_unload_plugin (label);
-        }
 
+        free (label->text);
+        free (label->fontdesc);
         free (label);
 }
 
 static bool
-ply_label_load_plugin (ply_label_t *label)
+ply_label_open_plugin (void)
 {
-        assert (label != NULL);
-
         get_plugin_interface_function_t get_label_plugin_interface;
 
-        label->module_handle = ply_open_module (PLYMOUTH_PLUGIN_PATH "label.so");
+        if (ply_label_plugin_interface != NULL)
+                return true;
+
+        ply_trace ("Loading label control plugin");
+        ply_label_module_handle = ply_open_module (PLYMOUTH_PLUGIN_PATH "label.so");
 
-        if (label->module_handle == NULL)
+        if (ply_label_module_handle == NULL)
                 return false;
 
         get_label_plugin_interface = (get_plugin_interface_function_t)
-                                     ply_module_look_up_function (label->module_handle,
+                                     ply_module_look_up_function (ply_label_module_handle,
                                                                   "ply_label_plugin_get_interface");
 
         if (get_label_plugin_interface == NULL) {
                 ply_save_errno ();
-                ply_close_module (label->module_handle);
-                label->module_handle = NULL;
+                ply_close_module (ply_label_module_handle);
+                ply_label_module_handle = NULL;
                 ply_restore_errno ();
                 return false;
         }
 
-        label->plugin_interface = get_label_plugin_interface ();
+        ply_label_plugin_interface = get_label_plugin_interface ();
 
-        if (label->plugin_interface == NULL) {
+        if (ply_label_plugin_interface == NULL) {
                 ply_save_errno ();
-                ply_close_module (label->module_handle);
-                label->module_handle = NULL;
+                ply_close_module (ply_label_module_handle);
+                ply_label_module_handle = NULL;
                 ply_restore_errno ();
                 return false;
         }
 
+        return true;
+}
+
+static bool
+ply_label_load_plugin (ply_label_t *label)
+{
+        assert (label != NULL);
+
+        if (!ply_label_open_plugin ())
+                return false;
+
+        label->plugin_interface = ply_label_plugin_interface;
         label->control = label->plugin_interface->create_control ();
 
         if (label->text != NULL)
@@ -149,11 +182,10 @@ ply_label_unload_plugin (ply_label_t *label)
 {
         assert (label != NULL);
         assert (label->plugin_interface != NULL);
-        assert (label->module_handle != NULL);
 
-        ply_close_module (label->module_handle);
+        label->plugin_interface->destroy_control (label->control);
+        label->control = NULL;
         label->plugin_interface = NULL;
-        label->module_handle = NULL;
 }
 
 bool
@@ -314,4 +346,101 @@ ply_label_get_height (ply_label_t *label)
 
         return label->plugin_interface->get_height_of_control (label->control);
 }
+
+static char *
+ply_label_get_rendered_text_key (ply_label_t *label,
+                                 int          device_scale)
+{
+        char *key;
+
+        /* The text goes last and the font is prefixed by its length, so
+         * no two labels can make the same key */
+        asprintf (&key, "%d %d %ld %a %a %a %a %d:%s %s",
+                  device_scale,
+                  label->alignment,
+                  label->width,
+                  label->red,
+                  label->green,
+                  label->blue,
+                  label->alpha,
+                  label->fontdesc != NULL ? (int) strlen (label->fontdesc) : -1,
+                  label->fontdesc != NULL ? label->fontdesc : "",
+                  label->text != NULL ? label->text : "");
+        return key;
+}
+
+static void
+ply_label_remove_rendered_text (ply_label_rendered_text_t *rendered_text)
+{
+        ply_hashtable_remove (ply_label_rendered_text, rendered_text->key);
+        ply_list_remove_node (ply_label_rendered_text_list, rendered_text->node);
+        ply_label_rendered_text_size -= rendered_text->size;
+        ply_pixel_buffer_free (rendered_text->buffer);
+        free (rendered_text->key);
+        free (rendered_text);
+}
+
+/* Returns a new buffer holding the text of the label, sized to fit it.
+ * Text rendered before with the same font, color, alignment, width and
+ * scale is shared from a cache rather than laid out and drawn again.
+ * The label is left shown, without a display.
+ */
+ply_pixel_buffer_t *
+ply_label_render (ply_label_t *label,
+                  int          device_scale)
+{
+        ply_label_rendered_text_t *rendered_text;
+        ply_pixel_buffer_t *buffer;
+        long width, height;
+        char *key;
+
+        if (ply_label_rendered_text == NULL) {
+                ply_label_rendered_text = ply_hashtable_new (ply_hashtable_string_hash,
+                                                             ply_hashtable_string_compare);
+                ply_label_rendered_text_list = ply_list_new ();
+        }
+
+        key = ply_label_get_rendered_text_key (label, device_scale);
+        rendered_text = ply_hashtable_lookup (ply_label_rendered_text, key);
+
+        if (rendered_text != NULL) {
+                free (key);
+                ply_list_remove_node (ply_label_rendered_text_list, rendered_text->node);
+                rendered_text->node = ply_list_prepend_data (ply_label_rendered_text_list,
+                                                             rendered_text);
+                return ply_pixel_buffer_share (rendered_text->buffer);
+        }
+
+        if (!ply_label_show (label, NULL, 0, 0)) {
+                free (key);
+                return NULL;
+        }
+
+        width = ply_label_get_width (label);
+        height = ply_label_get_height (label);
+
+        buffer = ply_pixel_buffer_new (width * device_scale, height * device_scale);
+        ply_pixel_buffer_set_device_scale (buffer, device_scale);
+        ply_label_draw_area (label, buffer, 0, 0, width, height);
+
+        rendered_text = calloc (1, sizeof(ply_label_rendered_text_t));
+        rendered_text->key = key;
+        rendered_text->size = (size_t) width * height * device_scale * device_scale * sizeof(uint32_t);
+
+        if (rendered_text->size > PLY_LABEL_RENDERED_TEXT_BUDGET) {
+                free (rendered_text->key);
+                free (rendered_text);
+                return buffer;
+        }
+
+        while (ply_label_rendered_text_size + rendered_text->size > PLY_LABEL_RENDERED_TEXT_BUDGET)
+                ply_label_remove_rendered_text (ply_list_node_get_data (ply_list_get_last_node (ply_label_rendered_text_list)));
+
+        rendered_text->buffer = buffer;
+        rendered_text->node = ply_list_prepend_data (ply_label_rendered_text_list, rendered_text);
+        ply_hashtable_insert (ply_label_rendered_text, rendered_text->key, rendered_text);
+        ply_label_rendered_text_size += rendered_text->size;
+
+        return ply_pixel_buffer_share (buffer);
+}
 /* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -74,6 +74,9 @@ void ply_label_set_color (ply_label_t *label,
 
 long ply_label_get_width (ply_label_t *label);
 long ply_label_get_height (ply_label_t *label);
+
+ply_pixel_buffer_t *ply_label_render (ply_label_t *label,
+                                      int          device_scale);
 #endif
 
 #endif /* PLY_LABEL_H */
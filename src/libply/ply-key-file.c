@@ -41,6 +41,7 @@
 #include "ply-utils.h"
 #include "ply-hashtable.h"
 #include "ply-logger.h"
+#include "ply-readahead.h"
 
 typedef struct
 {
@@ -296,6 +297,8 @@ ply_key_file_load (ply_key_file_t *key_file)
 
         if (!was_loaded)
                 ply_trace ("was unable to load any groups");
+        else
+                ply_readahead_record_file (key_file->filename);
 
         ply_key_file_close_file (key_file);
 
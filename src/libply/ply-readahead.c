@@ -0,0 +1,205 @@
+/* ply-readahead.c - records and prefetches files used during boot
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+#include "ply-readahead.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include "ply-logger.h"
+#include "ply-utils.h"
+
+#ifndef PLY_READAHEAD_MAPS_FILE
+#define PLY_READAHEAD_MAPS_FILE "/proc/self/maps"
+#endif
+
+/* The files plymouthd touches at boot are the same every time, so we
+ * keep a list of them, in the order they were first opened, and hand
+ * that list back to the kernel on the next boot before they are needed.
+ */
+static ply_list_t *recorded_files;
+static ply_hashtable_t *recorded_files_set;
+
+void
+ply_readahead_start_recording (void)
+{
+        if (recorded_files != NULL)
+                return;
+
+        ply_trace ("recording files for readahead");
+
+        recorded_files = ply_list_new ();
+        recorded_files_set = ply_hashtable_new (ply_hashtable_string_hash,
+                                                ply_hashtable_string_compare);
+}
+
+void
+ply_readahead_stop_recording (void)
+{
+        ply_list_node_t *node;
+
+        if (recorded_files == NULL)
+                return;
+
+        node = ply_list_get_first_node (recorded_files);
+        while (node != NULL) {
+                free (ply_list_node_get_data (node));
+                node = ply_list_get_next_node (recorded_files, node);
+        }
+
+        ply_list_free (recorded_files);
+        ply_hashtable_free (recorded_files_set);
+        recorded_files = NULL;
+        recorded_files_set = NULL;
+}
+
+bool
+ply_readahead_is_recording (void)
+{
+        return recorded_files != NULL;
+}
+
+void
+ply_readahead_record_file (const char *filename)
+{
+        char *file;
+
+        if (recorded_files == NULL || filename == NULL || filename[0] != '/')
+                return;
+
+        if (ply_hashtable_lookup (recorded_files_set, (void *) filename) != NULL)
+                return;
+
+        file = strdup (filename);
+        ply_list_append_data (recorded_files, file);
+        ply_hashtable_insert (recorded_files_set, file, file);
+}
+
+/* Shared libraries pulled in indirectly (pango, cairo, fontconfig...)
+ * and font files are never opened through plymouth code, but they end
+ * up mapped, so pick them up from the process maps.
+ */
+static void
+record_mapped_files (void)
+{
+        FILE *fp;
+        char *line = NULL;
+        size_t line_size = 0;
+
+        fp = fopen (PLY_READAHEAD_MAPS_FILE, "re");
+        if (fp == NULL)
+                return;
+
+        while (getline (&line, &line_size, fp) >= 0) {
+                char *filename;
+                size_t length;
+
+                filename = strchr (line, '/');
+                if (filename == NULL)
+                        continue;
+
+                length = strlen (filename);
+                if (length > 0 && filename[length - 1] == '\n')
+                        filename[--length] = '\0';
+
+                if (strstr (filename, " (deleted)") != NULL)
+                        continue;
+
+                ply_readahead_record_file (filename);
+        }
+
+        free (line);
+        fclose (fp);
+}
+
+bool
+ply_readahead_save_list (const char *filename)
+{
+        ply_list_node_t *node;
+        FILE *fp;
+
+        assert (filename != NULL);
+
+        if (recorded_files == NULL)
+                return false;
+
+        record_mapped_files ();
+
+        ply_trace ("saving %d readahead entries to %s",
+                   ply_list_get_length (recorded_files), filename);
+
+        fp = fopen (filename, "we");
+        if (fp == NULL) {
+                ply_trace ("failed to save readahead list: %m");
+                return false;
+        }
+
+        node = ply_list_get_first_node (recorded_files);
+        while (node != NULL) {
+                const char *file = ply_list_node_get_data (node);
+
+                if (ply_file_exists (file))
+                        fprintf (fp, "%s\n", file);
+                node = ply_list_get_next_node (recorded_files, node);
+        }
+
+        return fclose (fp) == 0;
+}
+
+int
+ply_readahead_prefetch_list (const char *filename)
+{
+        FILE *fp;
+        char *line = NULL;
+        size_t line_size = 0;
+        ssize_t length;
+        int number_of_files = 0;
+
+        assert (filename != NULL);
+
+        fp = fopen (filename, "re");
+        if (fp == NULL)
+                return 0;
+
+        /* POSIX_FADV_WILLNEED only queues the reads, so all of the
+         * requests end up in flight together
+         */
+        while ((length = getline (&line, &line_size, fp)) >= 0) {
+                if (length > 0 && line[length - 1] == '\n')
+                        line[length - 1] = '\0';
+
+                if (line[0] != '/')
+                        continue;
+
+                if (ply_prefetch_file (line))
+                        number_of_files++;
+        }
+
+        free (line);
+        fclose (fp);
+
+        ply_trace ("prefetched %d files listed in %s", number_of_files, filename);
+
+        return number_of_files;
+}
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
@@ -0,0 +1,33 @@
+/* ply-readahead.h - records and prefetches files used during boot
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef PLY_READAHEAD_H
+#define PLY_READAHEAD_H
+
+#include <stdbool.h>
+
+#ifndef PLY_HIDE_FUNCTION_DECLARATIONS
+void ply_readahead_start_recording (void);
+void ply_readahead_stop_recording (void);
+bool ply_readahead_is_recording (void);
+void ply_readahead_record_file (const char *filename);
+bool ply_readahead_save_list (const char *filename);
+int ply_readahead_prefetch_list (const char *filename);
+#endif
+
+#endif /* PLY_READAHEAD_H */
+/* vim: set ts=4 sw=4 expandtab autoindent cindent cino={.5s,(0: */
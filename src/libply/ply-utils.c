@@ -52,6 +52,7 @@
 #include <dlfcn.h>
 
 #include "ply-logger.h"
+#include "ply-readahead.h"
 
 #ifndef PLY_OPEN_FILE_DESCRIPTORS_DIR
 #define PLY_OPEN_FILE_DESCRIPTORS_DIR "/proc/self/fd"
@@ -536,6 +537,8 @@ ply_open_module (const char *module_path)
                 ply_trace ("Could not load module \"%s\": %s", module_path, dlerror ());
                 if (errno == 0)
                         errno = ELIBACC;
+        } else {
+                ply_readahead_record_file (module_path);
         }
 
         return handle;
@@ -631,6 +634,66 @@ ply_create_directory (const char *directory)
         return true;
 }
 
+bool
+ply_prefetch_file (const char *file)
+{
+        int fd;
+        int error;
+
+        assert (file != NULL);
+
+        fd = open (file, O_RDONLY | O_CLOEXEC | O_NOCTTY);
+
+        if (fd < 0)
+                return false;
+
+        error = posix_fadvise (fd, 0, 0, POSIX_FADV_WILLNEED);
+        close (fd);
+
+        if (error != 0) {
+                errno = error;
+                return false;
+        }
+
+        return true;
+}
+
+int
+ply_prefetch_directory (const char *directory)
+{
+        DIR *dir;
+        struct dirent *entry;
+        int number_of_files = 0;
+
+        assert (directory != NULL);
+
+        dir = opendir (directory);
+
+        if (dir == NULL)
+                return 0;
+
+        while ((entry = readdir (dir)) != NULL) {
+                char *path;
+
+                if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN)
+                        continue;
+
+                asprintf (&path, "%s/%s", directory, entry->d_name);
+
+                if ((entry->d_type == DT_REG || ply_file_exists (path)) &&
+                    ply_prefetch_file (path))
+                        number_of_files++;
+
+                free (path);
+        }
+
+        closedir (dir);
+
+        ply_trace ("prefetching %d files from '%s'", number_of_files, directory);
+
+        return number_of_files;
+}
+
 bool
 ply_create_file_link (const char *source,
                       const char *destination)
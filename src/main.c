@@ -55,9 +55,12 @@
 #include "ply-trigger.h"
 #include "ply-utils.h"
 #include "ply-progress.h"
+#include "ply-readahead.h"
 
 #define BOOT_DURATION_FILE     PLYMOUTH_TIME_DIRECTORY "/boot-duration"
 #define SHUTDOWN_DURATION_FILE PLYMOUTH_TIME_DIRECTORY "/shutdown-duration"
+#define BOOT_READAHEAD_FILE     PLYMOUTH_TIME_DIRECTORY "/boot-readahead"
+#define SHUTDOWN_READAHEAD_FILE PLYMOUTH_TIME_DIRECTORY "/shutdown-readahead"
 
 typedef struct
 {
@@ -145,6 +148,7 @@ static void tell_systemd_to_print_details (state_t *state);
 static void tell_systemd_to_stop_printing_details (state_t *state);
 #endif
 static const char *get_cache_file_for_mode (ply_boot_splash_mode_t mode);
+static const char *get_readahead_file_for_mode (ply_boot_splash_mode_t mode);
 static void on_escape_pressed (state_t *state);
 static void on_enter (state_t    *state,
                       const char *line);
@@ -701,6 +705,35 @@ get_cache_file_for_mode (ply_boot_splash_mode_t mode)
         return filename;
 }
 
+static const char *
+get_readahead_file_for_mode (ply_boot_splash_mode_t mode)
+{
+        const char *filename;
+
+        switch (mode) {
+        case PLY_BOOT_SPLASH_MODE_BOOT_UP:
+                filename = BOOT_READAHEAD_FILE;
+                break;
+        case PLY_BOOT_SPLASH_MODE_SHUTDOWN:
+        case PLY_BOOT_SPLASH_MODE_REBOOT:
+                filename = SHUTDOWN_READAHEAD_FILE;
+                break;
+        case PLY_BOOT_SPLASH_MODE_UPDATES:
+        case PLY_BOOT_SPLASH_MODE_SYSTEM_UPGRADE:
+        case PLY_BOOT_SPLASH_MODE_FIRMWARE_UPGRADE:
+                filename = NULL;
+                break;
+        case PLY_BOOT_SPLASH_MODE_INVALID:
+        default:
+                ply_error ("Unhandled case in %s line %d\n", __FILE__, __LINE__);
+                abort ();
+                break;
+        }
+
+        ply_trace ("returning readahead file '%s'", filename);
+        return filename;
+}
+
 static const char *
 get_log_file_for_state (state_t *state)
 {
@@ -1346,6 +1379,8 @@ on_quit (state_t       *state,
          bool           retain_splash,
          ply_trigger_t *quit_trigger)
 {
+        const char *readahead_file;
+
         ply_trace ("quitting (retain splash: %s)", retain_splash ? "true" : "false");
 
         if (state->quit_trigger != NULL) {
@@ -1362,6 +1397,10 @@ on_quit (state_t       *state,
                 ply_create_directory (PLYMOUTH_TIME_DIRECTORY);
                 ply_progress_save_cache (state->progress,
                                          get_cache_file_for_mode (state->mode));
+
+                readahead_file = get_readahead_file_for_mode (state->mode);
+                if (readahead_file != NULL)
+                        ply_readahead_save_list (readahead_file);
         } else {
                 ply_trace ("system not initialized so skipping saving boot-duration file");
         }
@@ -2136,6 +2175,7 @@ main (int    argc,
         char *mode_string = NULL;
         char *kernel_command_line = NULL;
         char *tty = NULL;
+        const char *readahead_file;
         ply_device_manager_flags_t device_manager_flags = PLY_DEVICE_MANAGER_FLAGS_NONE;
 
         state.start_time = ply_get_timestamp ();
@@ -2310,6 +2350,16 @@ main (int    argc,
         ply_progress_load_cache (state.progress,
                                  get_cache_file_for_mode (state.mode));
 
+        /* Get everything the splash needed last time on its way in
+         * from disk before we start loading it, and note down what it
+         * needs this time around
+         */
+        readahead_file = get_readahead_file_for_mode (state.mode);
+        if (readahead_file != NULL) {
+                ply_readahead_prefetch_list (readahead_file);
+                ply_readahead_start_recording ();
+        }
+
         if (pid_file != NULL)
                 write_pid_file (pid_file);
 
@@ -2362,6 +2412,7 @@ main (int    argc,
 
         ply_buffer_free (state.boot_buffer);
         ply_progress_free (state.progress);
+        ply_readahead_stop_recording ();
 
         ply_trace ("exiting with code %d", exit_code);
 
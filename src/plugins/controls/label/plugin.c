@@ -65,8 +65,14 @@ struct _ply_label_plugin_control
         float                blue;
         float                alpha;
 
+        PangoLayout         *pango_layout;      /* kept between draws */
+        ply_pixel_buffer_t  *bitmap;            /* text drawn by pango_layout */
+        long                 bitmap_x;          /* relative to area */
+        long                 bitmap_y;
+
         uint32_t             is_hidden : 1;
         uint32_t             needs_size_update : 1;
+        uint32_t             needs_layout_update : 1;
 };
 
 ply_label_plugin_interface_t *ply_label_plugin_get_interface (void);
@@ -81,74 +87,37 @@ create_control (void)
         label->is_hidden = true;
         label->alignment = PANGO_ALIGN_LEFT;
         label->width = -1;
+        label->needs_layout_update = true;
 
         return label;
 }
 
 static void
-destroy_control (ply_label_plugin_control_t *label)
+clear_bitmap (ply_label_plugin_control_t *label)
 {
-        if (label == NULL)
-                return;
-
-        free (label);
+        ply_pixel_buffer_free (label->bitmap);
+        label->bitmap = NULL;
 }
 
-static cairo_t *
-get_cairo_context_for_pixel_buffer (ply_label_plugin_control_t *label,
-                                    ply_pixel_buffer_t         *pixel_buffer,
-                                    long                       *center_x,
-                                    long                       *center_y)
+static void
+invalidate_layout (ply_label_plugin_control_t *label)
 {
-        cairo_surface_t *cairo_surface;
-        cairo_t *cairo_context;
-        unsigned char *data;
-        unsigned long width, height;
-        uint32_t scale;
-        ply_pixel_buffer_rotation_t rotation;
-
-        data = (unsigned char *) ply_pixel_buffer_get_argb32_data (pixel_buffer);
-        width = ply_pixel_buffer_get_width (pixel_buffer);
-        height = ply_pixel_buffer_get_height (pixel_buffer);
-        scale = ply_pixel_buffer_get_device_scale (pixel_buffer);
-        rotation = ply_pixel_buffer_get_device_rotation (pixel_buffer);
-
-        *center_x = width / 2;
-        *center_y = height / 2;
-
-        if (rotation == PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE ||
-            rotation == PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE) {
-                unsigned long tmp = width;
-                width = height;
-                height = tmp;
-        }
-
-        cairo_surface = cairo_image_surface_create_for_data (data,
-                                                             CAIRO_FORMAT_ARGB32,
-                                                             width * scale,
-                                                             height * scale,
-                                                             width * scale * 4);
-        cairo_surface_set_device_scale (cairo_surface, scale, scale);
-        cairo_context = cairo_create (cairo_surface);
-        cairo_surface_destroy (cairo_surface);
+        label->needs_layout_update = true;
+        clear_bitmap (label);
+}
 
-        /* Rotate around the center */
-        cairo_translate (cairo_context, width / 2, height / 2);
-        switch (rotation) {
-        case PLY_PIXEL_BUFFER_ROTATE_UPRIGHT:
-                break;
-        case PLY_PIXEL_BUFFER_ROTATE_UPSIDE_DOWN:
-                cairo_rotate (cairo_context, M_PI);
-                break;
-        case PLY_PIXEL_BUFFER_ROTATE_CLOCKWISE:
-                cairo_rotate (cairo_context, 0.5 * M_PI);
-                break;
-        case PLY_PIXEL_BUFFER_ROTATE_COUNTER_CLOCKWISE:
-                cairo_rotate (cairo_context, -0.5 * M_PI);
-                break;
-        }
+static void
+destroy_control (ply_label_plugin_control_t *label)
+{
+        if (label == NULL)
+                return;
 
-        return cairo_context;
+        clear_bitmap (label);
+        if (label->pango_layout != NULL)
+                g_object_unref (label->pango_layout);
+        free (label->text);
+        free (label->fontdesc);
+        free (label);
 }
 
 static cairo_t *
@@ -164,40 +133,98 @@ get_cairo_context_for_sizing (ply_label_plugin_control_t *label)
         return cairo_context;
 }
 
+/* The layout is made once and only changed when the text, font, width or
+ * alignment of the label do.
+ */
 static PangoLayout *
-init_pango_text_layout (cairo_t       *cairo_context,
-                        char          *text,
-                        char          *font_description,
-                        PangoAlignment alignment,
-                        long           width)
+get_pango_text_layout (ply_label_plugin_control_t *label)
 {
-        PangoLayout *pango_layout;
         PangoFontDescription *description;
+        cairo_t *cairo_context;
 
-        pango_layout = pango_cairo_create_layout (cairo_context);
+        if (label->pango_layout == NULL) {
+                cairo_context = get_cairo_context_for_sizing (label);
+                label->pango_layout = pango_cairo_create_layout (cairo_context);
+                cairo_destroy (cairo_context);
+                label->needs_layout_update = true;
+        }
+
+        if (!label->needs_layout_update)
+                return label->pango_layout;
 
-        if (!font_description)
+        if (!label->fontdesc)
                 description = pango_font_description_from_string ("Sans 12");
         else
-                description = pango_font_description_from_string (font_description);
+                description = pango_font_description_from_string (label->fontdesc);
 
-        pango_layout_set_font_description (pango_layout, description);
+        pango_layout_set_font_description (label->pango_layout, description);
         pango_font_description_free (description);
 
-        pango_layout_set_alignment (pango_layout, alignment);
-        if (width >= 0)
-                pango_layout_set_width (pango_layout, width * PANGO_SCALE);
+        pango_layout_set_alignment (label->pango_layout, label->alignment);
+        pango_layout_set_width (label->pango_layout,
+                                label->width >= 0 ? label->width * PANGO_SCALE : -1);
 
-        pango_layout_set_text (pango_layout, text, -1);
-        pango_cairo_update_layout (cairo_context, pango_layout);
+        pango_layout_set_text (label->pango_layout, label->text != NULL ? label->text : "", -1);
 
-        return pango_layout;
+        label->needs_layout_update = false;
+        return label->pango_layout;
 }
 
+/* Draws the text once into a buffer big enough for all of its ink, so
+ * redrawing the label only has to copy it.
+ */
 static void
-size_control (ply_label_plugin_control_t *label, bool force)
+update_bitmap (ply_label_plugin_control_t *label,
+               uint32_t                    scale)
 {
+        PangoLayout *pango_layout;
+        PangoRectangle ink_rectangle, logical_rectangle;
+        cairo_surface_t *cairo_surface;
         cairo_t *cairo_context;
+        long x1, y1, x2, y2;
+
+        if (label->bitmap != NULL &&
+            (uint32_t) ply_pixel_buffer_get_device_scale (label->bitmap) == scale)
+                return;
+
+        clear_bitmap (label);
+
+        pango_layout = get_pango_text_layout (label);
+        pango_layout_get_pixel_extents (pango_layout, &ink_rectangle, &logical_rectangle);
+
+        x1 = MIN (ink_rectangle.x, 0);
+        y1 = MIN (ink_rectangle.y, 0);
+        x2 = MAX (ink_rectangle.x + ink_rectangle.width, logical_rectangle.width);
+        y2 = MAX (ink_rectangle.y + ink_rectangle.height, logical_rectangle.height);
+
+        label->bitmap = ply_pixel_buffer_new ((x2 - x1) * scale, (y2 - y1) * scale);
+        ply_pixel_buffer_set_device_scale (label->bitmap, scale);
+        label->bitmap_x = x1;
+        label->bitmap_y = y1;
+
+        cairo_surface = cairo_image_surface_create_for_data ((unsigned char *) ply_pixel_buffer_get_argb32_data (label->bitmap),
+                                                             CAIRO_FORMAT_ARGB32,
+                                                             (x2 - x1) * scale,
+                                                             (y2 - y1) * scale,
+                                                             (x2 - x1) * scale * 4);
+        cairo_surface_set_device_scale (cairo_surface, scale, scale);
+        cairo_context = cairo_create (cairo_surface);
+        cairo_surface_destroy (cairo_surface);
+
+        pango_cairo_update_layout (cairo_context, pango_layout);
+        cairo_move_to (cairo_context, -x1, -y1);
+        cairo_set_source_rgba (cairo_context,
+                               label->red,
+                               label->green,
+                               label->blue,
+                               label->alpha);
+        pango_cairo_show_layout (cairo_context, pango_layout);
+        cairo_destroy (cairo_context);
+}
+
+static void
+size_control (ply_label_plugin_control_t *label, bool force)
+{
         PangoLayout *pango_layout;
         int text_width;
         int text_height;
@@ -210,16 +237,12 @@ size_control (ply_label_plugin_control_t *label, bool force)
                 return;
         }
 
-        cairo_context = get_cairo_context_for_sizing (label);
-
-        pango_layout = init_pango_text_layout (cairo_context, label->text, label->fontdesc, label->alignment, label->width);
+        pango_layout = get_pango_text_layout (label);
 
         pango_layout_get_size (pango_layout, &text_width, &text_height);
         label->area.width = (long) ((double) text_width / PANGO_SCALE);
         label->area.height = (long) ((double) text_height / PANGO_SCALE);
 
-        g_object_unref (pango_layout);
-        cairo_destroy (cairo_context);
         label->needs_size_update = false;
 }
 
@@ -231,39 +254,27 @@ draw_control (ply_label_plugin_control_t *label,
               unsigned long               width,
               unsigned long               height)
 {
-        cairo_t *cairo_context;
-        PangoLayout *pango_layout;
-        long center_x;
-        long center_y;
-        int text_width;
-        int text_height;
+        ply_rectangle_t clip_area;
+        uint32_t scale;
 
         if (label->is_hidden)
                 return;
 
-        cairo_context = get_cairo_context_for_pixel_buffer (label, pixel_buffer, &center_x, &center_y);
-
-        pango_layout = init_pango_text_layout (cairo_context, label->text, label->fontdesc, label->alignment, label->width);
-
-        pango_layout_get_size (pango_layout, &text_width, &text_height);
-        label->area.width = (long) ((double) text_width / PANGO_SCALE);
-        label->area.height = (long) ((double) text_height / PANGO_SCALE);
-
-        cairo_rectangle (cairo_context, x - center_x, y - center_y, width, height);
-        cairo_clip (cairo_context);
-        cairo_move_to (cairo_context,
-                       label->area.x - center_x,
-                       label->area.y - center_y);
-        cairo_set_source_rgba (cairo_context,
-                               label->red,
-                               label->green,
-                               label->blue,
-                               label->alpha);
-        pango_cairo_show_layout (cairo_context,
-                                 pango_layout);
+        size_control (label, true);
 
-        g_object_unref (pango_layout);
-        cairo_destroy (cairo_context);
+        scale = ply_pixel_buffer_get_device_scale (pixel_buffer);
+        update_bitmap (label, scale);
+
+        /* The clip is in the device pixels of the bitmap */
+        clip_area.x = x * scale;
+        clip_area.y = y * scale;
+        clip_area.width = width * scale;
+        clip_area.height = height * scale;
+        ply_pixel_buffer_fill_with_buffer_with_clip (pixel_buffer,
+                                                     label->bitmap,
+                                                     label->area.x + label->bitmap_x,
+                                                     label->area.y + label->bitmap_y,
+                                                     &clip_area);
 }
 
 static void
@@ -289,6 +300,7 @@ set_alignment_for_control (ply_label_plugin_control_t *label,
         if (label->alignment != pango_alignment) {
                 dirty_area = label->area;
                 label->alignment = pango_alignment;
+                invalidate_layout (label);
                 size_control (label, false);
                 if (!label->is_hidden && label->display != NULL)
                         ply_pixel_display_draw_area (label->display,
@@ -306,6 +318,7 @@ set_width_for_control (ply_label_plugin_control_t *label,
         if (label->width != width) {
                 dirty_area = label->area;
                 label->width = width;
+                invalidate_layout (label);
                 size_control (label, false);
                 if (!label->is_hidden && label->display != NULL)
                         ply_pixel_display_draw_area (label->display,
@@ -320,10 +333,11 @@ set_text_for_control (ply_label_plugin_control_t *label,
 {
         ply_rectangle_t dirty_area;
 
-        if (label->text != text) {
+        if (label->text == NULL || strcmp (label->text, text) != 0) {
                 dirty_area = label->area;
                 free (label->text);
                 label->text = strdup (text);
+                invalidate_layout (label);
                 size_control (label, false);
                 if (!label->is_hidden && label->display != NULL)
                         ply_pixel_display_draw_area (label->display,
@@ -338,13 +352,15 @@ set_font_for_control (ply_label_plugin_control_t *label,
 {
         ply_rectangle_t dirty_area;
 
-        if (label->fontdesc != fontdesc) {
+        if (label->fontdesc == NULL || fontdesc == NULL ?
+            label->fontdesc != fontdesc : strcmp (label->fontdesc, fontdesc) != 0) {
                 dirty_area = label->area;
                 free (label->fontdesc);
                 if (fontdesc)
                         label->fontdesc = strdup (fontdesc);
                 else
                         label->fontdesc = NULL;
+                invalidate_layout (label);
                 size_control (label, false);
                 if (!label->is_hidden && label->display != NULL)
                         ply_pixel_display_draw_area (label->display,
@@ -360,6 +376,10 @@ set_color_for_control (ply_label_plugin_control_t *label,
                        float                       blue,
                        float                       alpha)
 {
+        if (label->red != red || label->green != green ||
+            label->blue != blue || label->alpha != alpha)
+                clear_bitmap (label);
+
         label->red = red;
         label->green = green;
         label->blue = blue;
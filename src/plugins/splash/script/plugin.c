@@ -55,8 +55,10 @@
 
 #include "script.h"
 #include "script-parse.h"
+#include "script-cache.h"
 #include "script-object.h"
 #include "script-execute.h"
+#include "script-profile.h"
 #include "script-lib-image.h"
 #include "script-lib-sprite.h"
 #include "script-lib-plymouth.h"
@@ -69,6 +71,13 @@
 #define FRAMES_PER_SECOND 50
 #endif
 
+/* When ticks take longer than a frame, at most this many draws in a row
+ * are put off so the script can catch up */
+#define MAX_SKIPPED_DRAWS 4
+
+/* Tick costs are traced once this many have been measured */
+#define TICK_COST_SAMPLES 256
+
 struct _ply_boot_splash_plugin
 {
         ply_event_loop_t           *loop;
@@ -78,6 +87,7 @@ struct _ply_boot_splash_plugin
 
         char                       *script_filename;
         char                       *image_dir;
+        char                       *rotation_step;
 
         ply_list_t                 *script_env_vars;
         script_op_t                *script_main_op;
@@ -89,6 +99,18 @@ struct _ply_boot_splash_plugin
         script_lib_math_data_t     *script_math_lib;
         script_lib_string_data_t   *script_string_lib;
 
+        char                       *profile_filename;
+        script_profile_t           *profile;
+
+        double                      tick_deadline;      /* when the next tick is due */
+        double                      last_tick_time;
+        double                      draw_cost;
+        int                         skipped_draws;      /* in a row */
+        unsigned long               total_skipped_draws;
+        unsigned long               missed_deadlines;
+        double                      tick_costs[TICK_COST_SAMPLES];
+        int                         tick_cost_count;
+
         uint32_t                    is_animating : 1;
 };
 
@@ -163,10 +185,43 @@ add_script_env_var (const char *group_name,
         ply_list_append_data (script_env_vars, new_env_var);
 }
 
+/* The profile is written where plymouth.script-profile= on the kernel
+ * command line or ScriptProfile= in plymouthd.conf says, or to the runtime
+ * directory if plymouth.script-profile is given without a file.
+ */
+static char *
+get_profile_filename (void)
+{
+        ply_key_file_t *key_file;
+        char *filename;
+
+        filename = ply_kernel_command_line_get_key_value ("plymouth.script-profile=");
+        if (filename != NULL)
+                return filename;
+        if (ply_kernel_command_line_has_argument ("plymouth.script-profile"))
+                return strdup (PLYMOUTH_RUNTIME_DIR "/script-profile");
+
+        key_file = ply_key_file_new (PLYMOUTH_CONF_DIR "plymouthd.conf");
+        if (ply_key_file_load (key_file))
+                filename = ply_key_file_get_value (key_file, "Daemon", "ScriptProfile");
+        ply_key_file_free (key_file);
+        return filename;
+}
+
 static ply_boot_splash_plugin_t *
 create_plugin (ply_key_file_t *key_file)
 {
         ply_boot_splash_plugin_t *plugin;
+        char *interpreter;
+
+        /* The tree walker is kept around so the bytecode interpreter can
+         * be checked against it */
+        interpreter = ply_kernel_command_line_get_key_value ("plymouth.script-interpreter=");
+        if (interpreter != NULL && strcmp (interpreter, "tree") == 0) {
+                ply_trace ("using tree walking script interpreter");
+                script_execute_set_use_bytecode (false);
+        }
+        free (interpreter);
 
         plugin = calloc (1, sizeof(ply_boot_splash_plugin_t));
         plugin->image_dir = ply_key_file_get_value (key_file,
@@ -175,6 +230,13 @@ create_plugin (ply_key_file_t *key_file)
         plugin->script_filename = ply_key_file_get_value (key_file,
                                                           "script",
                                                           "ScriptFile");
+        plugin->rotation_step = ply_key_file_get_value (key_file,
+                                                        "script",
+                                                        "RotationStep");
+
+        plugin->profile_filename = get_profile_filename ();
+        if (plugin->profile_filename != NULL)
+                ply_trace ("profiling script to %s", plugin->profile_filename);
 
         plugin->script_env_vars = ply_list_new ();
         ply_key_file_foreach_entry (key_file, add_script_env_var, plugin->script_env_vars);
@@ -212,26 +274,131 @@ destroy_plugin (ply_boot_splash_plugin_t *plugin)
         ply_list_free (plugin->script_env_vars);
         free (plugin->script_filename);
         free (plugin->image_dir);
+        free (plugin->rotation_step);
+        free (plugin->profile_filename);
         free (plugin);
 }
 
+static int
+compare_tick_costs (const void *element_a,
+                    const void *element_b)
+{
+        double cost_a = *(const double *) element_a;
+        double cost_b = *(const double *) element_b;
+
+        if (cost_a < cost_b) return -1;
+        if (cost_a > cost_b) return 1;
+        return 0;
+}
+
+static void
+trace_tick_costs (ply_boot_splash_plugin_t *plugin)
+{
+        int count = plugin->tick_cost_count;
+
+        if (count == 0)
+                return;
+
+        qsort (plugin->tick_costs, count, sizeof(double), compare_tick_costs);
+        ply_trace ("ticks took %.2fms (p50) %.2fms (p99), "
+                   "%lu deadlines missed, %lu draws skipped so far",
+                   plugin->tick_costs[count / 2] * 1000,
+                   plugin->tick_costs[(count * 99) / 100] * 1000,
+                   plugin->missed_deadlines,
+                   plugin->total_skipped_draws);
+        plugin->tick_cost_count = 0;
+}
+
+/* Each tick runs the script's refresh function with the time since the
+ * last one, then draws what changed.  Ticks are due a frame apart and the
+ * timeout is set for whatever is left of the frame.  If drawing would run
+ * into the next tick, the sprites are only updated and their damage drawn
+ * later, so the script's own time keeps up on machines too slow for the
+ * refresh rate.
+ */
 static void
 on_timeout (ply_boot_splash_plugin_t *plugin)
 {
-        double sleep_time;
+        double frame_time;
+        double start_time;
+        double draw_start_time;
+        double end_time;
+        double elapsed;
+        double spare_time;
+        unsigned long collected;
+        unsigned long allocations_before;
+        unsigned long allocations_after;
+        unsigned long live;
+
+        if (plugin->script_plymouth_lib->refresh_rate > 0)
+                frame_time = 1.0 / plugin->script_plymouth_lib->refresh_rate;
+        else
+                frame_time = 1.0 / FRAMES_PER_SECOND;
+
+        start_time = ply_get_timestamp ();
+        if (plugin->last_tick_time > 0)
+                elapsed = start_time - plugin->last_tick_time;
+        else
+                elapsed = frame_time;
+        plugin->last_tick_time = start_time;
+
+        if (start_time - plugin->tick_deadline > frame_time)
+                plugin->missed_deadlines++;
+
+        script_obj_get_allocation_stats (&allocations_before, NULL);
+        script_lib_plymouth_on_refresh (plugin->script_state,
+                                        plugin->script_plymouth_lib,
+                                        elapsed);
+
+        if (plugin->profile != NULL)
+                script_profile_enter_section (plugin->profile, "sprite refresh");
+        draw_start_time = ply_get_timestamp ();
+        if (draw_start_time + plugin->draw_cost > plugin->tick_deadline + frame_time &&
+            plugin->skipped_draws < MAX_SKIPPED_DRAWS) {
+                script_lib_sprite_update (plugin->script_sprite_lib);
+                plugin->skipped_draws++;
+                plugin->total_skipped_draws++;
+        } else {
+                pause_displays (plugin);
+                script_lib_sprite_refresh (plugin->script_sprite_lib);
+                unpause_displays (plugin);
+                plugin->draw_cost = ply_get_timestamp () - draw_start_time;
+                plugin->skipped_draws = 0;
+        }
+        if (plugin->profile != NULL)
+                script_profile_leave (plugin->profile);
+
+        script_obj_get_allocation_stats (&allocations_after, &live);
+        if (allocations_after != allocations_before)
+                ply_trace ("refresh allocated %lu script objects, %lu live",
+                           allocations_after - allocations_before, live);
+
+        end_time = ply_get_timestamp ();
+        plugin->tick_costs[plugin->tick_cost_count++] = end_time - start_time;
+        if (plugin->tick_cost_count == TICK_COST_SAMPLES)
+                trace_tick_costs (plugin);
+
+        /* Ticks that could not be run in time are dropped rather than run
+         * back to back, the next one is passed the time they covered */
+        plugin->tick_deadline += frame_time;
+        if (plugin->tick_deadline < end_time)
+                plugin->tick_deadline = end_time;
+
+        spare_time = plugin->tick_deadline - end_time;
+        if (spare_time > 0) {
+                collected = script_obj_collect_cycles (MIN (spare_time, SCRIPT_OBJ_CYCLE_COLLECTION_BUDGET));
+                if (collected > 0)
+                        ply_trace ("freed %lu script objects in cycles, %lu live at most",
+                                   collected, script_obj_get_live_high_water_mark ());
+                end_time = ply_get_timestamp ();
+                if (plugin->tick_deadline < end_time)
+                        plugin->tick_deadline = end_time;
+        }
 
-        sleep_time = 1.0 / plugin->script_plymouth_lib->refresh_rate;
         ply_event_loop_watch_for_timeout (plugin->loop,
-                                          sleep_time,
+                                          plugin->tick_deadline - end_time,
                                           (ply_event_loop_timeout_handler_t)
                                           on_timeout, plugin);
-
-        script_lib_plymouth_on_refresh (plugin->script_state,
-                                        plugin->script_plymouth_lib);
-
-        pause_displays (plugin);
-        script_lib_sprite_refresh (plugin->script_sprite_lib);
-        unpause_displays (plugin);
 }
 
 static void
@@ -269,8 +436,13 @@ start_script_animation (ply_boot_splash_plugin_t *plugin)
 
         plugin->script_image_lib = script_lib_image_setup (plugin->script_state,
                                                            plugin->image_dir);
+        /* RotationStep= in the theme is in degrees */
+        if (plugin->rotation_step != NULL)
+                script_lib_image_set_rotation_step (plugin->script_image_lib,
+                                                    atof (plugin->rotation_step) * M_PI / 180);
         plugin->script_sprite_lib = script_lib_sprite_setup (plugin->script_state,
-                                                             plugin->displays);
+                                                             plugin->displays,
+                                                             plugin->script_image_lib);
         plugin->script_plymouth_lib = script_lib_plymouth_setup (plugin->script_state,
                                                                  plugin->mode,
                                                                  FRAMES_PER_SECOND);
@@ -278,13 +450,19 @@ start_script_animation (ply_boot_splash_plugin_t *plugin)
         plugin->script_string_lib = script_lib_string_setup (plugin->script_state);
 
         ply_trace ("executing script file");
+        if (plugin->profile != NULL)
+                script_profile_enter_section (plugin->profile, plugin->script_filename);
         script_return_t ret = script_execute (plugin->script_state,
                                               plugin->script_main_op);
         script_obj_unref (ret.object);
+        if (plugin->profile != NULL)
+                script_profile_leave (plugin->profile);
         if (plugin->keyboard != NULL)
                 ply_keyboard_add_input_handler (plugin->keyboard,
                                                 (ply_keyboard_input_handler_t)
                                                 on_keyboard_input, plugin);
+        plugin->tick_deadline = ply_get_timestamp ();
+        plugin->last_tick_time = 0;
         on_timeout (plugin);
 
         return true;
@@ -293,17 +471,35 @@ start_script_animation (ply_boot_splash_plugin_t *plugin)
 static bool
 start_animation (ply_boot_splash_plugin_t *plugin)
 {
+        script_cache_t *cache;
+        char *cache_filename;
+
         assert (plugin != NULL);
         assert (plugin->loop != NULL);
 
         if (plugin->is_animating)
                 return true;
 
+        if (plugin->profile_filename != NULL) {
+                plugin->profile = script_profile_new ();
+                script_execute_set_profile (plugin->profile);
+        }
+
+        /* plymouth-populate-initrd leaves the parsed script and libraries
+         * next to the script, anything missing or stale is parsed as usual */
+        asprintf (&cache_filename, "%s.cache", plugin->script_filename);
+        cache = script_cache_load (cache_filename);
+        free (cache_filename);
+        script_parse_set_cache (cache);
+
         ply_trace ("parsing script file");
         plugin->script_main_op = script_parse_file (plugin->script_filename);
 
         start_script_animation (plugin);
 
+        script_parse_set_cache (NULL);
+        script_cache_free (cache);
+
         plugin->is_animating = true;
         return true;
 }
@@ -314,6 +510,7 @@ stop_script_animation (ply_boot_splash_plugin_t *plugin)
         script_lib_plymouth_on_quit (plugin->script_state,
                                      plugin->script_plymouth_lib);
         script_lib_sprite_refresh (plugin->script_sprite_lib);
+        trace_tick_costs (plugin);
 
         if (plugin->loop != NULL)
                 ply_event_loop_stop_watching_for_timeout (plugin->loop,
@@ -328,6 +525,10 @@ stop_script_animation (ply_boot_splash_plugin_t *plugin)
         }
 
         script_state_destroy (plugin->script_state);
+        /* While the libraries are still around to free their natives */
+        ply_trace ("freed %lu script objects in cycles at quit, %lu live at most",
+                   script_obj_collect_cycles (INFINITY),
+                   script_obj_get_live_high_water_mark ());
         script_lib_sprite_destroy (plugin->script_sprite_lib);
         plugin->script_sprite_lib = NULL;
         script_lib_image_destroy (plugin->script_image_lib);
@@ -349,6 +550,16 @@ stop_animation (ply_boot_splash_plugin_t *plugin)
         stop_script_animation (plugin);
 
         script_parse_op_free (plugin->script_main_op);
+
+        if (plugin->profile != NULL) {
+                script_execute_set_profile (NULL);
+                if (script_profile_save (plugin->profile, plugin->profile_filename))
+                        ply_trace ("saved script profile to %s", plugin->profile_filename);
+                else
+                        ply_trace ("could not save script profile to %s: %m", plugin->profile_filename);
+                script_profile_free (plugin->profile);
+                plugin->profile = NULL;
+        }
 }
 
 static void
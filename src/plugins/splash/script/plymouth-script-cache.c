@@ -0,0 +1,109 @@
+/* plymouth-script-cache.c - write the parsed script of a theme to disk
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script.h"
+#include "script-cache.h"
+#include "script-parse.h"
+
+#include "script-lib-image.script.h"
+#include "script-lib-math.script.h"
+#include "script-lib-plymouth.script.h"
+#include "script-lib-sprite.script.h"
+#include "script-lib-string.script.h"
+
+static bool
+add_script (script_cache_t *cache,
+            const char     *name,
+            const char     *source)
+{
+        script_op_t *op = script_parse_string (source, name);
+
+        if (!op)
+                return false;
+        script_cache_add (cache, name, source, op);
+        script_parse_op_free (op);
+        return true;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        /* Each library is stored under the name the plugin parses it with */
+        const struct
+        {
+                const char *name;
+                const char *source;
+        } libraries[] = {
+                { "script-lib-image.script",    script_lib_image_string    },
+                { "script-lib-sprite.script",   script_lib_sprite_string   },
+                { "script-lib-plymouth.script", script_lib_plymouth_string },
+                { "script-lib-math.script",     script_lib_math_string     },
+                { "script-lib-string.script",   script_lib_string_string   },
+                { NULL,                         NULL                       }
+        };
+        script_cache_t *cache;
+        char *source_filename;
+        char *source;
+        int i;
+
+        if (argc != 3 && argc != 4) {
+                fprintf (stderr, "usage: %s SCRIPT-FILE CACHE-FILE [ROOT]\n", argv[0]);
+                return 1;
+        }
+
+        /* The script is read from below ROOT, but named as the daemon will
+         * see it once booted */
+        if (argc == 4)
+                asprintf (&source_filename, "%s%s", argv[3], argv[1]);
+        else
+                source_filename = strdup (argv[1]);
+
+        source = script_cache_read_file (source_filename);
+        if (!source) {
+                fprintf (stderr, "%s: could not read %s\n", argv[0], source_filename);
+                free (source_filename);
+                return 1;
+        }
+        free (source_filename);
+
+        cache = script_cache_new ();
+        for (i = 0; libraries[i].name; i++)
+                add_script (cache, libraries[i].name, libraries[i].source);
+
+        if (!add_script (cache, argv[1], source)) {
+                fprintf (stderr, "%s: could not parse %s\n", argv[0], argv[1]);
+                free (source);
+                script_cache_free (cache);
+                return 1;
+        }
+        free (source);
+
+        if (!script_cache_save (cache, argv[2])) {
+                fprintf (stderr, "%s: could not write %s: %m\n", argv[0], argv[2]);
+                script_cache_free (cache);
+                return 1;
+        }
+        script_cache_free (cache);
+        return 0;
+}
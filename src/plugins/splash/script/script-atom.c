@@ -0,0 +1,120 @@
+/* script-atom.c - interned strings used as script identifiers and hash keys
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ply-hashtable.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script-atom.h"
+
+typedef struct
+{
+        unsigned int hash;
+        int          refcount;
+        char         string[];
+} script_atom_entry_t;
+
+static ply_hashtable_t *script_atom_table = NULL;
+static const char *script_atom_index_cache[SCRIPT_ATOM_INDEX_CACHE_SIZE];
+
+static script_atom_entry_t *script_atom_get_entry (const char *atom)
+{
+        return (script_atom_entry_t *) (atom - offsetof (script_atom_entry_t, string));
+}
+
+const char *script_atom_lookup (const char *string)
+{
+        script_atom_entry_t *entry;
+
+        if (!script_atom_table) return NULL;
+        entry = ply_hashtable_lookup (script_atom_table, (void *) string);
+        if (!entry) return NULL;
+        return entry->string;
+}
+
+const char *script_atom_get (const char *string)
+{
+        script_atom_entry_t *entry;
+        size_t length;
+
+        if (!script_atom_table)
+                script_atom_table = ply_hashtable_new (ply_hashtable_string_hash,
+                                                       ply_hashtable_string_compare);
+
+        entry = ply_hashtable_lookup (script_atom_table, (void *) string);
+        if (entry) {
+                entry->refcount++;
+                return entry->string;
+        }
+
+        length = strlen (string);
+        entry = malloc (sizeof(script_atom_entry_t) + length + 1);
+        entry->hash = ply_hashtable_string_hash ((void *) string);
+        entry->refcount = 1;
+        memcpy (entry->string, string, length + 1);
+        ply_hashtable_insert (script_atom_table, entry->string, entry);
+        return entry->string;
+}
+
+const char *script_atom_ref (const char *atom)
+{
+        script_atom_get_entry (atom)->refcount++;
+        return atom;
+}
+
+void script_atom_unref (const char *atom)
+{
+        script_atom_entry_t *entry;
+
+        if (!atom) return;
+        entry = script_atom_get_entry (atom);
+        assert (entry->refcount > 0);
+        entry->refcount--;
+        if (entry->refcount > 0) return;
+        ply_hashtable_remove (script_atom_table, entry->string);
+        free (entry);
+}
+
+/* Small non-negative integers are the keys of every array, so keep their
+ * atoms around rather than formatting and looking them up each time.
+ */
+const char *script_atom_from_index (int index)
+{
+        char name[16];
+
+        if (index >= 0 && index < SCRIPT_ATOM_INDEX_CACHE_SIZE) {
+                if (!script_atom_index_cache[index]) {
+                        snprintf (name, sizeof(name), "%d", index);
+                        script_atom_index_cache[index] = script_atom_get (name);
+                }
+                return script_atom_ref (script_atom_index_cache[index]);
+        }
+        snprintf (name, sizeof(name), "%d", index);
+        return script_atom_get (name);
+}
+
+unsigned int script_atom_hash (void *atom)
+{
+        return script_atom_get_entry (atom)->hash;
+}
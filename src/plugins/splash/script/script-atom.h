@@ -0,0 +1,36 @@
+/* script-atom.h - interned strings used as script identifiers and hash keys
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_ATOM_H
+#define SCRIPT_ATOM_H
+
+/* An atom is a reference counted string of which there is only ever one
+ * copy, so two atoms are equal exactly when their pointers are.  Atoms are
+ * ordinary nul terminated strings and can be read as such.  The hash of
+ * the string is computed once when the atom is created.
+ */
+
+#define SCRIPT_ATOM_INDEX_CACHE_SIZE 1024
+
+const char *script_atom_get (const char *string);
+const char *script_atom_lookup (const char *string);
+const char *script_atom_ref (const char *atom);
+void script_atom_unref (const char *atom);
+const char *script_atom_from_index (int index);
+unsigned int script_atom_hash (void *atom);
+
+#endif /* SCRIPT_ATOM_H */
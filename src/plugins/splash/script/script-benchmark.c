@@ -0,0 +1,428 @@
+/* script-benchmark.c - time theme scripts without a display
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#include "config.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include "ply-pixel-buffer.h"
+#include "ply-utils.h"
+
+#include "script.h"
+#include "script-cache.h"
+#include "script-parse.h"
+#include "script-execute.h"
+#include "script-object.h"
+#include "script-lib-image.h"
+#include "script-lib-sprite.h"
+#include "script-lib-plymouth.h"
+#include "script-lib-math.h"
+#include "script-lib-string.h"
+
+#include "script-lib-image.script.h"
+#include "script-lib-math.script.h"
+#include "script-lib-plymouth.script.h"
+#include "script-lib-sprite.script.h"
+#include "script-lib-string.script.h"
+
+#define FRAMES_PER_SECOND 50
+#define DEFAULT_TICKS 500
+#define SCREEN_WIDTH 1024
+#define SCREEN_HEIGHT 768
+
+/* Scripts see time pass at the refresh rate however long a tick takes, so
+ * every run does the same work */
+static double virtual_time;
+
+static double
+get_virtual_time (void)
+{
+        return virtual_time;
+}
+
+typedef struct
+{
+        const char   *name;
+        script_obj_t *obj;
+} element_t;
+
+static void
+add_element (const char   *name,
+             script_obj_t *obj,
+             void         *user_data)
+{
+        element_t *element = malloc (sizeof(element_t));
+
+        element->name = name;
+        element->obj = obj;
+        ply_list_append_data (user_data, element);
+}
+
+static int
+compare_elements (void *element_a,
+                  void *element_b)
+{
+        return strcmp (((element_t *) element_a)->name,
+                       ((element_t *) element_b)->name);
+}
+
+/* Prints every value reachable from obj, one per line and sorted by
+ * name, so runs that should agree can be diffed */
+static void
+print_state (const char      *path,
+             script_obj_t    *obj,
+             ply_hashtable_t *seen)
+{
+        ply_list_t *elements;
+        ply_list_node_t *node;
+        char *element_path;
+
+        obj = script_obj_deref_direct (obj);
+        switch (obj->type) {
+        case SCRIPT_OBJ_TYPE_NULL:
+                printf ("%s = NULL\n", path);
+                break;
+        case SCRIPT_OBJ_TYPE_NUMBER:
+                printf ("%s = %.17g\n", path, obj->data.number);
+                break;
+        case SCRIPT_OBJ_TYPE_STRING:
+                printf ("%s = \"%s\"\n", path, obj->data.string);
+                break;
+        case SCRIPT_OBJ_TYPE_FUNCTION:
+                printf ("%s = function\n", path);
+                break;
+        case SCRIPT_OBJ_TYPE_NATIVE:
+                printf ("%s = %s\n", path, obj->data.native.class->name);
+                break;
+        case SCRIPT_OBJ_TYPE_EXTEND:
+                print_state (path, obj->data.dual_obj.obj_a, seen);
+                print_state (path, obj->data.dual_obj.obj_b, seen);
+                break;
+        case SCRIPT_OBJ_TYPE_HASH:
+                if (ply_hashtable_lookup (seen, obj)) {
+                        printf ("%s = seen\n", path);
+                        break;
+                }
+                ply_hashtable_insert (seen, obj, obj);
+
+                elements = ply_list_new ();
+                script_obj_hash_foreach (obj, add_element, elements);
+                ply_list_sort_stable (elements, compare_elements);
+                for (node = ply_list_get_first_node (elements);
+                     node;
+                     node = ply_list_get_next_node (elements, node)) {
+                        element_t *element = ply_list_node_get_data (node);
+
+                        asprintf (&element_path, "%s.%s", path, element->name);
+                        print_state (element_path, element->obj, seen);
+                        free (element_path);
+                        free (element);
+                }
+                ply_list_free (elements);
+                break;
+        case SCRIPT_OBJ_TYPE_REF:
+                break;
+        }
+}
+
+static void
+print_results (script_state_t     *state,
+               ply_pixel_buffer_t *pixel_buffer)
+{
+        ply_hashtable_t *seen;
+        uint32_t *pixels;
+        uint64_t hash = 14695981039346656037ULL;
+        size_t i;
+
+        seen = ply_hashtable_new (NULL, NULL);
+        print_state ("global", state->global, seen);
+        ply_hashtable_free (seen);
+
+        /* 64-bit FNV-1a of what the sprites drew */
+        pixels = ply_pixel_buffer_get_argb32_data (pixel_buffer);
+        for (i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++) {
+                hash ^= pixels[i];
+                hash *= 1099511628211ULL;
+        }
+        printf ("pixels = %016llx\n", (unsigned long long) hash);
+}
+
+/* Does what plymouth-populate-initrd and the plugin do with a script
+ * cache: parses the script and libraries, writes them to a cache file and
+ * loads that back.  Everything has to be found in the loaded cache.
+ */
+static script_cache_t *
+make_cache (const char *filename)
+{
+        const struct
+        {
+                const char *name;
+                const char *source;
+        } libraries[] = {
+                { "script-lib-image.script",    script_lib_image_string    },
+                { "script-lib-sprite.script",   script_lib_sprite_string   },
+                { "script-lib-plymouth.script", script_lib_plymouth_string },
+                { "script-lib-math.script",     script_lib_math_string     },
+                { "script-lib-string.script",   script_lib_string_string   },
+                { filename,                     NULL                       },
+                { NULL,                         NULL                       }
+        };
+        script_cache_t *cache;
+        script_op_t *op;
+        const char *tmpdir;
+        char *cache_filename;
+        char *source;
+        bool saved;
+        int i;
+
+        cache = script_cache_new ();
+        for (i = 0; libraries[i].name; i++) {
+                source = libraries[i].source ? strdup (libraries[i].source)
+                                             : script_cache_read_file (filename);
+                op = source ? script_parse_string (source, libraries[i].name) : NULL;
+                if (op == NULL) {
+                        fprintf (stderr, "could not parse %s\n", libraries[i].name);
+                        free (source);
+                        script_cache_free (cache);
+                        return NULL;
+                }
+                script_cache_add (cache, libraries[i].name, source, op);
+                script_parse_op_free (op);
+                free (source);
+        }
+
+        tmpdir = getenv ("TMPDIR");
+        asprintf (&cache_filename, "%s/script-benchmark-%d.cache",
+                  tmpdir ? tmpdir : "/tmp", (int) getpid ());
+        saved = script_cache_save (cache, cache_filename);
+        script_cache_free (cache);
+        cache = saved ? script_cache_load (cache_filename) : NULL;
+        unlink (cache_filename);
+        free (cache_filename);
+        if (cache == NULL) {
+                fprintf (stderr, "could not write and load a cache for %s\n", filename);
+                return NULL;
+        }
+
+        for (i = 0; libraries[i].name; i++) {
+                source = libraries[i].source ? strdup (libraries[i].source)
+                                             : script_cache_read_file (filename);
+                op = script_cache_lookup (cache, libraries[i].name, source);
+                free (source);
+                if (op == NULL) {
+                        fprintf (stderr, "%s is missing from the cache\n", libraries[i].name);
+                        script_cache_free (cache);
+                        return NULL;
+                }
+                script_parse_op_free (op);
+        }
+        return cache;
+}
+
+static bool
+run_benchmark (const char *image_dir,
+               const char *filename,
+               int         ticks,
+               bool        show_results,
+               bool        use_cache)
+{
+        script_state_t *state;
+        script_op_t *op;
+        script_return_t ret;
+        script_lib_image_data_t *image_lib;
+        script_lib_sprite_data_t *sprite_lib;
+        script_lib_plymouth_data_t *plymouth_lib;
+        script_lib_math_data_t *math_lib;
+        script_lib_string_data_t *string_lib;
+        ply_list_t *displays;
+        ply_pixel_buffer_t *pixel_buffer;
+        script_number_t ops_per_tick;
+        unsigned long allocations_before;
+        unsigned long allocations_after;
+        unsigned long live_before;
+        unsigned long live_after;
+        double frame_time;
+        double start_time;
+        double elapsed;
+        script_cache_t *cache = NULL;
+        const char *name;
+        int tick;
+
+        if (use_cache) {
+                cache = make_cache (filename);
+                if (cache == NULL)
+                        return false;
+                script_parse_set_cache (cache);
+        }
+
+        op = script_parse_file (filename);
+        if (op == NULL) {
+                fprintf (stderr, "could not parse %s\n", filename);
+                script_parse_set_cache (NULL);
+                script_cache_free (cache);
+                return false;
+        }
+
+        script_obj_get_allocation_stats (NULL, &live_before);
+        displays = ply_list_new ();
+        pixel_buffer = ply_pixel_buffer_new (SCREEN_WIDTH, SCREEN_HEIGHT);
+        virtual_time = 0;
+
+        state = script_state_new (NULL);
+        image_lib = script_lib_image_setup (state, (char *) image_dir);
+        sprite_lib = script_lib_sprite_setup (state, displays, image_lib);
+        script_lib_sprite_set_pixel_buffer (sprite_lib, pixel_buffer);
+        sprite_lib->get_timestamp = get_virtual_time;
+        plymouth_lib = script_lib_plymouth_setup (state,
+                                                  PLY_BOOT_SPLASH_MODE_BOOT_UP,
+                                                  FRAMES_PER_SECOND);
+        math_lib = script_lib_math_setup (state);
+        string_lib = script_lib_string_setup (state);
+
+        script_parse_set_cache (NULL);
+        script_cache_free (cache);
+
+        /* Math.Random gives the same numbers on every run */
+        srand (1);
+
+        ret = script_execute (state, op);
+        script_obj_unref (ret.object);
+        script_lib_sprite_refresh (sprite_lib);
+
+        /* Scripts doing a known amount of work each tick say how much */
+        ops_per_tick = script_obj_hash_get_number (state->global, "ops_per_tick");
+        if (!(ops_per_tick > 0))
+                ops_per_tick = 1;
+
+        if (plymouth_lib->refresh_rate > 0)
+                frame_time = 1.0 / plymouth_lib->refresh_rate;
+        else
+                frame_time = 1.0 / FRAMES_PER_SECOND;
+
+        script_obj_get_allocation_stats (&allocations_before, NULL);
+        start_time = ply_get_timestamp ();
+        for (tick = 0; tick < ticks; tick++) {
+                virtual_time += frame_time;
+                script_lib_plymouth_on_refresh (state, plymouth_lib, frame_time);
+                script_lib_sprite_refresh (sprite_lib);
+                /* The plugin does this in the time left before the next tick */
+                script_obj_collect_cycles (SCRIPT_OBJ_CYCLE_COLLECTION_BUDGET);
+        }
+        elapsed = ply_get_timestamp () - start_time;
+        script_obj_get_allocation_stats (&allocations_after, &live_after);
+
+        name = strrchr (filename, '/');
+        name = name != NULL ? name + 1 : filename;
+        if (show_results) {
+                printf ("# %s\n", name);
+                print_results (state, pixel_buffer);
+        } else {
+                printf ("%s\t%d\t%.0f\t%.1f\t%lu\n",
+                        name,
+                        ticks,
+                        ticks * ops_per_tick / elapsed,
+                        (double) (allocations_after - allocations_before) / ticks,
+                        live_after - live_before);
+        }
+
+        script_lib_plymouth_on_quit (state, plymouth_lib);
+        script_state_destroy (state);
+        script_obj_collect_cycles (INFINITY);
+        script_lib_sprite_destroy (sprite_lib);
+        script_lib_image_destroy (image_lib);
+        script_lib_plymouth_destroy (plymouth_lib);
+        script_lib_math_destroy (math_lib);
+        script_lib_string_destroy (string_lib);
+        script_parse_op_free (op);
+        ply_pixel_buffer_free (pixel_buffer);
+        ply_list_free (displays);
+
+        return true;
+}
+
+static int
+usage (const char *program)
+{
+        fprintf (stderr,
+                 "usage: %s [-t TICKS] [-i tree|bytecode] [-n] [-r] [-c] IMAGE-DIR SCRIPT-FILE...\n",
+                 program);
+        return 1;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+        bool show_results = false;
+        bool use_cache = false;
+        int ticks = DEFAULT_TICKS;
+        int status = 0;
+        int option;
+        int i;
+
+        while ((option = getopt (argc, argv, "t:i:nrc")) != -1) {
+                switch (option) {
+                case 't':
+                        ticks = atoi (optarg);
+                        if (ticks <= 0)
+                                return usage (argv[0]);
+                        break;
+                case 'i':
+                        /* The tree walker is kept to check the bytecode against */
+                        if (strcmp (optarg, "tree") == 0)
+                                script_execute_set_use_bytecode (false);
+                        else if (strcmp (optarg, "bytecode") == 0)
+                                script_execute_set_use_bytecode (true);
+                        else
+                                return usage (argv[0]);
+                        break;
+                case 'n':
+                        /* Run scripts as written, without folding constants */
+                        script_parse_set_optimize (false);
+                        break;
+                case 'r':
+                        /* Print the state each script ends in instead of timings */
+                        show_results = true;
+                        break;
+                case 'c':
+                        /* Run scripts as read back from a script cache */
+                        use_cache = true;
+                        break;
+                default:
+                        return usage (argv[0]);
+                }
+        }
+
+        if (argc - optind < 2)
+                return usage (argv[0]);
+
+        /* One line per script, tab separated, for comparing between builds */
+        if (!show_results)
+                printf ("# script\tticks\tops/s\tallocations/tick\tlive\n");
+        for (i = optind + 1; i < argc; i++) {
+                if (!run_benchmark (argv[optind], argv[i], ticks, show_results, use_cache))
+                        status = 1;
+        }
+
+        return status;
+}
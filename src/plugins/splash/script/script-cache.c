@@ -0,0 +1,851 @@
+/* script-cache.c - pre-parsed scripts saved to disk
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include "ply-logger.h"
+#include "ply-readahead.h"
+#include "ply-utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "script.h"
+#include "script-atom.h"
+#include "script-debug.h"
+#include "script-parse.h"
+#include "script-cache.h"
+
+/* The file starts with a magic string, the format version, a byte order
+ * mark, the size of a script number and the version of plymouth that
+ * wrote it.  A file that does not match all of these is ignored.  Then
+ * follows the number of entries and each entry as its name, the hash of
+ * its source, the serialized tree and a hash of that.  Numbers are stored
+ * in host byte order, as the file is read on the machine that wrote it.
+ *
+ * A serialized tree starts with a table of the strings it uses, which
+ * nodes then refer to by index.  Every node is its type as a single byte
+ * (or SCRIPT_CACHE_NODE_NONE for a missing node) followed by its location
+ * and its contents.
+ */
+#define SCRIPT_CACHE_MAGIC          "PLYSCRPT"
+#define SCRIPT_CACHE_FORMAT_VERSION 1
+#define SCRIPT_CACHE_BYTE_ORDER     0x01020304
+#define SCRIPT_CACHE_NODE_NONE      0xff
+
+typedef struct
+{
+        char  *data;
+        size_t size;
+        size_t capacity;
+} script_cache_buffer_t;
+
+typedef struct
+{
+        char    *name;
+        uint64_t hash;
+        char    *data;
+        size_t   size;
+} script_cache_entry_t;
+
+struct script_cache_t
+{
+        ply_list_t *entries;
+};
+
+typedef struct
+{
+        script_cache_buffer_t *buffer;
+        ply_hashtable_t       *string_indices;
+        ply_list_t            *strings;
+        uint32_t               string_count;
+} script_cache_writer_t;
+
+typedef struct
+{
+        const char   *data;
+        size_t        size;
+        size_t        offset;
+        bool          failed;
+        const char  **strings;          /* atoms */
+        uint32_t      string_count;
+} script_cache_reader_t;
+
+static uint64_t script_cache_hash (const char *bytes,
+                                   size_t      size)
+{
+        uint64_t hash = 14695981039346656037ULL;        /* 64 bit FNV-1a */
+        size_t i;
+
+        for (i = 0; i < size; i++) {
+                hash ^= (unsigned char) bytes[i];
+                hash *= 1099511628211ULL;
+        }
+        return hash;
+}
+
+static void script_cache_buffer_append (script_cache_buffer_t *buffer,
+                                        const void            *bytes,
+                                        size_t                 size)
+{
+        if (buffer->size + size > buffer->capacity) {
+                while (buffer->size + size > buffer->capacity)
+                        buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+                buffer->data = realloc (buffer->data, buffer->capacity);
+        }
+        memcpy (buffer->data + buffer->size, bytes, size);
+        buffer->size += size;
+}
+
+static void script_cache_buffer_append_uint8 (script_cache_buffer_t *buffer,
+                                              uint8_t                value)
+{
+        script_cache_buffer_append (buffer, &value, sizeof(value));
+}
+
+static void script_cache_buffer_append_uint32 (script_cache_buffer_t *buffer,
+                                               uint32_t               value)
+{
+        script_cache_buffer_append (buffer, &value, sizeof(value));
+}
+
+static void script_cache_buffer_append_string (script_cache_buffer_t *buffer,
+                                               const char            *string)
+{
+        uint32_t length = strlen (string);
+
+        script_cache_buffer_append_uint32 (buffer, length);
+        script_cache_buffer_append (buffer, string, length);
+}
+
+/* Writing */
+
+static void script_cache_write_string (script_cache_writer_t *writer,
+                                       const char            *string)
+{
+        uintptr_t index = (uintptr_t) ply_hashtable_lookup (writer->string_indices,
+                                                            (void *) string);
+
+        if (!index) {
+                index = ++writer->string_count;
+                ply_hashtable_insert (writer->string_indices, (void *) string, (void *) index);
+                ply_list_append_data (writer->strings, (void *) string);
+        }
+        script_cache_buffer_append_uint32 (writer->buffer, index - 1);
+}
+
+static void script_cache_write_location (script_cache_writer_t *writer,
+                                         void                  *element)
+{
+        script_debug_location_t *location = script_debug_lookup_element (element);
+        int32_t line_index = location ? location->line_index : 0;
+        int32_t column_index = location ? location->column_index : 0;
+
+        script_cache_write_string (writer, location ? location->name : "");
+        script_cache_buffer_append (writer->buffer, &line_index, sizeof(line_index));
+        script_cache_buffer_append (writer->buffer, &column_index, sizeof(column_index));
+}
+
+static void script_cache_write_op (script_cache_writer_t *writer,
+                                   script_op_t           *op);
+
+static void script_cache_write_exp (script_cache_writer_t *writer,
+                                    script_exp_t          *exp);
+
+static void script_cache_write_exp_list (script_cache_writer_t *writer,
+                                         ply_list_t            *list)
+{
+        ply_list_node_t *node;
+
+        script_cache_buffer_append_uint32 (writer->buffer, ply_list_get_length (list));
+        for (node = ply_list_get_first_node (list);
+             node;
+             node = ply_list_get_next_node (list, node))
+                script_cache_write_exp (writer, ply_list_node_get_data (node));
+}
+
+static void script_cache_write_exp (script_cache_writer_t *writer,
+                                    script_exp_t          *exp)
+{
+        ply_list_node_t *node;
+
+        if (!exp) {
+                script_cache_buffer_append_uint8 (writer->buffer, SCRIPT_CACHE_NODE_NONE);
+                return;
+        }
+        script_cache_buffer_append_uint8 (writer->buffer, exp->type);
+        script_cache_write_location (writer, exp);
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+        case SCRIPT_EXP_TYPE_HASH:
+                script_cache_write_exp (writer, exp->data.dual.sub_a);
+                script_cache_write_exp (writer, exp->data.dual.sub_b);
+                break;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                script_cache_write_exp (writer, exp->data.sub);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+                script_cache_buffer_append (writer->buffer,
+                                            &exp->data.number,
+                                            sizeof(exp->data.number));
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+                script_cache_write_string (writer, exp->data.string);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                script_cache_write_exp_list (writer, exp->data.parameters);
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                script_cache_write_exp (writer, exp->data.function_exe.name);
+                script_cache_write_exp_list (writer, exp->data.function_exe.parameters);
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                script_cache_buffer_append_uint32 (writer->buffer,
+                                                   ply_list_get_length (exp->data.function_def->parameters));
+                for (node = ply_list_get_first_node (exp->data.function_def->parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.function_def->parameters, node))
+                        script_cache_write_string (writer, ply_list_node_get_data (node));
+                script_cache_write_op (writer, exp->data.function_def->data.script);
+                break;
+        }
+}
+
+static void script_cache_write_op (script_cache_writer_t *writer,
+                                   script_op_t           *op)
+{
+        ply_list_node_t *node;
+
+        if (!op) {
+                script_cache_buffer_append_uint8 (writer->buffer, SCRIPT_CACHE_NODE_NONE);
+                return;
+        }
+        script_cache_buffer_append_uint8 (writer->buffer, op->type);
+        script_cache_write_location (writer, op);
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        case SCRIPT_OP_TYPE_RETURN:
+                script_cache_write_exp (writer, op->data.exp);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                script_cache_buffer_append_uint32 (writer->buffer,
+                                                   ply_list_get_length (op->data.list));
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node))
+                        script_cache_write_op (writer, ply_list_node_get_data (node));
+                break;
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                script_cache_write_exp (writer, op->data.cond_op.cond);
+                script_cache_write_op (writer, op->data.cond_op.op1);
+                script_cache_write_op (writer, op->data.cond_op.op2);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+}
+
+/* Reading.  A failed read leaves a complete tree with missing nodes, so
+ * whatever was built can be freed with script_parse_op_free.
+ */
+
+static bool script_cache_read (script_cache_reader_t *reader,
+                               void                  *bytes,
+                               size_t                 size)
+{
+        if (reader->failed || size > reader->size - reader->offset) {
+                reader->failed = true;
+                memset (bytes, 0, size);
+                return false;
+        }
+        memcpy (bytes, reader->data + reader->offset, size);
+        reader->offset += size;
+        return true;
+}
+
+static uint32_t script_cache_read_uint32 (script_cache_reader_t *reader)
+{
+        uint32_t value;
+
+        script_cache_read (reader, &value, sizeof(value));
+        return value;
+}
+
+static uint32_t script_cache_read_count (script_cache_reader_t *reader)
+{
+        uint32_t count = script_cache_read_uint32 (reader);
+
+        /* every item takes at least a byte */
+        if (count > reader->size - reader->offset) {
+                reader->failed = true;
+                return 0;
+        }
+        return count;
+}
+
+static char *script_cache_read_new_string (script_cache_reader_t *reader)
+{
+        uint32_t length = script_cache_read_count (reader);
+        char *string;
+
+        if (reader->failed) return NULL;
+        string = malloc (length + 1);
+        script_cache_read (reader, string, length);
+        string[length] = '\0';
+        return string;
+}
+
+static const char *script_cache_read_string (script_cache_reader_t *reader)
+{
+        uint32_t index = script_cache_read_uint32 (reader);
+
+        if (reader->failed || index >= reader->string_count) {
+                reader->failed = true;
+                return NULL;
+        }
+        return reader->strings[index];
+}
+
+static void script_cache_read_location (script_cache_reader_t *reader,
+                                        void                  *element)
+{
+        script_debug_location_t location;
+        int32_t line_index;
+        int32_t column_index;
+
+        location.name = (char *) script_cache_read_string (reader);
+        script_cache_read (reader, &line_index, sizeof(line_index));
+        script_cache_read (reader, &column_index, sizeof(column_index));
+        if (!location.name) location.name = (char *) "";
+        location.line_index = line_index;
+        location.column_index = column_index;
+        script_debug_add_element (element, &location);
+}
+
+static script_op_t *script_cache_read_op (script_cache_reader_t *reader);
+
+static script_exp_t *script_cache_read_exp (script_cache_reader_t *reader);
+
+static ply_list_t *script_cache_read_exp_list (script_cache_reader_t *reader)
+{
+        ply_list_t *list = ply_list_new ();
+        uint32_t count = script_cache_read_count (reader);
+        uint32_t i;
+
+        for (i = 0; i < count && !reader->failed; i++)
+                ply_list_append_data (list, script_cache_read_exp (reader));
+        return list;
+}
+
+static script_exp_t *script_cache_read_exp (script_cache_reader_t *reader)
+{
+        script_exp_t *exp;
+        const char *string;
+        ply_list_t *parameters;
+        uint32_t count;
+        uint32_t i;
+        uint8_t type;
+
+        script_cache_read (reader, &type, sizeof(type));
+        if (reader->failed || type == SCRIPT_CACHE_NODE_NONE) return NULL;
+        if (type > SCRIPT_EXP_TYPE_ASSIGN_EXTEND) {
+                reader->failed = true;
+                return NULL;
+        }
+
+        exp = malloc (sizeof(script_exp_t));
+        exp->type = type;
+        script_cache_read_location (reader, exp);
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+        case SCRIPT_EXP_TYPE_HASH:
+                exp->data.dual.sub_a = script_cache_read_exp (reader);
+                exp->data.dual.sub_b = script_cache_read_exp (reader);
+                break;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                exp->data.sub = script_cache_read_exp (reader);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+                script_cache_read (reader, &exp->data.number, sizeof(exp->data.number));
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+                string = script_cache_read_string (reader);
+                exp->data.string = string ? (char *) script_atom_ref (string) : NULL;
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                exp->data.parameters = script_cache_read_exp_list (reader);
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                exp->data.function_exe.name = script_cache_read_exp (reader);
+                exp->data.function_exe.parameters = script_cache_read_exp_list (reader);
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                parameters = ply_list_new ();
+                count = script_cache_read_count (reader);
+                for (i = 0; i < count && !reader->failed; i++) {
+                        string = script_cache_read_string (reader);
+                        if (string)
+                                ply_list_append_data (parameters, (void *) script_atom_ref (string));
+                }
+                exp->data.function_def = script_function_script_new (script_cache_read_op (reader),
+                                                                     NULL,
+                                                                     parameters);
+                break;
+        }
+        return exp;
+}
+
+static script_op_t *script_cache_read_op (script_cache_reader_t *reader)
+{
+        script_op_t *op;
+        uint32_t count;
+        uint32_t i;
+        uint8_t type;
+
+        script_cache_read (reader, &type, sizeof(type));
+        if (reader->failed || type == SCRIPT_CACHE_NODE_NONE) return NULL;
+        if (type > SCRIPT_OP_TYPE_CONTINUE) {
+                reader->failed = true;
+                return NULL;
+        }
+
+        op = malloc (sizeof(script_op_t));
+        op->type = type;
+        script_cache_read_location (reader, op);
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        case SCRIPT_OP_TYPE_RETURN:
+                op->data.exp = script_cache_read_exp (reader);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                op->data.list = ply_list_new ();
+                count = script_cache_read_count (reader);
+                for (i = 0; i < count && !reader->failed; i++)
+                        ply_list_append_data (op->data.list, script_cache_read_op (reader));
+                break;
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                op->data.cond_op.cond = script_cache_read_exp (reader);
+                op->data.cond_op.op1 = script_cache_read_op (reader);
+                op->data.cond_op.op2 = script_cache_read_op (reader);
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+        return op;
+}
+
+/* Entries */
+
+static script_cache_entry_t *script_cache_find_entry (script_cache_t *cache,
+                                                      const char     *name)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (cache->entries);
+             node;
+             node = ply_list_get_next_node (cache->entries, node)) {
+                script_cache_entry_t *entry = ply_list_node_get_data (node);
+                if (strcmp (entry->name, name) == 0)
+                        return entry;
+        }
+        return NULL;
+}
+
+static void script_cache_entry_free (script_cache_entry_t *entry)
+{
+        free (entry->name);
+        free (entry->data);
+        free (entry);
+}
+
+script_cache_t *script_cache_new (void)
+{
+        script_cache_t *cache = malloc (sizeof(script_cache_t));
+
+        cache->entries = ply_list_new ();
+        return cache;
+}
+
+void script_cache_free (script_cache_t *cache)
+{
+        ply_list_node_t *node;
+
+        if (!cache) return;
+        for (node = ply_list_get_first_node (cache->entries);
+             node;
+             node = ply_list_get_next_node (cache->entries, node))
+                script_cache_entry_free (ply_list_node_get_data (node));
+        ply_list_free (cache->entries);
+        free (cache);
+}
+
+void script_cache_add (script_cache_t *cache,
+                       const char     *name,
+                       const char     *source,
+                       script_op_t    *op)
+{
+        script_cache_buffer_t tree = { NULL, 0, 0 };
+        script_cache_buffer_t buffer = { NULL, 0, 0 };
+        script_cache_writer_t writer;
+        script_cache_entry_t *entry;
+        ply_list_node_t *node;
+
+        writer.buffer = &tree;
+        writer.string_indices = ply_hashtable_new (ply_hashtable_string_hash,
+                                                   ply_hashtable_string_compare);
+        writer.strings = ply_list_new ();
+        writer.string_count = 0;
+        script_cache_write_op (&writer, op);
+
+        script_cache_buffer_append_uint32 (&buffer, writer.string_count);
+        for (node = ply_list_get_first_node (writer.strings);
+             node;
+             node = ply_list_get_next_node (writer.strings, node))
+                script_cache_buffer_append_string (&buffer, ply_list_node_get_data (node));
+        script_cache_buffer_append (&buffer, tree.data, tree.size);
+        free (tree.data);
+        ply_hashtable_free (writer.string_indices);
+        ply_list_free (writer.strings);
+
+        entry = script_cache_find_entry (cache, name);
+        if (entry) {
+                free (entry->data);
+        } else {
+                entry = malloc (sizeof(script_cache_entry_t));
+                entry->name = strdup (name);
+                ply_list_append_data (cache->entries, entry);
+        }
+        entry->hash = script_cache_hash (source, strlen (source));
+        entry->data = buffer.data;
+        entry->size = buffer.size;
+}
+
+script_op_t *script_cache_lookup (script_cache_t *cache,
+                                  const char     *name,
+                                  const char     *source)
+{
+        script_cache_reader_t reader;
+        script_cache_entry_t *entry;
+        script_op_t *op;
+        uint32_t i;
+
+        entry = script_cache_find_entry (cache, name);
+        if (!entry) return NULL;
+        if (entry->hash != script_cache_hash (source, strlen (source))) {
+                ply_trace ("cached script %s does not match its source", name);
+                return NULL;
+        }
+
+        reader.data = entry->data;
+        reader.size = entry->size;
+        reader.offset = 0;
+        reader.failed = false;
+        reader.string_count = script_cache_read_count (&reader);
+        reader.strings = calloc (reader.string_count, sizeof(const char *));
+        for (i = 0; i < reader.string_count && !reader.failed; i++) {
+                char *string = script_cache_read_new_string (&reader);
+                if (string) reader.strings[i] = script_atom_get (string);
+                free (string);
+        }
+
+        op = script_cache_read_op (&reader);
+        if (!op || reader.offset != reader.size)
+                reader.failed = true;
+
+        for (i = 0; i < reader.string_count; i++)
+                script_atom_unref (reader.strings[i]);
+        free (reader.strings);
+
+        if (reader.failed) {
+                ply_trace ("cached script %s is corrupt", name);
+                script_parse_op_free (op);
+                return NULL;
+        }
+        return op;
+}
+
+/* Files */
+
+static bool script_cache_read_header (script_cache_reader_t *reader)
+{
+        char magic[sizeof(SCRIPT_CACHE_MAGIC) - 1];
+        char *version;
+        bool matches;
+
+        script_cache_read (reader, magic, sizeof(magic));
+        if (reader->failed || memcmp (magic, SCRIPT_CACHE_MAGIC, sizeof(magic)) != 0)
+                return false;
+        if (script_cache_read_uint32 (reader) != SCRIPT_CACHE_FORMAT_VERSION)
+                return false;
+        if (script_cache_read_uint32 (reader) != SCRIPT_CACHE_BYTE_ORDER)
+                return false;
+        if (script_cache_read_uint32 (reader) != sizeof(script_number_t))
+                return false;
+        version = script_cache_read_new_string (reader);
+        matches = version && strcmp (version, PACKAGE_VERSION) == 0;
+        free (version);
+        return matches && !reader->failed;
+}
+
+script_cache_t *script_cache_load (const char *filename)
+{
+        script_cache_reader_t reader = { NULL };
+        script_cache_t *cache;
+        uint64_t checksum;
+        uint32_t count;
+        uint32_t i;
+        char *data;
+        int fd;
+        struct stat info;
+
+        fd = open (filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return NULL;
+        if (fstat (fd, &info) < 0) {
+                close (fd);
+                return NULL;
+        }
+        ply_readahead_record_file (filename);
+        data = malloc (info.st_size);
+        if (!ply_read (fd, data, info.st_size)) {
+                ply_trace ("could not read script cache %s: %m", filename);
+                close (fd);
+                free (data);
+                return NULL;
+        }
+        close (fd);
+
+        reader.data = data;
+        reader.size = info.st_size;
+        if (!script_cache_read_header (&reader)) {
+                ply_trace ("script cache %s was written by a different version", filename);
+                free (data);
+                return NULL;
+        }
+
+        cache = script_cache_new ();
+        count = script_cache_read_count (&reader);
+        for (i = 0; i < count && !reader.failed; i++) {
+                script_cache_entry_t *entry = malloc (sizeof(script_cache_entry_t));
+                uint32_t size;
+
+                entry->name = script_cache_read_new_string (&reader);
+                script_cache_read (&reader, &entry->hash, sizeof(entry->hash));
+                size = script_cache_read_count (&reader);
+                entry->data = malloc (size);
+                entry->size = size;
+                script_cache_read (&reader, entry->data, size);
+                script_cache_read (&reader, &checksum, sizeof(checksum));
+                if (checksum != script_cache_hash (entry->data, size))
+                        reader.failed = true;
+                if (!entry->name || reader.failed) {
+                        script_cache_entry_free (entry);
+                        break;
+                }
+                ply_list_append_data (cache->entries, entry);
+        }
+        free (data);
+
+        if (reader.failed) {
+                ply_trace ("script cache %s is damaged", filename);
+                script_cache_free (cache);
+                return NULL;
+        }
+        ply_trace ("loaded %d cached scripts from %s", count, filename);
+        return cache;
+}
+
+bool script_cache_save (script_cache_t *cache,
+                        const char     *filename)
+{
+        script_cache_buffer_t buffer = { NULL, 0, 0 };
+        ply_list_node_t *node;
+        char *temporary_filename;
+        uint64_t checksum;
+        bool written;
+        int fd;
+
+        script_cache_buffer_append (&buffer, SCRIPT_CACHE_MAGIC, strlen (SCRIPT_CACHE_MAGIC));
+        script_cache_buffer_append_uint32 (&buffer, SCRIPT_CACHE_FORMAT_VERSION);
+        script_cache_buffer_append_uint32 (&buffer, SCRIPT_CACHE_BYTE_ORDER);
+        script_cache_buffer_append_uint32 (&buffer, sizeof(script_number_t));
+        script_cache_buffer_append_string (&buffer, PACKAGE_VERSION);
+        script_cache_buffer_append_uint32 (&buffer, ply_list_get_length (cache->entries));
+        for (node = ply_list_get_first_node (cache->entries);
+             node;
+             node = ply_list_get_next_node (cache->entries, node)) {
+                script_cache_entry_t *entry = ply_list_node_get_data (node);
+                script_cache_buffer_append_string (&buffer, entry->name);
+                script_cache_buffer_append (&buffer, &entry->hash, sizeof(entry->hash));
+                script_cache_buffer_append_uint32 (&buffer, entry->size);
+                script_cache_buffer_append (&buffer, entry->data, entry->size);
+                checksum = script_cache_hash (entry->data, entry->size);
+                script_cache_buffer_append (&buffer, &checksum, sizeof(checksum));
+        }
+
+        /* Write next to the destination and rename over it, so the daemon
+         * never sees half a file */
+        asprintf (&temporary_filename, "%s.XXXXXX", filename);
+        fd = mkstemp (temporary_filename);
+        if (fd < 0) {
+                free (temporary_filename);
+                free (buffer.data);
+                return false;
+        }
+        fchmod (fd, 0644);
+        written = ply_write (fd, buffer.data, buffer.size);
+        if (close (fd) < 0)
+                written = false;
+        if (written && rename (temporary_filename, filename) < 0)
+                written = false;
+        if (!written)
+                unlink (temporary_filename);
+        free (temporary_filename);
+        free (buffer.data);
+        return written;
+}
+
+char *script_cache_read_file (const char *filename)
+{
+        script_cache_buffer_t buffer = { NULL, 0, 0 };
+        char bytes[4096];
+        ssize_t bytes_read;
+        int fd;
+
+        fd = open (filename, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return NULL;
+        /* On a cache hit this is the only time the script gets read */
+        ply_readahead_record_file (filename);
+        while ((bytes_read = read (fd, bytes, sizeof(bytes))) != 0) {
+                if (bytes_read < 0) {
+                        if (errno == EINTR) continue;
+                        close (fd);
+                        free (buffer.data);
+                        return NULL;
+                }
+                script_cache_buffer_append (&buffer, bytes, bytes_read);
+        }
+        close (fd);
+        script_cache_buffer_append_uint8 (&buffer, '\0');
+        return buffer.data;
+}
@@ -0,0 +1,46 @@
+/* script-cache.h - pre-parsed scripts saved to disk
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_CACHE_H
+#define SCRIPT_CACHE_H
+
+#include <stdbool.h>
+#include "script.h"
+
+/* A cache holds the parsed op trees of a set of scripts.  Each tree is
+ * stored under the name the script was parsed with together with a hash
+ * of its source, and is only handed back for that exact name and source,
+ * so a stale cache is never used in place of the script it came from.
+ */
+
+typedef struct script_cache_t script_cache_t;
+
+script_cache_t *script_cache_new (void);
+script_cache_t *script_cache_load (const char *filename);
+bool script_cache_save (script_cache_t *cache,
+                        const char     *filename);
+void script_cache_free (script_cache_t *cache);
+void script_cache_add (script_cache_t *cache,
+                       const char     *name,
+                       const char     *source,
+                       script_op_t    *op);
+script_op_t *script_cache_lookup (script_cache_t *cache,
+                                  const char     *name,
+                                  const char     *source);
+char *script_cache_read_file (const char *filename);
+
+#endif /* SCRIPT_CACHE_H */
@@ -0,0 +1,615 @@
+/* script-compile.c - compilation of parsed scripts into bytecode
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script.h"
+#include "script-compile.h"
+#include "script-object.h"
+
+typedef struct script_compile_loop_t
+{
+        ply_list_t                   *break_ops;
+        ply_list_t                   *continue_ops;
+        struct script_compile_loop_t *parent;
+} script_compile_loop_t;
+
+typedef struct
+{
+        script_code_t         *code;
+        int                    depth;
+        script_compile_loop_t *loop;
+        ply_hashtable_t       *slots;       /* name to slot index + 1, NULL at the top level */
+        bool                   uses_local;
+} script_compile_t;
+
+static void script_compile_exp (script_compile_t *compile,
+                                script_exp_t     *exp);
+static void script_compile_statement (script_compile_t *compile,
+                                      script_op_t      *op);
+
+static int script_compile_emit (script_compile_t     *compile,
+                                script_code_op_type_t type,
+                                void                 *element,
+                                int                   stack_change)
+{
+        script_code_t *code = compile->code;
+        script_code_op_t *op;
+
+        if (code->op_count == code->op_allocated) {
+                code->op_allocated = code->op_allocated ? code->op_allocated * 2 : 16;
+                code->ops = realloc (code->ops, code->op_allocated * sizeof(script_code_op_t));
+        }
+        op = &code->ops[code->op_count];
+        memset (op, 0, sizeof(script_code_op_t));
+        op->type = type;
+        op->element = element;
+
+        compile->depth += stack_change;
+        assert (compile->depth >= 0);
+        if (compile->depth > code->stack_size)
+                code->stack_size = compile->depth;
+
+        return code->op_count++;
+}
+
+static int script_compile_emit_jump (script_compile_t     *compile,
+                                     script_code_op_type_t type,
+                                     void                 *element,
+                                     int                   stack_change)
+{
+        int index = script_compile_emit (compile, type, element, stack_change);
+
+        compile->code->ops[index].data.target = -1;
+        return index;
+}
+
+static void script_compile_patch_jump (script_compile_t *compile,
+                                       int               index)
+{
+        compile->code->ops[index].data.target = compile->code->op_count;
+}
+
+static int script_compile_get_slot (script_compile_t *compile,
+                                    const char       *name)
+{
+        int index;
+
+        if (!compile->slots)
+                return -1;
+        if (!strcmp (name, "_args")) {
+                compile->code->uses_args = true;
+                return -1;
+        }
+
+        index = (intptr_t) ply_hashtable_lookup (compile->slots, (void *) name);
+        if (index)
+                return index - 1;
+
+        index = compile->code->slot_count++;
+        ply_hashtable_insert (compile->slots, (void *) name, (void *) (intptr_t) (index + 1));
+        return index;
+}
+
+static void script_compile_dual (script_compile_t     *compile,
+                                 script_exp_t         *exp,
+                                 script_code_op_type_t type)
+{
+        script_compile_exp (compile, exp->data.dual.sub_a);
+        script_compile_exp (compile, exp->data.dual.sub_b);
+        script_compile_emit (compile, type, exp, -1);
+}
+
+static void script_compile_apply (script_compile_t     *compile,
+                                  script_exp_t         *exp,
+                                  script_code_op_type_t type,
+                                  script_obj_t *(*function)(script_obj_t *,
+                                                            script_obj_t *))
+{
+        script_compile_dual (compile, exp, type);
+        compile->code->ops[compile->code->op_count - 1].data.apply.function = function;
+        compile->code->ops[compile->code->op_count - 1].data.apply.exp_type = exp->type;
+}
+
+static void script_compile_cmp (script_compile_t       *compile,
+                                script_exp_t           *exp,
+                                script_obj_cmp_result_t condition)
+{
+        script_compile_dual (compile, exp, SCRIPT_CODE_OP_TYPE_CMP);
+        compile->code->ops[compile->code->op_count - 1].data.condition = condition;
+}
+
+static void script_compile_logic (script_compile_t *compile,
+                                  script_exp_t     *exp)
+{
+        script_code_op_type_t type;
+        int jump;
+
+        if (exp->type == SCRIPT_EXP_TYPE_AND)
+                type = SCRIPT_CODE_OP_TYPE_JUMP_IF_FALSE_OR_POP;
+        else
+                type = SCRIPT_CODE_OP_TYPE_JUMP_IF_TRUE_OR_POP;
+
+        script_compile_exp (compile, exp->data.dual.sub_a);
+        jump = script_compile_emit_jump (compile, type, exp, -1);
+        script_compile_exp (compile, exp->data.dual.sub_b);
+        script_compile_patch_jump (compile, jump);
+}
+
+static void script_compile_unary (script_compile_t *compile,
+                                  script_exp_t     *exp)
+{
+        int index;
+
+        script_compile_exp (compile, exp->data.sub);
+        if (exp->type == SCRIPT_EXP_TYPE_POS)
+                return;
+        index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_UNARY, exp, 0);
+        compile->code->ops[index].data.exp_type = exp->type;
+}
+
+static int script_compile_list_of_exps (script_compile_t *compile,
+                                        ply_list_t       *list)
+{
+        ply_list_node_t *node;
+        int count = 0;
+
+        for (node = ply_list_get_first_node (list);
+             node;
+             node = ply_list_get_next_node (list, node)) {
+                script_exp_t *sub = ply_list_node_get_data (node);
+                script_compile_exp (compile, sub);
+                count++;
+        }
+        return count;
+}
+
+static void script_compile_set (script_compile_t *compile,
+                                script_exp_t     *exp)
+{
+        int count = script_compile_list_of_exps (compile, exp->data.parameters);
+        int index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_MAKE_SET, exp, 1 - count);
+
+        compile->code->ops[index].data.count = count;
+}
+
+static void script_compile_func (script_compile_t *compile,
+                                 script_exp_t     *exp)
+{
+        script_exp_t *name_exp = exp->data.function_exe.name;
+        int count;
+        int index;
+
+        /* The callee and its "this" are resolved before the parameters are
+         * evaluated, leaving two slots under the parameters.
+         */
+        if (name_exp && name_exp->type == SCRIPT_EXP_TYPE_HASH &&
+            name_exp->data.dual.sub_b->type == SCRIPT_EXP_TYPE_TERM_STRING) {
+                script_compile_exp (compile, name_exp->data.dual.sub_a);
+                index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_LOAD_CALLEE_METHOD_KEY, name_exp, 1);
+                compile->code->ops[index].data.key.atom = name_exp->data.dual.sub_b->data.string;
+        } else if (name_exp && name_exp->type == SCRIPT_EXP_TYPE_HASH) {
+                script_compile_exp (compile, name_exp->data.dual.sub_b);
+                script_compile_exp (compile, name_exp->data.dual.sub_a);
+                script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_LOAD_CALLEE_METHOD, name_exp, 0);
+        } else if (name_exp && name_exp->type == SCRIPT_EXP_TYPE_TERM_VAR) {
+                int slot = script_compile_get_slot (compile, name_exp->data.string);
+                if (slot >= 0) {
+                        index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_LOAD_CALLEE_SLOT, name_exp, 2);
+                        compile->code->ops[index].data.slot.name = name_exp->data.string;
+                        compile->code->ops[index].data.slot.index = slot;
+                } else {
+                        index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_LOAD_CALLEE_VAR, name_exp, 2);
+                        compile->code->ops[index].data.string = name_exp->data.string;
+                }
+        } else {
+                script_compile_exp (compile, name_exp);
+                script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_LOAD_CALLEE, name_exp, 1);
+        }
+
+        count = script_compile_list_of_exps (compile, exp->data.function_exe.parameters);
+        index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_CALL, exp, -count - 1);
+        compile->code->ops[index].data.count = count;
+}
+
+static void script_compile_exp (script_compile_t *compile,
+                                script_exp_t     *exp)
+{
+        int index;
+
+        if (!exp) {
+                script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_PUSH_NULL, NULL, 1);
+                return;
+        }
+
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+                script_compile_apply (compile, exp, SCRIPT_CODE_OP_TYPE_APPLY, script_obj_plus);
+                break;
+        case SCRIPT_EXP_TYPE_MINUS:
+                script_compile_apply (compile, exp, SCRIPT_CODE_OP_TYPE_APPLY, script_obj_minus);
+                break;
+        case SCRIPT_EXP_TYPE_MUL:
+                script_compile_apply (compile, exp, SCRIPT_CODE_OP_TYPE_APPLY, script_obj_mul);
+                break;
+        case SCRIPT_EXP_TYPE_DIV:
+                script_compile_apply (compile, exp, SCRIPT_CODE_OP_TYPE_APPLY, script_obj_div);
+                break;
+        case SCRIPT_EXP_TYPE_MOD:
+                script_compile_apply (compile, exp, SCRIPT_CODE_OP_TYPE_APPLY, script_obj_mod);
+                break;
+        case SCRIPT_EXP_TYPE_EXTEND:
+                script_compile_apply (compile, exp, SCRIPT_CODE_OP_TYPE_APPLY, script_obj_new_extend);
+                break;
+
+        case SCRIPT_EXP_TYPE_EQ:
+                script_compile_cmp (compile, exp, SCRIPT_OBJ_CMP_RESULT_EQ);
+                break;
+        case SCRIPT_EXP_TYPE_NE:
+                script_compile_cmp (compile, exp, SCRIPT_OBJ_CMP_RESULT_NE |
+                                    SCRIPT_OBJ_CMP_RESULT_LT |
+                                    SCRIPT_OBJ_CMP_RESULT_GT);
+                break;
+        case SCRIPT_EXP_TYPE_GT:
+                script_compile_cmp (compile, exp, SCRIPT_OBJ_CMP_RESULT_GT);
+                break;
+        case SCRIPT_EXP_TYPE_GE:
+                script_compile_cmp (compile, exp, SCRIPT_OBJ_CMP_RESULT_GT |
+                                    SCRIPT_OBJ_CMP_RESULT_EQ);
+                break;
+        case SCRIPT_EXP_TYPE_LT:
+                script_compile_cmp (compile, exp, SCRIPT_OBJ_CMP_RESULT_LT);
+                break;
+        case SCRIPT_EXP_TYPE_LE:
+                script_compile_cmp (compile, exp, SCRIPT_OBJ_CMP_RESULT_LT |
+                                    SCRIPT_OBJ_CMP_RESULT_EQ);
+                break;
+
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+                script_compile_logic (compile, exp);
+                break;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                script_compile_unary (compile, exp);
+                break;
+
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+                index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_PUSH_NUMBER, exp, 1);
+                compile->code->ops[index].data.number = exp->data.number;
+                break;
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+                index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_PUSH_STRING, exp, 1);
+                compile->code->ops[index].data.string = exp->data.string;
+                break;
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+                script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_PUSH_NULL, exp, 1);
+                break;
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+                compile->uses_local = true;
+                script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_PUSH_LOCAL, exp, 1);
+                break;
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+                script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_PUSH_GLOBAL, exp, 1);
+                break;
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_PUSH_THIS, exp, 1);
+                break;
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                script_compile_set (compile, exp);
+                break;
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+        {
+                int slot = script_compile_get_slot (compile, exp->data.string);
+                if (slot >= 0) {
+                        index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_PUSH_SLOT, exp, 1);
+                        compile->code->ops[index].data.slot.name = exp->data.string;
+                        compile->code->ops[index].data.slot.index = slot;
+                } else {
+                        index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_PUSH_VAR, exp, 1);
+                        compile->code->ops[index].data.string = exp->data.string;
+                }
+                break;
+        }
+
+        case SCRIPT_EXP_TYPE_ASSIGN:
+                script_compile_dual (compile, exp, SCRIPT_CODE_OP_TYPE_ASSIGN);
+                break;
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+                script_compile_apply (compile, exp, SCRIPT_CODE_OP_TYPE_APPLY_AND_ASSIGN, script_obj_plus);
+                break;
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+                script_compile_apply (compile, exp, SCRIPT_CODE_OP_TYPE_APPLY_AND_ASSIGN, script_obj_minus);
+                break;
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+                script_compile_apply (compile, exp, SCRIPT_CODE_OP_TYPE_APPLY_AND_ASSIGN, script_obj_mul);
+                break;
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+                script_compile_apply (compile, exp, SCRIPT_CODE_OP_TYPE_APPLY_AND_ASSIGN, script_obj_div);
+                break;
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+                script_compile_apply (compile, exp, SCRIPT_CODE_OP_TYPE_APPLY_AND_ASSIGN, script_obj_mod);
+                break;
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                script_compile_apply (compile, exp, SCRIPT_CODE_OP_TYPE_APPLY_AND_ASSIGN, script_obj_new_extend);
+                break;
+
+        case SCRIPT_EXP_TYPE_HASH:
+                if (exp->data.dual.sub_b->type == SCRIPT_EXP_TYPE_TERM_STRING) {
+                        /* "a.b" and "a["b"]" index by an atom known up front */
+                        script_compile_exp (compile, exp->data.dual.sub_a);
+                        index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_HASH_KEY, exp, 0);
+                        compile->code->ops[index].data.key.atom = exp->data.dual.sub_b->data.string;
+                } else {
+                        script_compile_dual (compile, exp, SCRIPT_CODE_OP_TYPE_HASH);
+                }
+                break;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                script_compile_func (compile, exp);
+                break;
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_PUSH_FUNCTION, exp, 1);
+                compile->code->ops[index].data.function = exp->data.function_def;
+                break;
+        }
+}
+
+static void script_compile_patch_jump_list (script_compile_t *compile,
+                                            ply_list_t       *list,
+                                            int               target)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (list);
+             node;
+             node = ply_list_get_next_node (list, node)) {
+                int index = (intptr_t) ply_list_node_get_data (node);
+                compile->code->ops[index].data.target = target;
+        }
+        ply_list_free (list);
+}
+
+static void script_compile_loop (script_compile_t *compile,
+                                 script_op_t      *op)
+{
+        script_compile_loop_t loop;
+        int loop_start;
+        int exit_jump = -1;
+        int index;
+
+        loop.break_ops = ply_list_new ();
+        loop.continue_ops = ply_list_new ();
+        loop.parent = compile->loop;
+
+        script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_CLEAR_COMPLETION, op, 0);
+        loop_start = compile->code->op_count;
+
+        if (op->type != SCRIPT_OP_TYPE_DO_WHILE) {
+                script_compile_exp (compile, op->data.cond_op.cond);
+                exit_jump = script_compile_emit_jump (compile, SCRIPT_CODE_OP_TYPE_JUMP_IF_FALSE, op, -1);
+        }
+
+        compile->loop = &loop;
+        script_compile_statement (compile, op->data.cond_op.op1);
+        compile->loop = loop.parent;
+
+        script_compile_patch_jump_list (compile, loop.continue_ops, compile->code->op_count);
+
+        if (op->type == SCRIPT_OP_TYPE_DO_WHILE) {
+                script_compile_exp (compile, op->data.cond_op.cond);
+                index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_JUMP_IF_TRUE, op, -1);
+                compile->code->ops[index].data.target = loop_start;
+        } else {
+                if (op->data.cond_op.op2)
+                        script_compile_statement (compile, op->data.cond_op.op2);
+                index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_JUMP, op, 0);
+                compile->code->ops[index].data.target = loop_start;
+                script_compile_patch_jump (compile, exit_jump);
+        }
+
+        script_compile_patch_jump_list (compile, loop.break_ops, compile->code->op_count);
+}
+
+static void script_compile_exit (script_compile_t    *compile,
+                                 script_op_t         *op,
+                                 script_return_type_t return_type)
+{
+        int index = script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_EXIT, op, 0);
+
+        compile->code->ops[index].data.return_type = return_type;
+}
+
+static void script_compile_break_or_continue (script_compile_t *compile,
+                                              script_op_t      *op)
+{
+        int index;
+
+        if (!compile->loop) {   /* Outside of a loop these unwind the whole function */
+                script_compile_exit (compile, op, op->type == SCRIPT_OP_TYPE_BREAK ?
+                                     SCRIPT_RETURN_TYPE_BREAK : SCRIPT_RETURN_TYPE_CONTINUE);
+                return;
+        }
+
+        script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_CLEAR_COMPLETION, op, 0);
+        index = script_compile_emit_jump (compile, SCRIPT_CODE_OP_TYPE_JUMP, op, 0);
+        if (op->type == SCRIPT_OP_TYPE_BREAK)
+                ply_list_append_data (compile->loop->break_ops, (void *) (intptr_t) index);
+        else
+                ply_list_append_data (compile->loop->continue_ops, (void *) (intptr_t) index);
+}
+
+/* Each statement leaves the value of the last expression statement it ran
+ * in the completion register, as script_execute_list does with its reply.
+ */
+static void script_compile_statement (script_compile_t *compile,
+                                      script_op_t      *op)
+{
+        if (!op) {
+                script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_CLEAR_COMPLETION, NULL, 0);
+                return;
+        }
+
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        {
+                script_compile_exp (compile, op->data.exp);
+                script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_SET_COMPLETION, op, -1);
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+        {
+                ply_list_node_t *node;
+
+                if (ply_list_get_length (op->data.list) == 0) {
+                        script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_CLEAR_COMPLETION, op, 0);
+                        break;
+                }
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node)) {
+                        script_op_t *sub_op = ply_list_node_get_data (node);
+                        script_compile_statement (compile, sub_op);
+                }
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_IF:
+        {
+                int else_jump;
+                int end_jump;
+
+                script_compile_exp (compile, op->data.cond_op.cond);
+                else_jump = script_compile_emit_jump (compile, SCRIPT_CODE_OP_TYPE_JUMP_IF_FALSE, op, -1);
+                script_compile_statement (compile, op->data.cond_op.op1);
+                end_jump = script_compile_emit_jump (compile, SCRIPT_CODE_OP_TYPE_JUMP, op, 0);
+                script_compile_patch_jump (compile, else_jump);
+                script_compile_statement (compile, op->data.cond_op.op2);
+                script_compile_patch_jump (compile, end_jump);
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+        {
+                script_compile_loop (compile, op);
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_RETURN:
+        {
+                if (op->data.exp)
+                        script_compile_exp (compile, op->data.exp);
+                else
+                        script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_PUSH_NULL, op, 1);
+                script_compile_emit (compile, SCRIPT_CODE_OP_TYPE_RETURN, op, -1);
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_FAIL:
+        {
+                script_compile_exit (compile, op, SCRIPT_RETURN_TYPE_FAIL);
+                break;
+        }
+
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+        {
+                script_compile_break_or_continue (compile, op);
+                break;
+        }
+        }
+        assert (compile->depth == 0);
+}
+
+script_code_t *script_compile_op (script_op_t *op)
+{
+        script_compile_t compile;
+
+        compile.code = calloc (1, sizeof(script_code_t));
+        compile.depth = 0;
+        compile.loop = NULL;
+        compile.slots = NULL;
+        compile.uses_local = false;
+
+        script_compile_statement (&compile, op);
+        script_compile_exit (&compile, op, SCRIPT_RETURN_TYPE_NORMAL);
+
+        return compile.code;
+}
+
+script_code_t *script_compile_function (script_function_t *function)
+{
+        script_compile_t compile;
+        ply_list_node_t *node;
+        int index = 0;
+
+        assert (function->type == SCRIPT_FUNCTION_TYPE_SCRIPT);
+
+        compile.code = calloc (1, sizeof(script_code_t));
+        compile.depth = 0;
+        compile.loop = NULL;
+        compile.slots = ply_hashtable_new (ply_hashtable_string_hash,
+                                           ply_hashtable_string_compare);
+        compile.uses_local = false;
+
+        compile.code->uses_slots = true;
+        compile.code->parameter_count = ply_list_get_length (function->parameters);
+        compile.code->parameter_slots = calloc (compile.code->parameter_count + 1, sizeof(int));
+        for (node = ply_list_get_first_node (function->parameters);
+             node;
+             node = ply_list_get_next_node (function->parameters, node)) {
+                char *name = ply_list_node_get_data (node);
+                compile.code->parameter_slots[index++] = script_compile_get_slot (&compile, name);
+        }
+
+        script_compile_statement (&compile, function->data.script);
+        script_compile_exit (&compile, function->data.script, SCRIPT_RETURN_TYPE_NORMAL);
+        ply_hashtable_free (compile.slots);
+
+        if (compile.uses_local) {       /* The frame has to be a real hash, so use the name lookups */
+                script_code_free (compile.code);
+                return script_compile_op (function->data.script);
+        }
+
+        return compile.code;
+}
+
+void script_code_free (script_code_t *code)
+{
+        if (!code) return;
+        free (code->parameter_slots);
+        free (code->ops);
+        free (code);
+}
@@ -0,0 +1,123 @@
+/* script-compile.h - compilation of parsed scripts into bytecode
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_COMPILE_H
+#define SCRIPT_COMPILE_H
+
+#include "script.h"
+#include "script-object.h"
+
+/* The compiled form is a flat array of ops for a small stack machine.
+ * Every op that produces a value pushes a referenced script_obj_t and every
+ * op that consumes one pops it and drops the reference, exactly mirroring
+ * the reference handling of the tree walking evaluator.
+ *
+ * Numbers produced along the way may instead be left unboxed on the stack,
+ * see script_execute_code ().
+ */
+typedef enum
+{
+        SCRIPT_CODE_OP_TYPE_PUSH_NULL,
+        SCRIPT_CODE_OP_TYPE_PUSH_NUMBER,
+        SCRIPT_CODE_OP_TYPE_PUSH_STRING,
+        SCRIPT_CODE_OP_TYPE_PUSH_LOCAL,
+        SCRIPT_CODE_OP_TYPE_PUSH_GLOBAL,
+        SCRIPT_CODE_OP_TYPE_PUSH_THIS,
+        SCRIPT_CODE_OP_TYPE_PUSH_VAR,
+        SCRIPT_CODE_OP_TYPE_PUSH_SLOT,
+        SCRIPT_CODE_OP_TYPE_PUSH_FUNCTION,
+        SCRIPT_CODE_OP_TYPE_MAKE_SET,
+        SCRIPT_CODE_OP_TYPE_APPLY,
+        SCRIPT_CODE_OP_TYPE_APPLY_AND_ASSIGN,
+        SCRIPT_CODE_OP_TYPE_ASSIGN,
+        SCRIPT_CODE_OP_TYPE_CMP,
+        SCRIPT_CODE_OP_TYPE_UNARY,
+        SCRIPT_CODE_OP_TYPE_HASH,
+        SCRIPT_CODE_OP_TYPE_HASH_KEY,
+        SCRIPT_CODE_OP_TYPE_LOAD_CALLEE,
+        SCRIPT_CODE_OP_TYPE_LOAD_CALLEE_VAR,
+        SCRIPT_CODE_OP_TYPE_LOAD_CALLEE_SLOT,
+        SCRIPT_CODE_OP_TYPE_LOAD_CALLEE_METHOD,
+        SCRIPT_CODE_OP_TYPE_LOAD_CALLEE_METHOD_KEY,
+        SCRIPT_CODE_OP_TYPE_CALL,
+        SCRIPT_CODE_OP_TYPE_JUMP,
+        SCRIPT_CODE_OP_TYPE_JUMP_IF_FALSE,
+        SCRIPT_CODE_OP_TYPE_JUMP_IF_TRUE,
+        SCRIPT_CODE_OP_TYPE_JUMP_IF_FALSE_OR_POP,
+        SCRIPT_CODE_OP_TYPE_JUMP_IF_TRUE_OR_POP,
+        SCRIPT_CODE_OP_TYPE_SET_COMPLETION,
+        SCRIPT_CODE_OP_TYPE_CLEAR_COMPLETION,
+        SCRIPT_CODE_OP_TYPE_RETURN,
+        SCRIPT_CODE_OP_TYPE_EXIT,
+} script_code_op_type_t;
+
+typedef struct
+{
+        script_code_op_type_t type;
+        void                 *element;    /* source expression or op, used for error locations */
+        union
+        {
+                script_number_t      number;
+                const char          *string;     /* atom owned by the parse tree */
+                int                  count;
+                int                  target;
+                int                  condition;
+                script_exp_type_t    exp_type;
+                script_return_type_t return_type;
+                script_function_t   *function;
+                struct
+                {
+                        const char *name;
+                        int         index;
+                } slot;
+                struct
+                {
+                        const char             *atom;
+                        script_obj_hash_cache_t cache;
+                } key;
+                struct
+                {
+                        struct script_obj_t *(*function)(struct script_obj_t *,
+                                                         struct script_obj_t *);
+                        script_exp_type_t     exp_type;  /* selects the unboxed number path */
+                } apply;
+        } data;
+} script_code_op_t;
+
+/* Functions which never touch their "local" hash keep their parameters and
+ * locals in a frame of numbered slots instead.  A slot that is still NULL
+ * has not been created in the function yet, so lookups fall through to
+ * "this" and "global" just as a missing hash entry would.
+ */
+typedef struct script_code_t
+{
+        script_code_op_t *ops;
+        int               op_count;
+        int               op_allocated;
+        int               stack_size;
+        bool              uses_slots;
+        bool              uses_args;        /* needs "_args" built on each call */
+        int               slot_count;
+        int               parameter_count;
+        int              *parameter_slots;  /* slot of each parameter, or -1 */
+} script_code_t;
+
+script_code_t *script_compile_op (script_op_t *op);
+script_code_t *script_compile_function (script_function_t *function);
+void script_code_free (script_code_t *code);
+
+#endif /* SCRIPT_COMPILE_H */
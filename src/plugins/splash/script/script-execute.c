@@ -38,12 +38,19 @@
 #include <math.h>
 
 #include "script.h"
+#include "script-atom.h"
+#include "script-compile.h"
 #include "script-debug.h"
 #include "script-execute.h"
 #include "script-object.h"
 
+static bool script_execute_use_bytecode = true;
+static script_profile_t *script_execute_profile = NULL;
+
 static script_obj_t *script_evaluate (script_state_t *state,
                                       script_exp_t   *exp);
+static script_return_t script_execute_tree (script_state_t *state,
+                                            script_op_t    *op);
 static script_return_t script_execute_function_with_parlist (script_state_t    *state,
                                                              script_function_t *function,
                                                              script_obj_t      *this,
@@ -96,13 +103,41 @@ static script_obj_t *script_evaluate_apply_function_and_assign (script_state_t
         return obj;
 }
 
-static script_obj_t *script_evaluate_hash (script_state_t *state,
-                                           script_exp_t   *exp)
+/* Array indices are by far the most common non-string keys, so integers
+ * in the cached range skip formatting the number as a string.
+ */
+static const char *script_execute_number_atom (script_number_t number)
+{
+        const char *atom;
+        char *name;
+
+        if (number >= 0 && number < SCRIPT_ATOM_INDEX_CACHE_SIZE &&
+            number == (int) number && !signbit (number))
+                return script_atom_from_index ((int) number);
+        asprintf (&name, "%g", number);
+        atom = script_atom_get (name);
+        free (name);
+        return atom;
+}
+
+static const char *script_execute_key_atom (script_obj_t *key)
+{
+        const char *atom;
+        char *name;
+
+        if (script_obj_is_number (key))
+                return script_execute_number_atom (script_obj_as_number (key));
+        name = script_obj_as_string (key);
+        atom = script_atom_get (name);
+        free (name);
+        return atom;
+}
+
+/* Takes the reference to hash */
+static script_obj_t *script_execute_hash_element_atom (script_obj_t *hash,
+                                                       const char   *atom)
 {
-        script_obj_t *hash = script_evaluate (state, exp->data.dual.sub_a);
-        script_obj_t *key = script_evaluate (state, exp->data.dual.sub_b);
         script_obj_t *obj;
-        char *name = script_obj_as_string (key);
 
         if (!script_obj_is_hash (hash)) {
                 script_obj_t *newhash = script_obj_new_hash ();
@@ -110,29 +145,74 @@ static script_obj_t *script_evaluate_hash (script_state_t *state,
                 script_obj_unref (newhash);
         }
 
-        obj = script_obj_hash_get_element (hash, name);
-        free (name);
+        obj = script_obj_hash_get_element_atom (hash, atom);
+        script_obj_unref (hash);
+        return obj;
+}
 
+/* Takes the reference to hash */
+static script_obj_t *script_execute_hash_element_cached (script_obj_t            *hash,
+                                                         const char              *atom,
+                                                         script_obj_hash_cache_t *cache)
+{
+        script_obj_t *obj;
+
+        if (!script_obj_is_hash (hash)) {
+                script_obj_t *newhash = script_obj_new_hash ();
+                script_obj_assign (hash, newhash);
+                script_obj_unref (newhash);
+        }
+
+        obj = script_obj_hash_get_element_cached (hash, atom, cache);
         script_obj_unref (hash);
+        return obj;
+}
+
+static script_obj_t *script_execute_hash_element (script_obj_t *hash,
+                                                  script_obj_t *key)
+{
+        script_obj_t *obj;
+        const char *atom = script_execute_key_atom (key);
+
+        obj = script_execute_hash_element_atom (hash, atom);
+        script_atom_unref (atom);
         script_obj_unref (key);
         return obj;
 }
 
-static script_obj_t *script_evaluate_var (script_state_t *state,
-                                          script_exp_t   *exp)
+static script_obj_t *script_evaluate_hash (script_state_t *state,
+                                           script_exp_t   *exp)
+{
+        script_obj_t *hash = script_evaluate (state, exp->data.dual.sub_a);
+
+        if (exp->data.dual.sub_b->type == SCRIPT_EXP_TYPE_TERM_STRING)
+                return script_execute_hash_element_atom (hash, exp->data.dual.sub_b->data.string);
+
+        script_obj_t *key = script_evaluate (state, exp->data.dual.sub_b);
+
+        return script_execute_hash_element (hash, key);
+}
+
+static script_obj_t *script_execute_lookup_var (script_state_t *state,
+                                                const char     *atom)
 {
-        char *name = exp->data.string;
-        script_obj_t *obj = script_obj_hash_peek_element (state->local, name);
+        script_obj_t *obj = script_obj_hash_peek_element_atom (state->local, atom);
 
         if (obj) return obj;
-        obj = script_obj_hash_peek_element (state->this, name);
+        obj = script_obj_hash_peek_element_atom (state->this, atom);
         if (obj) return obj;
-        obj = script_obj_hash_peek_element (state->global, name);
+        obj = script_obj_hash_peek_element_atom (state->global, atom);
         if (obj) return obj;
-        obj = script_obj_hash_get_element (state->local, name);
+        obj = script_obj_hash_get_element_atom (state->local, atom);
         return obj;
 }
 
+static script_obj_t *script_evaluate_var (script_state_t *state,
+                                          script_exp_t   *exp)
+{
+        return script_execute_lookup_var (state, exp->data.string);
+}
+
 static script_obj_t *script_evaluate_set (script_state_t *state,
                                           script_exp_t   *exp)
 {
@@ -144,11 +224,11 @@ static script_obj_t *script_evaluate_set (script_state_t *state,
         while (node_data) {
                 script_exp_t *data_exp = ply_list_node_get_data (node_data);
                 script_obj_t *data_obj = script_evaluate (state, data_exp);
-                char *name;
-                asprintf (&name, "%d", index);
+                const char *atom = script_atom_from_index (index);
                 index++;
-                script_obj_hash_add_element (obj, data_obj, name);
-                free (name);
+                script_obj_hash_add_element_atom (obj, data_obj, atom);
+                script_obj_unref (data_obj);
+                script_atom_unref (atom);
 
                 node_data = ply_list_get_next_node (parameter_data, node_data);
         }
@@ -197,24 +277,24 @@ static script_obj_t *script_evaluate_logic (script_state_t *state,
         return obj;
 }
 
-static script_obj_t *script_evaluate_unary (script_state_t *state,
-                                            script_exp_t   *exp)
+static script_obj_t *script_execute_unary (script_exp_type_t type,
+                                           script_obj_t     *obj,
+                                           void             *element)
 {
-        script_obj_t *obj = script_evaluate (state, exp->data.sub);
         script_obj_t *new_obj;
 
-        if (exp->type == SCRIPT_EXP_TYPE_NOT) {
+        if (type == SCRIPT_EXP_TYPE_NOT) {
                 new_obj = script_obj_new_number (!script_obj_as_bool (obj));
                 script_obj_unref (obj);
                 return new_obj;
         }
-        if (exp->type == SCRIPT_EXP_TYPE_POS) /* FIXME what should happen on non number operands? */
-                return obj;                   /* Does nothing, maybe just remove at parse stage */
-        if (exp->type == SCRIPT_EXP_TYPE_NEG) {
+        if (type == SCRIPT_EXP_TYPE_POS) /* FIXME what should happen on non number operands? */
+                return obj;              /* Does nothing, maybe just remove at parse stage */
+        if (type == SCRIPT_EXP_TYPE_NEG) {
                 if (script_obj_is_number (obj)) {
                         new_obj = script_obj_new_number (-script_obj_as_number (obj));
                 } else {
-                        script_execute_error (exp, "Cannot negate non number objects");
+                        script_execute_error (element, "Cannot negate non number objects");
                         new_obj = script_obj_new_null ();
                 }
                 script_obj_unref (obj);
@@ -223,11 +303,11 @@ static script_obj_t *script_evaluate_unary (script_state_t *state,
         int change_pre = 0;
         int change = -1;
 
-        if ((exp->type == SCRIPT_EXP_TYPE_PRE_INC) ||
-            (exp->type == SCRIPT_EXP_TYPE_POST_INC))
+        if ((type == SCRIPT_EXP_TYPE_PRE_INC) ||
+            (type == SCRIPT_EXP_TYPE_POST_INC))
                 change = 1;
-        if ((exp->type == SCRIPT_EXP_TYPE_PRE_INC) ||
-            (exp->type == SCRIPT_EXP_TYPE_PRE_DEC))
+        if ((type == SCRIPT_EXP_TYPE_PRE_INC) ||
+            (type == SCRIPT_EXP_TYPE_PRE_DEC))
                 change_pre = 1;
 
         if (script_obj_is_number (obj)) {
@@ -242,13 +322,22 @@ static script_obj_t *script_evaluate_unary (script_state_t *state,
                         script_obj_unref (new_obj2);
                 }
         } else {
-                script_execute_error (exp, "Cannot increment/decrement non number objects");
+                script_execute_error (element, "Cannot increment/decrement non number objects");
                 new_obj = script_obj_new_null (); /* If performeing something like a=hash++; a and hash become NULL */
                 script_obj_reset (obj);
         }
         script_obj_unref (obj);
         return new_obj;
 }
+
+static script_obj_t *script_evaluate_unary (script_state_t *state,
+                                            script_exp_t   *exp)
+{
+        script_obj_t *obj = script_evaluate (state, exp->data.sub);
+
+        return script_execute_unary (exp->type, obj, exp);
+}
+
 typedef struct
 {
         script_state_t *state;
@@ -290,6 +379,95 @@ static script_return_t script_execute_object_with_parlist (script_state_t *state
         return script_return_fail ();
 }
 
+/* Does not take the reference to this_obj */
+static script_obj_t *script_execute_method_callee_atom (script_state_t *state,
+                                                        script_obj_t   *this_obj,
+                                                        const char     *atom)
+{
+        script_obj_t *func_obj;
+
+        func_obj = script_obj_hash_peek_element_atom (this_obj, atom);
+
+        if (!func_obj && script_obj_is_string (this_obj)) {
+                script_obj_t *string_hash = script_obj_hash_peek_element (state->global, "String");
+                func_obj = script_obj_hash_peek_element_atom (string_hash, atom);
+                script_obj_unref (string_hash);
+        }
+
+        if (!func_obj)
+                func_obj = script_obj_hash_get_element_atom (this_obj, atom);
+
+        return func_obj;
+}
+
+static script_obj_t *script_execute_method_callee_cached (script_state_t          *state,
+                                                          script_obj_t            *this_obj,
+                                                          const char              *atom,
+                                                          script_obj_hash_cache_t *cache)
+{
+        script_obj_t *func_obj = script_obj_hash_peek_element_cached (this_obj, atom, cache);
+
+        if (func_obj) return func_obj;
+        return script_execute_method_callee_atom (state, this_obj, atom);
+}
+
+/* Takes the reference to this_key, but not to this_obj */
+static script_obj_t *script_execute_method_callee (script_state_t *state,
+                                                   script_obj_t   *this_obj,
+                                                   script_obj_t   *this_key)
+{
+        script_obj_t *func_obj;
+        const char *atom = script_execute_key_atom (this_key);
+
+        script_obj_unref (this_key);
+        func_obj = script_execute_method_callee_atom (state, this_obj, atom);
+        script_atom_unref (atom);
+        return func_obj;
+}
+
+static script_obj_t *script_execute_var_callee (script_state_t *state,
+                                                const char     *atom,
+                                                script_obj_t  **this_obj)
+{
+        script_obj_t *func_obj;
+
+        *this_obj = NULL;
+        func_obj = script_obj_hash_peek_element_atom (state->local, atom);
+        if (!func_obj) {
+                func_obj = script_obj_hash_peek_element_atom (state->this, atom);
+                if (func_obj) {
+                        *this_obj = state->this;
+                        script_obj_ref (*this_obj);
+                } else {
+                        func_obj = script_obj_hash_peek_element_atom (state->global, atom);
+                        if (!func_obj) func_obj = script_obj_new_null ();
+                }
+        }
+        return func_obj;
+}
+
+/* Takes the references to the function, this and all of the parameters */
+static script_obj_t *script_execute_call (script_state_t *state,
+                                          script_obj_t   *func_obj,
+                                          script_obj_t   *this_obj,
+                                          ply_list_t     *parameter_data)
+{
+        script_return_t reply = script_execute_object_with_parlist (state, func_obj, this_obj, parameter_data);
+
+        ply_list_node_t *node_data = ply_list_get_first_node (parameter_data);
+        while (node_data) {
+                script_obj_t *data_obj = ply_list_node_get_data (node_data);
+                script_obj_unref (data_obj);
+                node_data = ply_list_get_next_node (parameter_data, node_data);
+        }
+        ply_list_free (parameter_data);
+
+        script_obj_unref (func_obj);
+        if (this_obj) script_obj_unref (this_obj);
+
+        return reply.object ? reply.object : script_obj_new_null ();
+}
+
 static script_obj_t *script_evaluate_func (script_state_t *state,
                                            script_exp_t   *exp)
 {
@@ -297,36 +475,17 @@ static script_obj_t *script_evaluate_func (script_state_t *state,
         script_obj_t *func_obj;
         script_exp_t *name_exp = exp->data.function_exe.name;
 
-        if (name_exp->type == SCRIPT_EXP_TYPE_HASH) {
+        if (name_exp->type == SCRIPT_EXP_TYPE_HASH &&
+            name_exp->data.dual.sub_b->type == SCRIPT_EXP_TYPE_TERM_STRING) {
+                this_obj = script_evaluate (state, name_exp->data.dual.sub_a);
+                func_obj = script_execute_method_callee_atom (state, this_obj,
+                                                              name_exp->data.dual.sub_b->data.string);
+        } else if (name_exp->type == SCRIPT_EXP_TYPE_HASH) {
                 script_obj_t *this_key = script_evaluate (state, name_exp->data.dual.sub_b);
                 this_obj = script_evaluate (state, name_exp->data.dual.sub_a);
-                char *this_key_name = script_obj_as_string (this_key);
-                script_obj_unref (this_key);
-                func_obj = script_obj_hash_peek_element (this_obj, this_key_name);
-
-                if (!func_obj && script_obj_is_string (this_obj)) {
-                        script_obj_t *string_hash = script_obj_hash_peek_element (state->global, "String");
-                        func_obj = script_obj_hash_peek_element (string_hash, this_key_name);
-                        script_obj_unref (string_hash);
-                }
-
-                if (!func_obj)
-                        func_obj = script_obj_hash_get_element (this_obj, this_key_name);
-
-                free (this_key_name);
+                func_obj = script_execute_method_callee (state, this_obj, this_key);
         } else if (name_exp->type == SCRIPT_EXP_TYPE_TERM_VAR) {
-                char *name = name_exp->data.string;
-                func_obj = script_obj_hash_peek_element (state->local, name);
-                if (!func_obj) {
-                        func_obj = script_obj_hash_peek_element (state->this, name);
-                        if (func_obj) {
-                                this_obj = state->this;
-                                script_obj_ref (this_obj);
-                        } else {
-                                func_obj = script_obj_hash_peek_element (state->global, name);
-                                if (!func_obj) func_obj = script_obj_new_null ();
-                        }
-                }
+                func_obj = script_execute_var_callee (state, name_exp->data.string, &this_obj);
         } else {
                 func_obj = script_evaluate (state, name_exp);
         }
@@ -343,20 +502,7 @@ static script_obj_t *script_evaluate_func (script_state_t *state,
                                                           node_expression);
         }
 
-        script_return_t reply = script_execute_object_with_parlist (state, func_obj, this_obj, parameter_data);
-
-        ply_list_node_t *node_data = ply_list_get_first_node (parameter_data);
-        while (node_data) {
-                script_obj_t *data_obj = ply_list_node_get_data (node_data);
-                script_obj_unref (data_obj);
-                node_data = ply_list_get_next_node (parameter_data, node_data);
-        }
-        ply_list_free (parameter_data);
-
-        script_obj_unref (func_obj);
-        if (this_obj) script_obj_unref (this_obj);
-
-        return reply.object ? reply.object : script_obj_new_null ();
+        return script_execute_call (state, func_obj, this_obj, parameter_data);
 }
 
 static script_obj_t *script_evaluate (script_state_t *state,
@@ -543,6 +689,449 @@ static script_obj_t *script_evaluate (script_state_t *state,
         return script_obj_new_null ();
 }
 
+static script_obj_t *script_execute_lookup_slot (script_state_t *state,
+                                                 script_obj_t  **slots,
+                                                 int             index,
+                                                 const char     *atom)
+{
+        script_obj_t *obj = slots[index];
+
+        if (obj) {
+                script_obj_ref (obj);
+                return obj;
+        }
+        obj = script_obj_hash_peek_element_atom (state->this, atom);
+        if (obj) return obj;
+        obj = script_obj_hash_peek_element_atom (state->global, atom);
+        if (obj) return obj;
+        obj = slots[index] = script_obj_new_null ();
+        script_obj_ref (obj);
+        return obj;
+}
+
+static script_obj_t *script_execute_slot_callee (script_state_t *state,
+                                                 script_obj_t  **slots,
+                                                 int             index,
+                                                 const char     *atom,
+                                                 script_obj_t  **this_obj)
+{
+        script_obj_t *func_obj = slots[index];
+
+        *this_obj = NULL;
+        if (func_obj) {
+                script_obj_ref (func_obj);
+                return func_obj;
+        }
+        func_obj = script_obj_hash_peek_element_atom (state->this, atom);
+        if (func_obj) {
+                *this_obj = state->this;
+                script_obj_ref (*this_obj);
+                return func_obj;
+        }
+        func_obj = script_obj_hash_peek_element_atom (state->global, atom);
+        if (!func_obj) func_obj = script_obj_new_null ();
+        return func_obj;
+}
+
+static void script_execute_free_slots (script_obj_t **slots,
+                                       int            slot_count)
+{
+        int index;
+
+        for (index = 0; index < slot_count; index++) {
+                script_obj_unref (slots[index]);
+        }
+}
+
+/* Number temporaries in the code stack are kept unboxed: a NULL entry
+ * means the value is the number held in the same place of the numbers
+ * array.  They only become objects when something needs one.
+ */
+static script_obj_t *script_execute_box (script_obj_t   **stack,
+                                         script_number_t *numbers,
+                                         int              index)
+{
+        if (!stack[index])
+                stack[index] = script_obj_new_number (numbers[index]);
+        return stack[index];
+}
+
+static bool script_execute_peek_number (script_obj_t   **stack,
+                                        script_number_t *numbers,
+                                        int              index,
+                                        script_number_t *number)
+{
+        script_obj_t *obj = stack[index];
+
+        if (!obj) {
+                *number = numbers[index];
+                return true;
+        }
+        obj = script_obj_deref_direct (obj);
+        if (obj->type != SCRIPT_OBJ_TYPE_NUMBER)
+                return false;
+        *number = obj->data.number;
+        return true;
+}
+
+static bool script_execute_number_as_bool (script_number_t number)
+{
+        int num_type = fpclassify (number);
+
+        return num_type != FP_ZERO && num_type != FP_NAN;
+}
+
+static bool script_execute_number_apply (script_exp_type_t type,
+                                         script_number_t   number_a,
+                                         script_number_t   number_b,
+                                         script_number_t  *result)
+{
+        if (type == SCRIPT_EXP_TYPE_PLUS || type == SCRIPT_EXP_TYPE_ASSIGN_PLUS)
+                *result = number_a + number_b;
+        else if (type == SCRIPT_EXP_TYPE_MINUS || type == SCRIPT_EXP_TYPE_ASSIGN_MINUS)
+                *result = number_a - number_b;
+        else if (type == SCRIPT_EXP_TYPE_MUL || type == SCRIPT_EXP_TYPE_ASSIGN_MUL)
+                *result = number_a * number_b;
+        else if (type == SCRIPT_EXP_TYPE_DIV || type == SCRIPT_EXP_TYPE_ASSIGN_DIV)
+                *result = number_a / number_b;
+        else if (type == SCRIPT_EXP_TYPE_MOD || type == SCRIPT_EXP_TYPE_ASSIGN_MOD)
+                *result = fmodl (number_a, number_b);
+        else
+                return false;
+        return true;
+}
+
+static script_obj_cmp_result_t script_execute_number_cmp (script_number_t number_a,
+                                                          script_number_t number_b)
+{
+        if (number_a < number_b) return SCRIPT_OBJ_CMP_RESULT_LT;
+        if (number_a > number_b) return SCRIPT_OBJ_CMP_RESULT_GT;
+        if (number_a == number_b) return SCRIPT_OBJ_CMP_RESULT_EQ;
+        return SCRIPT_OBJ_CMP_RESULT_NE;
+}
+
+/* parameter_data is only used to fill in the frame of code using slots */
+static script_return_t script_execute_code (script_state_t *state,
+                                            script_code_t  *code,
+                                            ply_list_t     *parameter_data)
+{
+        script_obj_t *stack[code->stack_size + 1];
+        script_number_t numbers[code->stack_size + 1];
+        script_obj_t *slots[code->slot_count + 1];
+        script_obj_t *completion = NULL;
+        script_obj_t *obj_a;
+        script_obj_t *obj_b;
+        script_obj_t *obj;
+        script_number_t number_a;
+        script_number_t number_b;
+        int sp = 0;
+        int pc = 0;
+
+        memset (slots, 0, sizeof(slots));
+        if (code->uses_slots && parameter_data) {
+                ply_list_node_t *node;
+                int index = 0;
+
+                for (node = ply_list_get_first_node (parameter_data);
+                     node && index < code->parameter_count;
+                     node = ply_list_get_next_node (parameter_data, node), index++) {
+                        int slot = code->parameter_slots[index];
+                        if (slot < 0) continue;
+                        if (!slots[slot]) slots[slot] = script_obj_new_null ();
+                        script_obj_assign (slots[slot], ply_list_node_get_data (node));
+                }
+        }
+
+        while (true) {
+                script_code_op_t *op = &code->ops[pc++];
+
+                if (script_execute_profile)
+                        script_profile_enter_line (script_execute_profile, op->element);
+
+                switch (op->type) {
+                case SCRIPT_CODE_OP_TYPE_PUSH_NULL:
+                        stack[sp++] = script_obj_new_null ();
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_PUSH_NUMBER:
+                        numbers[sp] = op->data.number;
+                        stack[sp++] = NULL;
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_PUSH_STRING:
+                        stack[sp++] = script_obj_new_string (op->data.string);
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_PUSH_LOCAL:
+                        script_obj_ref (state->local);
+                        stack[sp++] = state->local;
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_PUSH_GLOBAL:
+                        script_obj_ref (state->global);
+                        stack[sp++] = state->global;
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_PUSH_THIS:
+                        script_obj_ref (state->this);
+                        stack[sp++] = state->this;
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_PUSH_VAR:
+                        stack[sp++] = script_execute_lookup_var (state, op->data.string);
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_PUSH_SLOT:
+                        stack[sp++] = script_execute_lookup_slot (state, slots,
+                                                                  op->data.slot.index,
+                                                                  op->data.slot.name);
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_PUSH_FUNCTION:
+                        stack[sp++] = script_obj_new_function (op->data.function);
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_MAKE_SET:
+                {
+                        int index;
+                        obj = script_obj_new_hash ();
+                        sp -= op->data.count;
+                        for (index = 0; index < op->data.count; index++) {
+                                const char *atom = script_atom_from_index (index);
+                                script_execute_box (stack, numbers, sp + index);
+                                script_obj_hash_add_element_atom (obj, stack[sp + index], atom);
+                                script_obj_unref (stack[sp + index]);
+                                script_atom_unref (atom);
+                        }
+                        stack[sp++] = obj;
+                        break;
+                }
+
+                case SCRIPT_CODE_OP_TYPE_APPLY:
+                        sp--;
+                        if (script_execute_peek_number (stack, numbers, sp - 1, &number_a) &&
+                            script_execute_peek_number (stack, numbers, sp, &number_b) &&
+                            script_execute_number_apply (op->data.apply.exp_type, number_a, number_b,
+                                                         &numbers[sp - 1])) {
+                                script_obj_unref (stack[sp - 1]);
+                                script_obj_unref (stack[sp]);
+                                stack[sp - 1] = NULL;
+                                break;
+                        }
+                        obj_b = script_execute_box (stack, numbers, sp);
+                        obj_a = script_execute_box (stack, numbers, sp - 1);
+                        stack[sp - 1] = op->data.apply.function (obj_a, obj_b);
+                        script_obj_unref (obj_a);
+                        script_obj_unref (obj_b);
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_APPLY_AND_ASSIGN:
+                        sp--;
+                        obj_a = script_execute_box (stack, numbers, sp - 1);
+                        if (script_execute_peek_number (stack, numbers, sp - 1, &number_a) &&
+                            script_execute_peek_number (stack, numbers, sp, &number_b) &&
+                            script_execute_number_apply (op->data.apply.exp_type, number_a, number_b,
+                                                         &numbers[sp - 1])) {
+                                script_obj_assign_number (obj_a, numbers[sp - 1]);
+                                script_obj_unref (obj_a);
+                                script_obj_unref (stack[sp]);
+                                stack[sp - 1] = NULL;
+                                break;
+                        }
+                        obj_b = script_execute_box (stack, numbers, sp);
+                        obj = op->data.apply.function (obj_a, obj_b);
+                        script_obj_assign (obj_a, obj);
+                        stack[sp - 1] = obj;
+                        script_obj_unref (obj_a);
+                        script_obj_unref (obj_b);
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_ASSIGN:
+                        obj_a = script_execute_box (stack, numbers, sp - 2);
+                        obj_b = stack[--sp];
+                        if (!obj_b) {
+                                script_obj_assign_number (obj_a, numbers[sp]);
+                                break;
+                        }
+                        script_obj_assign (obj_a, obj_b);
+                        script_obj_unref (obj_b);
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_CMP:
+                {
+                        script_obj_cmp_result_t cmp_result;
+                        sp--;
+                        if (script_execute_peek_number (stack, numbers, sp - 1, &number_a) &&
+                            script_execute_peek_number (stack, numbers, sp, &number_b)) {
+                                cmp_result = script_execute_number_cmp (number_a, number_b);
+                        } else {
+                                obj_a = script_execute_box (stack, numbers, sp - 1);
+                                obj_b = script_execute_box (stack, numbers, sp);
+                                cmp_result = script_obj_cmp (obj_a, obj_b);
+                        }
+                        script_obj_unref (stack[sp - 1]);
+                        script_obj_unref (stack[sp]);
+                        numbers[sp - 1] = (cmp_result & op->data.condition) ? 1 : 0;
+                        stack[sp - 1] = NULL;
+                        break;
+                }
+
+                case SCRIPT_CODE_OP_TYPE_UNARY:
+                        if (op->data.exp_type == SCRIPT_EXP_TYPE_POS)
+                                break;  /* leaves the operand, boxed or not */
+                        if (script_execute_peek_number (stack, numbers, sp - 1, &number_a)) {
+                                script_exp_type_t type = op->data.exp_type;
+                                bool pre = type == SCRIPT_EXP_TYPE_PRE_INC || type == SCRIPT_EXP_TYPE_PRE_DEC;
+                                int change = (type == SCRIPT_EXP_TYPE_PRE_INC ||
+                                              type == SCRIPT_EXP_TYPE_POST_INC) ? 1 : -1;
+                                if (type == SCRIPT_EXP_TYPE_NOT) {
+                                        numbers[sp - 1] = !script_execute_number_as_bool (number_a);
+                                } else if (type == SCRIPT_EXP_TYPE_NEG) {
+                                        numbers[sp - 1] = -number_a;
+                                } else {
+                                        obj = script_execute_box (stack, numbers, sp - 1);
+                                        script_obj_assign_number (obj, number_a + change);
+                                        numbers[sp - 1] = pre ? number_a + change : number_a;
+                                }
+                                script_obj_unref (stack[sp - 1]);
+                                stack[sp - 1] = NULL;
+                                break;
+                        }
+                        stack[sp - 1] = script_execute_unary (op->data.exp_type, stack[sp - 1], op->element);
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_HASH:
+                        sp--;
+                        obj_a = script_execute_box (stack, numbers, sp - 1);
+                        if (!stack[sp]) {
+                                const char *atom = script_execute_number_atom (numbers[sp]);
+                                stack[sp - 1] = script_execute_hash_element_atom (obj_a, atom);
+                                script_atom_unref (atom);
+                                break;
+                        }
+                        stack[sp - 1] = script_execute_hash_element (obj_a, stack[sp]);
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_HASH_KEY:
+                        obj_a = script_execute_box (stack, numbers, sp - 1);
+                        stack[sp - 1] = script_execute_hash_element_cached (obj_a, op->data.key.atom,
+                                                                            &op->data.key.cache);
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_LOAD_CALLEE:
+                        script_execute_box (stack, numbers, sp - 1);
+                        stack[sp++] = NULL;     /* no "this", never unboxed */
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_LOAD_CALLEE_VAR:
+                        stack[sp] = script_execute_var_callee (state, op->data.string, &stack[sp + 1]);
+                        sp += 2;
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_LOAD_CALLEE_SLOT:
+                        stack[sp] = script_execute_slot_callee (state, slots,
+                                                                op->data.slot.index,
+                                                                op->data.slot.name,
+                                                                &stack[sp + 1]);
+                        sp += 2;
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_LOAD_CALLEE_METHOD:
+                        obj_a = script_execute_box (stack, numbers, sp - 1);
+                        if (!stack[sp - 2]) {
+                                const char *atom = script_execute_number_atom (numbers[sp - 2]);
+                                stack[sp - 2] = script_execute_method_callee_atom (state, obj_a, atom);
+                                script_atom_unref (atom);
+                                break;
+                        }
+                        stack[sp - 2] = script_execute_method_callee (state, obj_a, stack[sp - 2]);
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_LOAD_CALLEE_METHOD_KEY:
+                        obj_a = script_execute_box (stack, numbers, sp - 1);
+                        stack[sp - 1] = script_execute_method_callee_cached (state, obj_a, op->data.key.atom,
+                                                                             &op->data.key.cache);
+                        stack[sp++] = obj_a;
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_CALL:
+                {
+                        ply_list_t *parameter_data = ply_list_new ();
+                        int index;
+                        sp -= op->data.count;
+                        for (index = 0; index < op->data.count; index++) {
+                                ply_list_append_data (parameter_data,
+                                                      script_execute_box (stack, numbers, sp + index));
+                        }
+                        sp -= 2;
+                        stack[sp] = script_execute_call (state, stack[sp], stack[sp + 1], parameter_data);
+                        sp++;
+                        break;
+                }
+
+                case SCRIPT_CODE_OP_TYPE_JUMP:
+                        pc = op->data.target;
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_JUMP_IF_FALSE:
+                case SCRIPT_CODE_OP_TYPE_JUMP_IF_TRUE:
+                {
+                        bool cond;
+                        obj = stack[--sp];
+                        if (obj) {
+                                cond = script_obj_as_bool (obj);
+                                script_obj_unref (obj);
+                        } else {
+                                cond = script_execute_number_as_bool (numbers[sp]);
+                        }
+                        if (cond == (op->type == SCRIPT_CODE_OP_TYPE_JUMP_IF_TRUE))
+                                pc = op->data.target;
+                        break;
+                }
+
+                case SCRIPT_CODE_OP_TYPE_JUMP_IF_FALSE_OR_POP:
+                case SCRIPT_CODE_OP_TYPE_JUMP_IF_TRUE_OR_POP:
+                {
+                        bool cond;
+                        if (stack[sp - 1])
+                                cond = script_obj_as_bool (stack[sp - 1]);
+                        else
+                                cond = script_execute_number_as_bool (numbers[sp - 1]);
+                        if (cond == (op->type == SCRIPT_CODE_OP_TYPE_JUMP_IF_TRUE_OR_POP))
+                                pc = op->data.target;
+                        else
+                                script_obj_unref (stack[--sp]);
+                        break;
+                }
+
+                case SCRIPT_CODE_OP_TYPE_SET_COMPLETION:
+                        script_obj_unref (completion);
+                        completion = script_execute_box (stack, numbers, --sp);
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_CLEAR_COMPLETION:
+                        script_obj_unref (completion);
+                        completion = NULL;
+                        break;
+
+                case SCRIPT_CODE_OP_TYPE_RETURN:
+                        assert (sp == 1);
+                        script_execute_box (stack, numbers, 0);
+                        script_execute_free_slots (slots, code->slot_count);
+                        script_obj_unref (completion);
+                        return script_return_obj (stack[0]);
+
+                case SCRIPT_CODE_OP_TYPE_EXIT:
+                        assert (sp == 0);
+                        script_execute_free_slots (slots, code->slot_count);
+                        if (op->data.return_type == SCRIPT_RETURN_TYPE_NORMAL)
+                                return script_return_normal_obj (completion);
+                        script_obj_unref (completion);
+                        return (script_return_t) { op->data.return_type, NULL };
+                }
+        }
+}
+
 static script_return_t script_execute_list (script_state_t *state,
                                             ply_list_t     *op_list)                      /* FIXME script_execute returns the return obj */
 {
@@ -554,7 +1143,7 @@ static script_return_t script_execute_list (script_state_t *state,
              node = ply_list_get_next_node (op_list, node)) {
                 script_op_t *op = ply_list_node_get_data (node);
                 script_obj_unref (reply.object);
-                reply = script_execute (state, op);
+                reply = script_execute_tree (state, op);
                 switch (reply.type) {
                 case SCRIPT_RETURN_TYPE_NORMAL:
                         break;
@@ -574,54 +1163,97 @@ static script_return_t script_execute_function_with_parlist (script_state_t    *
                                                              script_obj_t      *this,
                                                              ply_list_t        *parameter_data)
 {
-        script_state_t *sub_state = script_state_init_sub (state, this);
+        script_state_t sub_state;
         ply_list_t *parameter_names = function->parameters;
         ply_list_node_t *node_name = ply_list_get_first_node (parameter_names);
-        ply_list_node_t *node_data = ply_list_get_first_node (parameter_data);
-        int index = 0;
-        script_obj_t *arg_obj = script_obj_new_hash ();
+        ply_list_node_t *node_data;
+        script_code_t *code = NULL;
+        bool needs_local = true;
+        bool needs_args = true;
+
+        if (function->type == SCRIPT_FUNCTION_TYPE_SCRIPT && script_execute_use_bytecode) {
+                if (!function->code)
+                        function->code = script_compile_function (function);
+                code = function->code;
+                if (code->uses_slots) {
+                        /* Parameters are passed in the frame, and the local
+                         * hash is only reachable through "_args" */
+                        node_name = NULL;
+                        needs_local = code->uses_args;
+                        needs_args = code->uses_args;
+                }
+        } else if (function->type == SCRIPT_FUNCTION_TYPE_NATIVE) {
+                needs_args = false;     /* Natives only look their parameters up by name */
+        }
 
-        while (node_data) {
-                script_obj_t *data_obj = ply_list_node_get_data (node_data);
-                char *name;
-                asprintf (&name, "%d", index);
-                index++;
-                script_obj_hash_add_element (arg_obj, data_obj, name);
-                free (name);
+        if (needs_local) {
+                script_obj_t *local_hash = script_obj_new_hash ();
+                sub_state.local = script_obj_new_ref (local_hash);
+                script_obj_unref (local_hash);
+        } else {
+                sub_state.local = NULL;
+        }
+        sub_state.global = script_obj_new_ref (state->global);
+        sub_state.this = script_obj_new_ref (this ? this : state->this);
+        sub_state.user_data = state->user_data;
+
+        for (node_data = ply_list_get_first_node (parameter_data);
+             node_data && node_name;
+             node_data = ply_list_get_next_node (parameter_data, node_data)) {
+                const char *atom = ply_list_node_get_data (node_name);
+                script_obj_hash_add_element_atom (sub_state.local, ply_list_node_get_data (node_data), atom);
+                node_name = ply_list_get_next_node (parameter_names, node_name);
+        }
 
-                if (node_name) {
-                        name = ply_list_node_get_data (node_name);
-                        script_obj_hash_add_element (sub_state->local, data_obj, name);
-                        node_name = ply_list_get_next_node (parameter_names, node_name);
+        if (needs_args) {
+                script_obj_t *arg_obj = script_obj_new_hash ();
+                script_obj_t *count_obj;
+                int index = 0;
+
+                for (node_data = ply_list_get_first_node (parameter_data);
+                     node_data;
+                     node_data = ply_list_get_next_node (parameter_data, node_data)) {
+                        const char *atom = script_atom_from_index (index);
+                        script_obj_hash_add_element_atom (arg_obj, ply_list_node_get_data (node_data), atom);
+                        script_atom_unref (atom);
+                        index++;
                 }
-                node_data = ply_list_get_next_node (parameter_data, node_data);
+                count_obj = script_obj_new_number (index);
+                script_obj_hash_add_element (arg_obj, count_obj, "count");
+                script_obj_hash_add_element (sub_state.local, arg_obj, "_args");
+                script_obj_unref (count_obj);
+                script_obj_unref (arg_obj);
         }
 
-        script_obj_t *count_obj = script_obj_new_number (index);
-        script_obj_hash_add_element (arg_obj, count_obj, "count");
-        script_obj_hash_add_element (sub_state->local, arg_obj, "_args");
-        script_obj_unref (count_obj);
-        script_obj_unref (arg_obj);
+        if (this && needs_args)
+                script_obj_hash_add_element (sub_state.local, this, "this");
 
-        if (this)
-                script_obj_hash_add_element (sub_state->local, this, "this");
+        if (script_execute_profile)
+                script_profile_enter_function (script_execute_profile, function);
 
         script_return_t reply;
         switch (function->type) {
         case SCRIPT_FUNCTION_TYPE_SCRIPT:
         {
                 script_op_t *op = function->data.script;
-                reply = script_execute (sub_state, op);
+                if (code)
+                        reply = script_execute_code (&sub_state, code, parameter_data);
+                else
+                        reply = script_execute_tree (&sub_state, op);
                 break;
         }
 
         case SCRIPT_FUNCTION_TYPE_NATIVE:
         {
-                reply = function->data.native (sub_state, function->user_data);
+                reply = function->data.native (&sub_state, function->user_data);
                 break;
         }
         }
-        script_state_destroy (sub_state);
+        if (script_execute_profile)
+                script_profile_leave (script_execute_profile);
+        script_obj_unref (sub_state.global);
+        script_obj_unref (sub_state.local);
+        script_obj_unref (sub_state.this);
         if (reply.type != SCRIPT_RETURN_TYPE_FAIL)
                 reply.type = SCRIPT_RETURN_TYPE_RETURN;
         return reply;
@@ -652,12 +1284,14 @@ script_return_t script_execute_object (script_state_t *state,
         return reply;
 }
 
-script_return_t script_execute (script_state_t *state,
-                                script_op_t    *op)
+static script_return_t script_execute_tree (script_state_t *state,
+                                            script_op_t    *op)
 {
         script_return_t reply = script_return_normal ();
 
         if (!op) return reply;
+        if (script_execute_profile)
+                script_profile_enter_line (script_execute_profile, op);
         switch (op->type) {
         case SCRIPT_OP_TYPE_EXPRESSION:
         {
@@ -675,9 +1309,9 @@ script_return_t script_execute (script_state_t *state,
         {
                 script_obj_t *obj = script_evaluate (state, op->data.cond_op.cond);
                 if (script_obj_as_bool (obj))
-                        reply = script_execute (state, op->data.cond_op.op1);
+                        reply = script_execute_tree (state, op->data.cond_op.op1);
                 else
-                        reply = script_execute (state, op->data.cond_op.op2);
+                        reply = script_execute_tree (state, op->data.cond_op.op2);
                 script_obj_unref (obj);
                 break;
         }
@@ -698,7 +1332,7 @@ script_return_t script_execute (script_state_t *state,
 
                         if (cond) {
                                 script_obj_unref (reply.object);
-                                reply = script_execute (state, op->data.cond_op.op1);
+                                reply = script_execute_tree (state, op->data.cond_op.op1);
                                 switch (reply.type) {
                                 case SCRIPT_RETURN_TYPE_NORMAL:
                                         break;
@@ -711,11 +1345,12 @@ script_return_t script_execute (script_state_t *state,
                                         return script_return_normal ();
 
                                 case SCRIPT_RETURN_TYPE_CONTINUE:
+                                        reply = script_return_normal ();
                                         break;
                                 }
                                 if (op->data.cond_op.op2) {
                                         script_obj_unref (reply.object);
-                                        reply = script_execute (state, op->data.cond_op.op2);
+                                        reply = script_execute_tree (state, op->data.cond_op.op2);
                                 }
                         } else {
                                 break;
@@ -754,3 +1389,35 @@ script_return_t script_execute (script_state_t *state,
         }
         return reply;
 }
+
+script_return_t script_execute (script_state_t *state,
+                                script_op_t    *op)
+{
+        script_return_t reply;
+        script_code_t *code;
+
+        if (!script_execute_use_bytecode) {
+                reply = script_execute_tree (state, op);
+        } else {
+                code = script_compile_op (op);
+                reply = script_execute_code (state, code, NULL);
+                script_code_free (code);
+        }
+
+        /* The last line run does not go on until the next script code */
+        if (script_execute_profile)
+                script_profile_leave_line (script_execute_profile);
+
+        return reply;
+}
+
+void script_execute_set_use_bytecode (bool use_bytecode)
+{
+        script_execute_use_bytecode = use_bytecode;
+}
+
+/* While a profile is set, every function call is recorded in it */
+void script_execute_set_profile (script_profile_t *profile)
+{
+        script_execute_profile = profile;
+}
@@ -23,6 +23,7 @@
 #define SCRIPT_EXECUTE_H
 
 #include "script.h"
+#include "script-profile.h"
 
 script_return_t script_execute (script_state_t *state,
                                 script_op_t    *op);
@@ -31,5 +32,7 @@ script_return_t script_execute_object (script_state_t * state,
                                        script_obj_t * this,
                                        script_obj_t * first_arg,
                                        ...);
+void script_execute_set_use_bytecode (bool use_bytecode);
+void script_execute_set_profile (script_profile_t *profile);
 
 #endif /* SCRIPT_EXECUTE_H */
@@ -22,6 +22,7 @@
 
 #include "config.h"
 
+#include "ply-hashtable.h"
 #include "ply-image.h"
 #include "ply-label.h"
 #include "ply-pixel-buffer.h"
@@ -34,12 +35,47 @@
 #include "script-execute.h"
 #include "script-lib-image.h"
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "script-lib-image.script.h"
 
+/* Results of transforms, most recently used first.  Themes tend to rotate
+ * the same image through the same few angles, or scale a logo to the same
+ * size for every display, so these are shared rather than redone.  The
+ * budget covers the results and the sources kept for them.
+ */
+#define SCRIPT_LIB_IMAGE_TRANSFORM_BUDGET (8 * 1024 * 1024)
+
+typedef enum
+{
+        IMAGE_TRANSFORM_ROTATE,
+        IMAGE_TRANSFORM_CROP,
+        IMAGE_TRANSFORM_SCALE,
+        IMAGE_TRANSFORM_TILE,
+} image_transform_op_t;
+
+/* A source is held while any transform of it is, so its pixels cannot be
+ * freed and reused by another image, and counts once towards the budget
+ */
+typedef struct
+{
+        ply_pixel_buffer_t *buffer;
+        size_t              size;
+        int                 transform_count;
+} image_transform_source_t;
+
+typedef struct
+{
+        char                     *key;
+        image_transform_source_t *source;
+        ply_pixel_buffer_t       *result;
+        size_t                    size;
+        ply_list_node_t          *node;
+} image_transform_t;
+
 static void image_free (script_obj_t *obj)
 {
         ply_pixel_buffer_t *image = obj->data.native.object_data;
@@ -112,20 +148,174 @@ static script_return_t image_get_height (script_state_t *state,
         return script_return_obj (script_obj_new_number (size.height));
 }
 
+static void image_transform_remove (script_lib_image_data_t *data,
+                                    image_transform_t       *transform)
+{
+        ply_hashtable_remove (data->transforms, transform->key);
+        ply_list_remove_node (data->transform_list, transform->node);
+        data->transform_size -= transform->size;
+        if (--transform->source->transform_count == 0) {
+                ply_hashtable_remove (data->transform_sources,
+                                      ply_pixel_buffer_get_argb32_data (transform->source->buffer));
+                data->transform_size -= transform->source->size;
+                ply_pixel_buffer_free (transform->source->buffer);
+                free (transform->source);
+        }
+        ply_pixel_buffer_free (transform->result);
+        free (transform->key);
+        free (transform);
+}
+
+/* Returns a new buffer holding image transformed by op.  The source is
+ * told apart by its pixel data, which buffers sharing it have in common
+ * and which is never changed in place while shared, so the result can be
+ * handed out again for as long as the entry holds on to the source.
+ */
+static ply_pixel_buffer_t *image_transform (script_lib_image_data_t *data,
+                                            ply_pixel_buffer_t      *image,
+                                            image_transform_op_t     op,
+                                            double                   param_a,
+                                            double                   param_b,
+                                            double                   param_c,
+                                            double                   param_d)
+{
+        image_transform_t *transform;
+        image_transform_source_t *source;
+        ply_pixel_buffer_t *result = NULL;
+        ply_rectangle_t size;
+        size_t source_size;
+        size_t needed;
+        char *key;
+
+        asprintf (&key, "%p %d %d %a %a %a %a",
+                  (void *) ply_pixel_buffer_get_argb32_data (image),
+                  ply_pixel_buffer_get_device_scale (image),
+                  op,
+                  param_a,
+                  param_b,
+                  param_c,
+                  param_d);
+        transform = ply_hashtable_lookup (data->transforms, key);
+
+        if (transform != NULL) {
+                free (key);
+                data->transform_hits++;
+                ply_list_remove_node (data->transform_list, transform->node);
+                transform->node = ply_list_prepend_data (data->transform_list, transform);
+                return ply_pixel_buffer_share (transform->result);
+        }
+        data->transform_misses++;
+
+        switch (op) {
+        case IMAGE_TRANSFORM_ROTATE:
+                ply_pixel_buffer_get_size (image, &size);
+                result = ply_pixel_buffer_rotate (image,
+                                                  size.width / 2,
+                                                  size.height / 2,
+                                                  param_a);
+                break;
+        case IMAGE_TRANSFORM_CROP:
+                {
+                        ply_rectangle_t clip_area = { 0, 0, (long) param_c, (long) param_d };
+
+                        result = ply_pixel_buffer_new ((long) param_c, (long) param_d);
+                        ply_pixel_buffer_fill_with_buffer_with_clip (result, image,
+                                                                     -param_a, -param_b,
+                                                                     &clip_area);
+                }
+                break;
+        case IMAGE_TRANSFORM_SCALE:
+                result = ply_pixel_buffer_resize (image, param_a, param_b);
+                break;
+        case IMAGE_TRANSFORM_TILE:
+                result = ply_pixel_buffer_tile (image, param_a, param_b);
+                break;
+        }
+
+        transform = calloc (1, sizeof(image_transform_t));
+        transform->key = key;
+        ply_pixel_buffer_get_size (result, &size);
+        transform->size = (size_t) size.width * size.height * sizeof(uint32_t);
+        ply_pixel_buffer_get_size (image, &size);
+        source_size = (size_t) size.width * size.height * sizeof(uint32_t);
+
+        if (transform->size + source_size > SCRIPT_LIB_IMAGE_TRANSFORM_BUDGET) {
+                free (transform->key);
+                free (transform);
+                return result;
+        }
+
+        /* Making room may let go of the source too, so it is looked up
+         * again each time round */
+        for (;;) {
+                source = ply_hashtable_lookup (data->transform_sources,
+                                              ply_pixel_buffer_get_argb32_data (image));
+                needed = transform->size + (source == NULL ? source_size : 0);
+                if (data->transform_size + needed <= SCRIPT_LIB_IMAGE_TRANSFORM_BUDGET)
+                        break;
+                image_transform_remove (data, ply_list_node_get_data (ply_list_get_last_node (data->transform_list)));
+        }
+
+        if (source == NULL) {
+                source = calloc (1, sizeof(image_transform_source_t));
+                source->buffer = ply_pixel_buffer_share (image);
+                source->size = source_size;
+                ply_hashtable_insert (data->transform_sources,
+                                      ply_pixel_buffer_get_argb32_data (source->buffer),
+                                      source);
+                data->transform_size += source_size;
+        }
+        source->transform_count++;
+
+        transform->source = source;
+        transform->result = result;
+        transform->node = ply_list_prepend_data (data->transform_list, transform);
+        ply_hashtable_insert (data->transforms, transform->key, transform);
+        data->transform_size += transform->size;
+
+        return ply_pixel_buffer_share (result);
+}
+
+/* Transforms that would leave the image unchanged hand out a buffer
+ * sharing the pixel data instead of a copy
+ */
+static bool is_full_size (ply_pixel_buffer_t *image,
+                          int                 width,
+                          int                 height)
+{
+        ply_rectangle_t size;
+
+        if (ply_pixel_buffer_get_device_scale (image) != 1)
+                return false;
+
+        ply_pixel_buffer_get_size (image, &size);
+
+        return size.width == (unsigned long) width && size.height == (unsigned long) height;
+}
+
 static script_return_t image_rotate (script_state_t *state,
                                      void           *user_data)
 {
         script_lib_image_data_t *data = user_data;
         ply_pixel_buffer_t *image = script_obj_as_native_of_class (state->this, data->class);
         float angle = script_obj_hash_get_number (state->local, "angle");
-        ply_rectangle_t size;
+        double turn;
 
         if (image) {
-                ply_pixel_buffer_get_size (image, &size);
-                ply_pixel_buffer_t *new_image = ply_pixel_buffer_rotate (image,
-                                                                         size.width / 2,
-                                                                         size.height / 2,
-                                                                         angle);
+                /* With a rotation step, angles that only differ by whole
+                 * turns, or by less than the step, give the same image */
+                if (data->rotation_step > 0 && isfinite (angle)) {
+                        turn = fmod (angle, 2 * M_PI);
+                        if (turn < 0)
+                                turn += 2 * M_PI;
+                        angle = fmod (round (turn / data->rotation_step) * data->rotation_step,
+                                      2 * M_PI);
+                }
+                if (angle == 0)
+                        return script_return_obj (script_obj_new_native (ply_pixel_buffer_share (image), data->class));
+
+                ply_pixel_buffer_t *new_image = image_transform (data, image, IMAGE_TRANSFORM_ROTATE,
+                                                                 angle, 0, 0, 0);
                 return script_return_obj (script_obj_new_native (new_image, data->class));
         }
         return script_return_obj_null ();
@@ -142,9 +332,11 @@ static script_return_t image_crop (script_state_t *state,
         int height = script_obj_hash_get_number (state->local, "height");
 
         if (image) {
-                ply_rectangle_t clip_area = { 0, 0, width, height };
-                ply_pixel_buffer_t *new_image = ply_pixel_buffer_new (width, height);
-                ply_pixel_buffer_fill_with_buffer_with_clip (new_image, image, -x, -y, &clip_area);
+                if (x == 0 && y == 0 && is_full_size (image, width, height))
+                        return script_return_obj (script_obj_new_native (ply_pixel_buffer_share (image), data->class));
+
+                ply_pixel_buffer_t *new_image = image_transform (data, image, IMAGE_TRANSFORM_CROP,
+                                                                 x, y, width, height);
                 return script_return_obj (script_obj_new_native (new_image, data->class));
         }
         return script_return_obj_null ();
@@ -159,7 +351,11 @@ static script_return_t image_scale (script_state_t *state,
         int height = script_obj_hash_get_number (state->local, "height");
 
         if (image) {
-                ply_pixel_buffer_t *new_image = ply_pixel_buffer_resize (image, width, height);
+                if (is_full_size (image, width, height))
+                        return script_return_obj (script_obj_new_native (ply_pixel_buffer_share (image), data->class));
+
+                ply_pixel_buffer_t *new_image = image_transform (data, image, IMAGE_TRANSFORM_SCALE,
+                                                                 width, height, 0, 0);
                 return script_return_obj (script_obj_new_native (new_image, data->class));
         }
         return script_return_obj_null ();
@@ -174,7 +370,8 @@ static script_return_t image_tile (script_state_t *state,
         int height = script_obj_hash_get_number (state->local, "height");
 
         if (image) {
-                ply_pixel_buffer_t *new_image = ply_pixel_buffer_tile (image, width, height);
+                ply_pixel_buffer_t *new_image = image_transform (data, image, IMAGE_TRANSFORM_TILE,
+                                                                 width, height, 0, 0);
                 return script_return_obj (script_obj_new_native (new_image, data->class));
         }
         return script_return_obj_null ();
@@ -187,7 +384,6 @@ static script_return_t image_text (script_state_t *state,
         ply_pixel_buffer_t *image;
         ply_label_t *label;
         script_obj_t *alpha_obj, *font_obj, *align_obj;
-        int width, height;
         int align = PLY_LABEL_ALIGN_LEFT;
         char *font;
 
@@ -245,28 +441,148 @@ static script_return_t image_text (script_state_t *state,
                 ply_label_set_font (label, font);
         ply_label_set_alignment (label, align);
         ply_label_set_color (label, red, green, blue, alpha);
-        ply_label_show (label, NULL, 0, 0);
 
-        width = ply_label_get_width (label);
-        height = ply_label_get_height (label);
-
-        image = ply_pixel_buffer_new (width, height);
-        ply_label_draw_area (label, image, 0, 0, width, height);
+        /* Status messages and clocks show the same few strings over and
+         * over, so the rendered text is shared where possible */
+        image = ply_label_render (label, 1);
 
         free (text);
         free (font);
         ply_label_free (label);
 
+        if (!image)
+                image = ply_pixel_buffer_new (0, 0);
+
         return script_return_obj (script_obj_new_native (image, data->class));
 }
 
+/* Draws each image over the ones before it, at its offset and opacity,
+ * into a new image.  If nothing shows through, the result is marked opaque
+ * so that drawing it copies rather than blends.
+ */
+ply_pixel_buffer_t *script_lib_image_compose (ply_pixel_buffer_t **images,
+                                              const long          *x,
+                                              const long          *y,
+                                              const double        *opacities,
+                                              int                  count,
+                                              unsigned long        width,
+                                              unsigned long        height)
+{
+        ply_pixel_buffer_t *composed = ply_pixel_buffer_new (width, height);
+        uint32_t *pixels;
+        unsigned long i, pixel_count;
+        bool is_opaque;
+
+        for (i = 0; i < (unsigned long) count; i++)
+                ply_pixel_buffer_fill_with_buffer_at_opacity (composed,
+                                                              images[i],
+                                                              x[i],
+                                                              y[i],
+                                                              opacities[i]);
+
+        pixels = ply_pixel_buffer_get_argb32_data (composed);
+        pixel_count = width * height;
+        is_opaque = pixel_count > 0;
+        for (i = 0; i < pixel_count && is_opaque; i++)
+                is_opaque = (pixels[i] >> 24) == 0xff;
+        ply_pixel_buffer_set_opaque (composed, is_opaque);
+
+        return composed;
+}
+
+static script_obj_t *image_array_peek (script_obj_t *array,
+                                       int           index)
+{
+        char key[16];
+
+        if (!script_obj_is_hash (array)) return NULL;
+        snprintf (key, sizeof(key), "%d", index);
+        return script_obj_hash_peek_element (array, key);
+}
+
+static double image_array_get_number (script_obj_t *array,
+                                      int           index,
+                                      double        default_value)
+{
+        script_obj_t *obj = image_array_peek (array, index);
+        double value = default_value;
+
+        if (obj && script_obj_is_number (obj))
+                value = script_obj_as_number (obj);
+        script_obj_unref (obj);
+        return value;
+}
+
+/* Image.Compose (images, x, y, opacity, width, height) draws an array of
+ * images, each at the position and opacity from the same index of the
+ * other arrays, into one new image.  Positions default to 0, opacities to
+ * 1 and the size to whatever holds every image.
+ */
+static script_return_t image_compose (script_state_t *state,
+                                      void           *user_data)
+{
+        script_lib_image_data_t *data = user_data;
+        script_obj_t *images_obj = script_obj_hash_get_element (state->local, "images");
+        script_obj_t *x_obj = script_obj_hash_get_element (state->local, "x");
+        script_obj_t *y_obj = script_obj_hash_get_element (state->local, "y");
+        script_obj_t *opacity_obj = script_obj_hash_get_element (state->local, "opacity");
+        double width = script_obj_hash_get_number (state->local, "width");
+        double height = script_obj_hash_get_number (state->local, "height");
+        ply_pixel_buffer_t **images = NULL;
+        long *x = NULL, *y = NULL;
+        double *opacities = NULL;
+        long max_width = 0, max_height = 0;
+        ply_pixel_buffer_t *composed;
+        script_obj_t *obj;
+        int index, count = 0;
+
+        /* The array of images ends at the first index with no entry */
+        for (index = 0; (obj = image_array_peek (images_obj, index)); index++) {
+                ply_pixel_buffer_t *image = script_obj_as_native_of_class (obj, data->class);
+                script_obj_unref (obj);
+                if (!image) continue;
+
+                images = realloc (images, (count + 1) * sizeof(ply_pixel_buffer_t *));
+                x = realloc (x, (count + 1) * sizeof(long));
+                y = realloc (y, (count + 1) * sizeof(long));
+                opacities = realloc (opacities, (count + 1) * sizeof(double));
+                images[count] = image;
+                x[count] = image_array_get_number (x_obj, index, 0);
+                y[count] = image_array_get_number (y_obj, index, 0);
+                opacities[count] = CLAMP (image_array_get_number (opacity_obj, index, 1), 0, 1);
+                max_width = MAX (max_width, x[count] + (long) ply_pixel_buffer_get_width (image));
+                max_height = MAX (max_height, y[count] + (long) ply_pixel_buffer_get_height (image));
+                count++;
+        }
+
+        if (!(width >= 0)) width = max_width;
+        if (!(height >= 0)) height = max_height;
+        composed = script_lib_image_compose (images, x, y, opacities, count, width, height);
+
+        free (images);
+        free (x);
+        free (y);
+        free (opacities);
+        script_obj_unref (images_obj);
+        script_obj_unref (x_obj);
+        script_obj_unref (y_obj);
+        script_obj_unref (opacity_obj);
+
+        return script_return_obj (script_obj_new_native (composed, data->class));
+}
+
 script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
                                                  char           *image_dir)
 {
-        script_lib_image_data_t *data = malloc (sizeof(script_lib_image_data_t));
+        script_lib_image_data_t *data = calloc (1, sizeof(script_lib_image_data_t));
 
         data->class = script_obj_native_class_new (image_free, "image", data);
         data->image_dir = strdup (image_dir);
+        data->transforms = ply_hashtable_new (ply_hashtable_string_hash,
+                                              ply_hashtable_string_compare);
+        data->transform_list = ply_list_new ();
+        data->transform_sources = ply_hashtable_new (ply_hashtable_direct_hash,
+                                                     ply_hashtable_direct_compare);
 
         script_obj_t *image_hash = script_obj_hash_get_element (state->global, "Image");
 
@@ -315,6 +631,17 @@ script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
                                     image_get_height,
                                     data,
                                     NULL);
+        script_add_native_function (image_hash,
+                                    "_Compose",
+                                    image_compose,
+                                    data,
+                                    "images",
+                                    "x",
+                                    "y",
+                                    "opacity",
+                                    "width",
+                                    "height",
+                                    NULL);
         script_add_native_function (image_hash,
                                     "_Text",
                                     image_text,
@@ -335,8 +662,29 @@ script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
         return data;
 }
 
+/* Rotations are done to the nearest multiple of step radians, so that
+ * angles close together share one image.  By default, and with a step of
+ * 0, they are done exactly.
+ */
+void script_lib_image_set_rotation_step (script_lib_image_data_t *data,
+                                         double                   step)
+{
+        data->rotation_step = step > 0 ? step : 0;
+}
+
 void script_lib_image_destroy (script_lib_image_data_t *data)
 {
+        ply_list_node_t *node;
+
+        ply_trace ("image transforms: %lu reused, %lu made",
+                   data->transform_hits, data->transform_misses);
+
+        while ((node = ply_list_get_first_node (data->transform_list)))
+                image_transform_remove (data, ply_list_node_get_data (node));
+        ply_list_free (data->transform_list);
+        ply_hashtable_free (data->transforms);
+        ply_hashtable_free (data->transform_sources);
+
         script_obj_native_class_destroy (data->class);
         free (data->image_dir);
         script_parse_op_free (data->script_main_op);
@@ -22,6 +22,9 @@
 #ifndef SCRIPT_LIB_IMAGE_H
 #define SCRIPT_LIB_IMAGE_H
 
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include "ply-pixel-buffer.h"
 #include "script.h"
 
 typedef struct
@@ -29,10 +32,26 @@ typedef struct
         script_obj_native_class_t *class;
         script_op_t               *script_main_op;
         char                      *image_dir;
+        ply_hashtable_t           *transforms;
+        ply_list_t                *transform_list;
+        ply_hashtable_t           *transform_sources;
+        size_t                     transform_size;      /* results and sources held */
+        double                     rotation_step;
+        unsigned long              transform_hits;
+        unsigned long              transform_misses;
 } script_lib_image_data_t;
 
 script_lib_image_data_t *script_lib_image_setup (script_state_t *state,
                                                  char           *image_dir);
+void script_lib_image_set_rotation_step (script_lib_image_data_t *data,
+                                         double                   step);
 void script_lib_image_destroy (script_lib_image_data_t *data);
+ply_pixel_buffer_t *script_lib_image_compose (ply_pixel_buffer_t **images,
+                                              const long          *x,
+                                              const long          *y,
+                                              const double        *opacities,
+                                              int                  count,
+                                              unsigned long        width,
+                                              unsigned long        height);
 
 #endif /* SCRIPT_LIB_IMAGE_H */
@@ -37,6 +37,32 @@
 
 #include "script-lib-math.script.h"
 
+/* Members of Math which never change.  The parser folds these into scripts
+ * which cannot modify Math.
+ */
+static const struct
+{
+        const char     *name;
+        script_number_t value;
+} script_lib_math_constants[] = {
+        { "Pi", M_PI },
+        { NULL, 0    }
+};
+
+bool script_lib_math_get_constant (const char      *name,
+                                   script_number_t *value)
+{
+        int index;
+
+        for (index = 0; script_lib_math_constants[index].name; index++) {
+                if (!strcmp (script_lib_math_constants[index].name, name)) {
+                        *value = script_lib_math_constants[index].value;
+                        return true;
+                }
+        }
+        return false;
+}
+
 static script_return_t script_lib_math_double_from_double_function (script_state_t *state,
                                                                     void           *user_data)
 {
@@ -68,6 +94,7 @@ static script_return_t script_lib_math_random (script_state_t *state,
 script_lib_math_data_t *script_lib_math_setup (script_state_t *state)
 {
         script_lib_math_data_t *data = malloc (sizeof(script_lib_math_data_t));
+        int index;
 
         srand ((int) ply_get_timestamp ());
 
@@ -114,6 +141,11 @@ script_lib_math_data_t *script_lib_math_setup (script_state_t *state)
                                     script_lib_math_random,
                                     NULL,
                                     NULL);
+        for (index = 0; script_lib_math_constants[index].name; index++) {
+                script_obj_t *constant = script_obj_new_number (script_lib_math_constants[index].value);
+                script_obj_hash_add_element (math_hash, constant, script_lib_math_constants[index].name);
+                script_obj_unref (constant);
+        }
         script_obj_unref (math_hash);
 
         data->script_main_op = script_parse_string (script_lib_math_string, "script-lib-math.script");
@@ -31,5 +31,7 @@ typedef struct
 
 script_lib_math_data_t *script_lib_math_setup (script_state_t *state);
 void script_lib_math_destroy (script_lib_math_data_t *data);
+bool script_lib_math_get_constant (const char      *name,
+                                   script_number_t *value);
 
 #endif /* SCRIPT_LIB_MATH_H */
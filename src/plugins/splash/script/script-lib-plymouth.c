@@ -222,15 +222,22 @@ void script_lib_plymouth_destroy (script_lib_plymouth_data_t *data)
         free (data);
 }
 
+/* The refresh function is passed the seconds since it was last called,
+ * which can be more than one frame when the machine is too slow to keep up
+ */
 void script_lib_plymouth_on_refresh (script_state_t             *state,
-                                     script_lib_plymouth_data_t *data)
+                                     script_lib_plymouth_data_t *data,
+                                     double                      elapsed)
 {
+        script_obj_t *elapsed_obj = script_obj_new_number (elapsed);
         script_return_t ret = script_execute_object (state,
                                                      data->script_refresh_func,
                                                      NULL,
+                                                     elapsed_obj,
                                                      NULL);
 
         script_obj_unref (ret.object);
+        script_obj_unref (elapsed_obj);
 }
 
 void script_lib_plymouth_on_boot_progress (script_state_t             *state,
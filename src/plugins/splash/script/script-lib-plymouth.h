@@ -50,7 +50,8 @@ script_lib_plymouth_data_t *script_lib_plymouth_setup (script_state_t        *st
 void script_lib_plymouth_destroy (script_lib_plymouth_data_t *data);
 
 void script_lib_plymouth_on_refresh (script_state_t             *state,
-                                     script_lib_plymouth_data_t *data);
+                                     script_lib_plymouth_data_t *data,
+                                     double                      elapsed);
 void script_lib_plymouth_on_boot_progress (script_state_t             *state,
                                            script_lib_plymouth_data_t *data,
                                            double                      duration,
@@ -33,16 +33,265 @@
 #include "script-lib-image.h"
 #include "script-lib-sprite.h"
 #include <assert.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 
 #include "script-lib-sprite.script.h"
 
+/* Sprites with an image are kept in a grid of cells covering the screen, so
+ * drawing an area only has to look at the sprites near it.  Anything off
+ * the edge of the screen is filed under the nearest edge cell.  The grid
+ * holds the sprites where they were last refreshed, which is where they
+ * are on screen.
+ */
+#define SPRITE_GRID_CELL_SIZE 64
+
+/* More sprites than this changing z in one refresh sorts the whole list */
+#define SPRITE_MAX_MOVED_BEFORE_SORT 32
+
+/* A damaged region of more rectangles than this is redrawn as the one
+ * rectangle around them all, as merging each new one in gets slow */
+#define SPRITE_MAX_DAMAGED_RECTANGLES 64
+
+/* Opaque sprites after this many in one area are not looked at for
+ * hiding the ones under them */
+#define SPRITE_MAX_OCCLUDERS 16
+
+typedef struct
+{
+        sprite_t **sprites;
+        int        count;
+        int        capacity;
+} sprite_grid_cell_t;
+
+struct script_lib_sprite_grid_t
+{
+        int                 columns;
+        int                 rows;
+        sprite_grid_cell_t *cells;
+        unsigned int        query_stamp;
+        sprite_t          **found;
+        int                 found_capacity;
+};
+
+static script_lib_sprite_grid_t *sprite_grid_new (int width,
+                                                  int height)
+{
+        script_lib_sprite_grid_t *grid = calloc (1, sizeof(script_lib_sprite_grid_t));
+
+        grid->columns = MAX (1, (width + SPRITE_GRID_CELL_SIZE - 1) / SPRITE_GRID_CELL_SIZE);
+        grid->rows = MAX (1, (height + SPRITE_GRID_CELL_SIZE - 1) / SPRITE_GRID_CELL_SIZE);
+        grid->cells = calloc (grid->columns * grid->rows, sizeof(sprite_grid_cell_t));
+        return grid;
+}
+
+static void sprite_grid_free (script_lib_sprite_grid_t *grid)
+{
+        int i;
+
+        for (i = 0; i < grid->columns * grid->rows; i++)
+                free (grid->cells[i].sprites);
+        free (grid->cells);
+        free (grid->found);
+        free (grid);
+}
+
+static void sprite_grid_get_cells (script_lib_sprite_grid_t *grid,
+                                   long                      x,
+                                   long                      y,
+                                   long                      width,
+                                   long                      height,
+                                   int                      *cell_x1,
+                                   int                      *cell_y1,
+                                   int                      *cell_x2,
+                                   int                      *cell_y2)
+{
+        *cell_x1 = CLAMP (x / SPRITE_GRID_CELL_SIZE, 0, grid->columns - 1);
+        *cell_y1 = CLAMP (y / SPRITE_GRID_CELL_SIZE, 0, grid->rows - 1);
+        *cell_x2 = CLAMP ((x + width - 1) / SPRITE_GRID_CELL_SIZE, 0, grid->columns - 1);
+        *cell_y2 = CLAMP ((y + height - 1) / SPRITE_GRID_CELL_SIZE, 0, grid->rows - 1);
+}
+
+static void sprite_grid_remove (script_lib_sprite_grid_t *grid,
+                                sprite_t                 *sprite)
+{
+        int cell_x, cell_y, i;
+
+        if (!sprite->is_in_grid) return;
+        for (cell_y = sprite->cell_y1; cell_y <= sprite->cell_y2; cell_y++) {
+                for (cell_x = sprite->cell_x1; cell_x <= sprite->cell_x2; cell_x++) {
+                        sprite_grid_cell_t *cell = &grid->cells[cell_y * grid->columns + cell_x];
+                        for (i = 0; i < cell->count; i++) {
+                                if (cell->sprites[i] != sprite) continue;
+                                cell->sprites[i] = cell->sprites[--cell->count];
+                                break;
+                        }
+                }
+        }
+        sprite->is_in_grid = false;
+}
+
+static void sprite_grid_update (script_lib_sprite_grid_t *grid,
+                                sprite_t                 *sprite)
+{
+        int cell_x1, cell_y1, cell_x2, cell_y2;
+        int cell_x, cell_y;
+
+        sprite_grid_get_cells (grid,
+                               sprite->old_x,
+                               sprite->old_y,
+                               MAX (sprite->old_width, 1),
+                               MAX (sprite->old_height, 1),
+                               &cell_x1, &cell_y1, &cell_x2, &cell_y2);
+        if (sprite->is_in_grid &&
+            sprite->cell_x1 == cell_x1 && sprite->cell_y1 == cell_y1 &&
+            sprite->cell_x2 == cell_x2 && sprite->cell_y2 == cell_y2)
+                return;
+
+        sprite_grid_remove (grid, sprite);
+        for (cell_y = cell_y1; cell_y <= cell_y2; cell_y++) {
+                for (cell_x = cell_x1; cell_x <= cell_x2; cell_x++) {
+                        sprite_grid_cell_t *cell = &grid->cells[cell_y * grid->columns + cell_x];
+                        if (cell->count == cell->capacity) {
+                                cell->capacity = cell->capacity ? cell->capacity * 2 : 8;
+                                cell->sprites = realloc (cell->sprites,
+                                                         cell->capacity * sizeof(sprite_t *));
+                        }
+                        cell->sprites[cell->count++] = sprite;
+                }
+        }
+        sprite->cell_x1 = cell_x1;
+        sprite->cell_y1 = cell_y1;
+        sprite->cell_x2 = cell_x2;
+        sprite->cell_y2 = cell_y2;
+        sprite->is_in_grid = true;
+}
+
+static int sprite_compare_order (const void *element_a,
+                                 const void *element_b)
+{
+        const sprite_t *sprite_a = *(sprite_t *const *) element_a;
+        const sprite_t *sprite_b = *(sprite_t *const *) element_b;
+
+        return sprite_a->order - sprite_b->order;
+}
+
+static void sprite_grid_add_found (script_lib_sprite_grid_t *grid,
+                                   sprite_t                 *sprite,
+                                   int                      *count)
+{
+        if (sprite->query_stamp == grid->query_stamp) return;
+        sprite->query_stamp = grid->query_stamp;
+        if (*count == grid->found_capacity) {
+                grid->found_capacity = grid->found_capacity ? grid->found_capacity * 2 : 64;
+                grid->found = realloc (grid->found,
+                                       grid->found_capacity * sizeof(sprite_t *));
+        }
+        grid->found[(*count)++] = sprite;
+}
+
+/* Returns the sprites which may overlap the area along with the extra
+ * sprites, in z order */
+static sprite_t **sprite_grid_find (script_lib_sprite_grid_t *grid,
+                                    ply_list_t               *extra_sprites,
+                                    long                      x,
+                                    long                      y,
+                                    long                      width,
+                                    long                      height,
+                                    int                      *count)
+{
+        int cell_x1, cell_y1, cell_x2, cell_y2;
+        int cell_x, cell_y, i;
+        ply_list_node_t *node;
+
+        *count = 0;
+        grid->query_stamp++;
+        sprite_grid_get_cells (grid, x, y, width, height,
+                               &cell_x1, &cell_y1, &cell_x2, &cell_y2);
+        for (cell_y = cell_y1; cell_y <= cell_y2; cell_y++) {
+                for (cell_x = cell_x1; cell_x <= cell_x2; cell_x++) {
+                        sprite_grid_cell_t *cell = &grid->cells[cell_y * grid->columns + cell_x];
+                        for (i = 0; i < cell->count; i++)
+                                sprite_grid_add_found (grid, cell->sprites[i], count);
+                }
+        }
+        for (node = ply_list_get_first_node (extra_sprites);
+             node;
+             node = ply_list_get_next_node (extra_sprites, node))
+                sprite_grid_add_found (grid, ply_list_node_get_data (node), count);
+        /* Nothing found may mean nothing was ever allocated */
+        if (*count > 0)
+                qsort (grid->found, *count, sizeof(sprite_t *), sprite_compare_order);
+        return grid->found;
+}
+
+/* Changed sprites are only looked at on the next refresh */
+static void sprite_mark_dirty (script_lib_sprite_data_t *data,
+                               sprite_t                 *sprite)
+{
+        if (sprite->is_dirty) return;
+        sprite->is_dirty = true;
+        ply_list_append_data (data->dirty_sprites, sprite);
+}
+
+/* A SpriteAnimation is a list of frames shown in turn at a fixed rate.
+ * Sprites showing one have their frame picked on each refresh, without
+ * running any script code.
+ */
+typedef struct
+{
+        ply_pixel_buffer_t **frames;
+        script_obj_t       **frame_objs;        /* images the frames came from */
+        int                  frame_count;
+        double               frame_rate;
+} sprite_animation_t;
+
+static void sprite_animation_free (script_obj_t *obj)
+{
+        sprite_animation_t *animation = obj->data.native.object_data;
+        int i;
+
+        for (i = 0; i < animation->frame_count; i++) {
+                if (animation->frame_objs[i])
+                        script_obj_unref (animation->frame_objs[i]);
+                else
+                        ply_pixel_buffer_free (animation->frames[i]);
+        }
+        free (animation->frames);
+        free (animation->frame_objs);
+        free (animation);
+}
+
+static sprite_animation_t *sprite_animation_new (int    frame_count,
+                                                 double frame_rate)
+{
+        sprite_animation_t *animation = calloc (1, sizeof(sprite_animation_t));
+
+        animation->frames = calloc (frame_count, sizeof(ply_pixel_buffer_t *));
+        animation->frame_objs = calloc (frame_count, sizeof(script_obj_t *));
+        animation->frame_count = frame_count;
+        animation->frame_rate = isfinite (frame_rate) ? frame_rate : 0;
+        return animation;
+}
+
+static int sprite_animation_get_frame (sprite_animation_t *animation,
+                                       double              elapsed_time)
+{
+        double frame;
+
+        if (animation->frame_rate <= 0 || elapsed_time <= 0) return 0;
+        frame = fmod (floor (elapsed_time * animation->frame_rate), animation->frame_count);
+        return (int) frame;
+}
+
 static void sprite_free (script_obj_t *obj)
 {
         sprite_t *sprite = obj->data.native.object_data;
+        script_lib_sprite_data_t *data = obj->data.native.class->user_data;
 
         sprite->remove_me = true;
+        sprite_mark_dirty (data, sprite);
 }
 
 static script_return_t sprite_new (script_state_t *state,
@@ -50,6 +299,7 @@ static script_return_t sprite_new (script_state_t *state,
 {
         script_lib_sprite_data_t *data = user_data;
         script_obj_t *reply;
+        ply_list_node_t *node;
 
         sprite_t *sprite = calloc (1, sizeof(sprite_t));
 
@@ -67,7 +317,16 @@ static script_return_t sprite_new (script_state_t *state,
         sprite->remove_me = false;
         sprite->image = NULL;
         sprite->image_obj = NULL;
-        ply_list_append_data (data->sprite_list, sprite);
+        sprite->animation_obj = NULL;
+        sprite->animation_node = NULL;
+        node = ply_list_get_last_node (data->sprite_list);
+        sprite->order = node ? ((sprite_t *) ply_list_node_get_data (node))->order + 1 : 0;
+        sprite->node = ply_list_append_data (data->sprite_list, sprite);
+        sprite->is_sorted = false;
+        sprite->is_dirty = false;
+        sprite->is_in_grid = false;
+        sprite->query_stamp = 0;
+        sprite_mark_dirty (data, sprite);
 
         reply = script_obj_new_native (sprite, data->class);
         return script_return_obj (reply);
@@ -86,30 +345,102 @@ static script_return_t sprite_get_image (script_state_t *state,
         return script_return_obj_null ();
 }
 
-static script_return_t sprite_set_image (script_state_t *state,
-                                         void           *user_data)
+/* The sprite is left showing the frame it reached, which it keeps a
+ * reference to as its image, as the animation may be freed after this.
+ */
+static void sprite_stop_animation (script_lib_sprite_data_t *data,
+                                   sprite_t                 *sprite)
 {
-        script_lib_sprite_data_t *data = user_data;
-        sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
-        script_obj_t *script_obj_image = script_obj_hash_get_element (state->local,
-                                                                      "image");
+        sprite_animation_t *animation;
+        script_obj_t *frame_obj;
+
+        if (!sprite->animation_obj) return;
+        animation = script_obj_as_native_of_class (sprite->animation_obj,
+                                                   data->animation_class);
+        frame_obj = animation->frame_objs[sprite->animation_frame];
+        if (frame_obj)
+                script_obj_ref (frame_obj);
+        else
+                frame_obj = script_obj_new_native (ply_pixel_buffer_share (sprite->image),
+                                                   data->image_class);
+        script_obj_unref (sprite->image_obj);
+        sprite->image_obj = frame_obj;
+        sprite->image = script_obj_as_native_of_class (frame_obj, data->image_class);
+
+        ply_list_remove_node (data->animated_sprites, sprite->animation_node);
+        sprite->animation_node = NULL;
+        script_obj_unref (sprite->animation_obj);
+        sprite->animation_obj = NULL;
+}
 
-        script_obj_deref (&script_obj_image);
+static void sprite_set_image_obj (script_lib_sprite_data_t *data,
+                                  sprite_t                 *sprite,
+                                  script_obj_t             *script_obj_image)
+{
         ply_pixel_buffer_t *image = script_obj_as_native_of_class_name (script_obj_image,
                                                                         "image");
 
         if (image && sprite) {
+                sprite_stop_animation (data, sprite);
                 script_obj_unref (sprite->image_obj);
                 script_obj_ref (script_obj_image);
                 sprite->image = image;
                 sprite->image_obj = script_obj_image;
                 sprite->refresh_me = true;
+                sprite_mark_dirty (data, sprite);
         }
+}
+
+static script_return_t sprite_set_image (script_state_t *state,
+                                         void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
+        script_obj_t *script_obj_image = script_obj_hash_get_element (state->local,
+                                                                      "image");
+
+        script_obj_deref (&script_obj_image);
+        sprite_set_image_obj (data, sprite, script_obj_image);
         script_obj_unref (script_obj_image);
 
         return script_return_obj_null ();
 }
 
+/* Showing an animation starts it from its first frame.  Setting no
+ * animation stops it on the frame it reached.
+ */
+static script_return_t sprite_set_animation (script_state_t *state,
+                                             void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
+        script_obj_t *animation_obj = script_obj_hash_get_element (state->local,
+                                                                   "animation");
+        sprite_animation_t *animation;
+
+        script_obj_deref (&animation_obj);
+        animation = script_obj_as_native_of_class (animation_obj, data->animation_class);
+
+        if (sprite) {
+                sprite_stop_animation (data, sprite);
+                if (animation) {
+                        script_obj_ref (animation_obj);
+                        script_obj_unref (sprite->image_obj);
+                        sprite->image_obj = NULL;
+                        sprite->animation_obj = animation_obj;
+                        sprite->animation_node = ply_list_append_data (data->animated_sprites, sprite);
+                        sprite->animation_start_time = data->get_timestamp ();
+                        sprite->animation_frame = 0;
+                        sprite->image = animation->frames[0];
+                        sprite->refresh_me = true;
+                        sprite_mark_dirty (data, sprite);
+                }
+        }
+        script_obj_unref (animation_obj);
+
+        return script_return_obj_null ();
+}
+
 static script_return_t sprite_get_x (script_state_t *state,
                                      void           *user_data)
 {
@@ -160,8 +491,10 @@ static script_return_t sprite_set_x (script_state_t *state,
         script_lib_sprite_data_t *data = user_data;
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
-        if (sprite)
+        if (sprite) {
                 sprite->x = script_obj_hash_get_number (state->local, "value");
+                sprite_mark_dirty (data, sprite);
+        }
         return script_return_obj_null ();
 }
 
@@ -171,8 +504,10 @@ static script_return_t sprite_set_y (script_state_t *state,
         script_lib_sprite_data_t *data = user_data;
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
-        if (sprite)
+        if (sprite) {
                 sprite->y = script_obj_hash_get_number (state->local, "value");
+                sprite_mark_dirty (data, sprite);
+        }
         return script_return_obj_null ();
 }
 
@@ -182,8 +517,10 @@ static script_return_t sprite_set_z (script_state_t *state,
         script_lib_sprite_data_t *data = user_data;
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
-        if (sprite)
+        if (sprite) {
                 sprite->z = script_obj_hash_get_number (state->local, "value");
+                sprite_mark_dirty (data, sprite);
+        }
         return script_return_obj_null ();
 }
 
@@ -193,8 +530,326 @@ static script_return_t sprite_set_opacity (script_state_t *state,
         script_lib_sprite_data_t *data = user_data;
         sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
 
-        if (sprite)
+        if (sprite) {
                 sprite->opacity = script_obj_hash_get_number (state->local, "value");
+                sprite_mark_dirty (data, sprite);
+        }
+        return script_return_obj_null ();
+}
+
+static script_return_t sprite_set_position (script_state_t *state,
+                                            void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
+
+        if (sprite) {
+                sprite->x = script_obj_hash_get_number (state->local, "x");
+                sprite->y = script_obj_hash_get_number (state->local, "y");
+                sprite->z = script_obj_hash_get_number (state->local, "z");
+                sprite_mark_dirty (data, sprite);
+        }
+        return script_return_obj_null ();
+}
+
+/* Only properties given as numbers are changed */
+static void sprite_set_number_property (script_obj_t    *obj,
+                                        script_number_t *number,
+                                        bool            *is_set)
+{
+        *is_set = obj && script_obj_is_number (obj);
+        if (*is_set)
+                *number = script_obj_as_number (obj);
+}
+
+static script_return_t sprite_set (script_state_t *state,
+                                   void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_t *sprite = script_obj_as_native_of_class (state->this, data->class);
+        script_obj_t *properties = script_obj_hash_get_element (state->local, "properties");
+        script_obj_t *obj;
+        script_number_t number;
+        bool is_set;
+
+        if (!sprite || !script_obj_is_hash (properties)) {
+                script_obj_unref (properties);
+                return script_return_obj_null ();
+        }
+
+        obj = script_obj_hash_peek_element (properties, "x");
+        sprite_set_number_property (obj, &number, &is_set);
+        if (is_set) sprite->x = number;
+        script_obj_unref (obj);
+
+        obj = script_obj_hash_peek_element (properties, "y");
+        sprite_set_number_property (obj, &number, &is_set);
+        if (is_set) sprite->y = number;
+        script_obj_unref (obj);
+
+        obj = script_obj_hash_peek_element (properties, "z");
+        sprite_set_number_property (obj, &number, &is_set);
+        if (is_set) sprite->z = number;
+        script_obj_unref (obj);
+
+        obj = script_obj_hash_peek_element (properties, "opacity");
+        sprite_set_number_property (obj, &number, &is_set);
+        if (is_set) sprite->opacity = number;
+        script_obj_unref (obj);
+
+        obj = script_obj_hash_peek_element (properties, "image");
+        if (obj) {
+                script_obj_deref (&obj);
+                sprite_set_image_obj (data, sprite, obj);
+        }
+        script_obj_unref (obj);
+
+        sprite_mark_dirty (data, sprite);
+        script_obj_unref (properties);
+        return script_return_obj_null ();
+}
+
+static script_obj_t *sprite_array_peek (script_obj_t *array,
+                                        int           index)
+{
+        char key[16];
+
+        if (!array) return NULL;
+        snprintf (key, sizeof(key), "%d", index);
+        return script_obj_hash_peek_element (array, key);
+}
+
+/* Sprite.SetMany (sprites, x, y, z, opacity) sets the properties of each
+ * sprite in an array from the same index of the other arrays.  Any of
+ * them may be left out, or hold something other than a number to leave a
+ * sprite's property as it is.
+ */
+static script_return_t sprite_set_many (script_state_t *state,
+                                        void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        const char *names[] = { "x", "y", "z", "opacity" };
+        script_obj_t *sprites = script_obj_hash_get_element (state->local, "sprites");
+        script_obj_t *arrays[4];
+        script_obj_t *obj;
+        script_number_t number;
+        bool is_set;
+        int index, i;
+
+        for (i = 0; i < 4; i++) {
+                arrays[i] = script_obj_hash_get_element (state->local, names[i]);
+                if (!script_obj_is_hash (arrays[i])) {
+                        script_obj_unref (arrays[i]);
+                        arrays[i] = NULL;
+                }
+        }
+
+        /* The array of sprites ends at the first index with no entry */
+        for (index = 0; (obj = sprite_array_peek (sprites, index)); index++) {
+                sprite_t *sprite = script_obj_as_native_of_class (obj, data->class);
+                script_obj_unref (obj);
+                if (!sprite) continue;
+
+                for (i = 0; i < 4; i++) {
+                        obj = sprite_array_peek (arrays[i], index);
+                        sprite_set_number_property (obj, &number, &is_set);
+                        script_obj_unref (obj);
+                        if (!is_set) continue;
+                        if (i == 0) sprite->x = number;
+                        else if (i == 1) sprite->y = number;
+                        else if (i == 2) sprite->z = number;
+                        else sprite->opacity = number;
+                }
+                sprite_mark_dirty (data, sprite);
+        }
+
+        for (i = 0; i < 4; i++)
+                script_obj_unref (arrays[i]);
+        script_obj_unref (sprites);
+        return script_return_obj_null ();
+}
+
+static int sprite_compare_z_and_order (const void *element_a,
+                                       const void *element_b)
+{
+        const sprite_t *sprite_a = *(sprite_t *const *) element_a;
+        const sprite_t *sprite_b = *(sprite_t *const *) element_b;
+
+        if (sprite_a->z != sprite_b->z)
+                return sprite_a->z < sprite_b->z ? -1 : 1;
+        return sprite_a->order - sprite_b->order;
+}
+
+/* sprite._Flatten (sprites) returns a single image of the visible sprites
+ * in the array, drawn as they would be on screen, and places the sprite
+ * where they were at the lowest z among them.  Scenes that stop changing
+ * can then be drawn with one copy instead of blending every layer.  The
+ * sprites themselves are left alone.
+ */
+static script_return_t sprite_flatten (script_state_t *state,
+                                       void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_t *flat_sprite = script_obj_as_native_of_class (state->this, data->class);
+        script_obj_t *sprites_obj = script_obj_hash_get_element (state->local, "sprites");
+        sprite_t **sprites = NULL;
+        ply_pixel_buffer_t **images;
+        long *x, *y;
+        double *opacities;
+        long x1 = 0, y1 = 0, x2 = 0, y2 = 0;
+        script_obj_t *image_obj;
+        script_obj_t *obj;
+        int index, count = 0, i;
+
+        if (!flat_sprite) {
+                script_obj_unref (sprites_obj);
+                return script_return_obj_null ();
+        }
+
+        for (index = 0; (obj = sprite_array_peek (sprites_obj, index)); index++) {
+                sprite_t *sprite = script_obj_as_native_of_class (obj, data->class);
+                script_obj_unref (obj);
+                if (!sprite || sprite == flat_sprite) continue;
+                if (!sprite->image || sprite->remove_me || sprite->opacity < 0.011) continue;
+                sprites = realloc (sprites, (count + 1) * sizeof(sprite_t *));
+                sprites[count++] = sprite;
+        }
+        script_obj_unref (sprites_obj);
+
+        if (count == 0) {
+                free (sprites);
+                return script_return_obj_null ();
+        }
+
+        qsort (sprites, count, sizeof(sprite_t *), sprite_compare_z_and_order);
+
+        for (i = 0; i < count; i++) {
+                long right = sprites[i]->x + (long) ply_pixel_buffer_get_width (sprites[i]->image);
+                long bottom = sprites[i]->y + (long) ply_pixel_buffer_get_height (sprites[i]->image);
+                x1 = i ? MIN (x1, sprites[i]->x) : sprites[i]->x;
+                y1 = i ? MIN (y1, sprites[i]->y) : sprites[i]->y;
+                x2 = i ? MAX (x2, right) : right;
+                y2 = i ? MAX (y2, bottom) : bottom;
+        }
+
+        images = calloc (count, sizeof(ply_pixel_buffer_t *));
+        x = calloc (count, sizeof(long));
+        y = calloc (count, sizeof(long));
+        opacities = calloc (count, sizeof(double));
+        for (i = 0; i < count; i++) {
+                images[i] = sprites[i]->image;
+                x[i] = sprites[i]->x - x1;
+                y[i] = sprites[i]->y - y1;
+                opacities[i] = CLAMP (sprites[i]->opacity, 0, 1);
+        }
+
+        image_obj = script_obj_new_native (script_lib_image_compose (images, x, y, opacities,
+                                                                     count, x2 - x1, y2 - y1),
+                                           data->image_class);
+
+        flat_sprite->x = x1;
+        flat_sprite->y = y1;
+        flat_sprite->z = sprites[0]->z;
+        flat_sprite->opacity = 1;
+        sprite_mark_dirty (data, flat_sprite);
+
+        free (images);
+        free (x);
+        free (y);
+        free (opacities);
+        free (sprites);
+        return script_return_obj (image_obj);
+}
+
+/* SpriteAnimation._New (frames, frame_rate) takes an array of images,
+ * which ends at the first index with no entry */
+static script_return_t sprite_animation_new_from_frames (script_state_t *state,
+                                                         void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        script_obj_t *frames = script_obj_hash_get_element (state->local, "frames");
+        double frame_rate = script_obj_hash_get_number (state->local, "frame_rate");
+        sprite_animation_t *animation;
+        script_obj_t *obj;
+        int frame_count, i;
+
+        for (frame_count = 0; (obj = sprite_array_peek (frames, frame_count)); frame_count++) {
+                bool is_image = script_obj_is_native_of_class_name (obj, "image");
+                script_obj_unref (obj);
+                if (!is_image) break;
+        }
+
+        if (frame_count == 0) {
+                script_obj_unref (frames);
+                return script_return_obj_null ();
+        }
+
+        animation = sprite_animation_new (frame_count, frame_rate);
+        for (i = 0; i < frame_count; i++) {
+                obj = sprite_array_peek (frames, i);
+                script_obj_deref (&obj);
+                animation->frames[i] = script_obj_as_native_of_class_name (obj, "image");
+                animation->frame_objs[i] = obj;
+        }
+        script_obj_unref (frames);
+
+        return script_return_obj (script_obj_new_native (animation, data->animation_class));
+}
+
+/* SpriteAnimation._NewFromSheet (image, columns, rows, frame_rate, count)
+ * cuts an image into a grid of equally sized frames, taken a row at a
+ * time.  Without a count every cell is a frame.
+ */
+static script_return_t sprite_animation_new_from_sheet (script_state_t *state,
+                                                        void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        ply_pixel_buffer_t *sheet = script_obj_hash_get_native_of_class_name (state->local,
+                                                                              "image",
+                                                                              "image");
+        double columns = script_obj_hash_get_number (state->local, "columns");
+        double rows = script_obj_hash_get_number (state->local, "rows");
+        double frame_rate = script_obj_hash_get_number (state->local, "frame_rate");
+        double count = script_obj_hash_get_number (state->local, "count");
+        sprite_animation_t *animation;
+        int frame_width, frame_height;
+        int frame_count, i;
+
+        if (!sheet || !(columns >= 1) || !(rows >= 1))
+                return script_return_obj_null ();
+
+        frame_width = ply_pixel_buffer_get_width (sheet) / (int) columns;
+        frame_height = ply_pixel_buffer_get_height (sheet) / (int) rows;
+        if (frame_width <= 0 || frame_height <= 0)
+                return script_return_obj_null ();
+
+        frame_count = (int) columns * (int) rows;
+        if (count >= 1 && count < frame_count)
+                frame_count = count;
+
+        animation = sprite_animation_new (frame_count, frame_rate);
+        for (i = 0; i < frame_count; i++) {
+                ply_rectangle_t clip_area = { 0, 0, frame_width, frame_height };
+                int x = (i % (int) columns) * frame_width;
+                int y = (i / (int) columns) * frame_height;
+
+                animation->frames[i] = ply_pixel_buffer_new (frame_width, frame_height);
+                ply_pixel_buffer_fill_with_buffer_with_clip (animation->frames[i], sheet,
+                                                             -x, -y, &clip_area);
+        }
+
+        return script_return_obj (script_obj_new_native (animation, data->animation_class));
+}
+
+static script_return_t sprite_animation_get_frame_count (script_state_t *state,
+                                                         void           *user_data)
+{
+        script_lib_sprite_data_t *data = user_data;
+        sprite_animation_t *animation = script_obj_as_native_of_class (state->this,
+                                                                       data->animation_class);
+
+        if (animation)
+                return script_return_obj (script_obj_new_number (animation->frame_count));
         return script_return_obj_null ();
 }
 
@@ -432,6 +1087,27 @@ static void script_lib_draw_brackground (ply_pixel_buffer_t *pixel_buffer,
         }
 }
 
+/* The rectangles of a region never overlap, so an area is covered when
+ * their overlaps with it add up to all of it */
+static bool region_covers_area (ply_region_t    *region,
+                                ply_rectangle_t *area)
+{
+        ply_list_t *rectangle_list = ply_region_get_rectangle_list (region);
+        ply_list_node_t *node;
+        unsigned long covered = 0;
+
+        for (node = ply_list_get_first_node (rectangle_list);
+             node;
+             node = ply_list_get_next_node (rectangle_list, node)) {
+                ply_rectangle_t overlap;
+
+                ply_rectangle_intersect (ply_list_node_get_data (node), area, &overlap);
+                if (!ply_rectangle_is_empty (&overlap))
+                        covered += overlap.width * overlap.height;
+        }
+        return covered >= area->width * area->height;
+}
+
 static void script_lib_sprite_draw_area (script_lib_display_t *display,
                                          ply_pixel_buffer_t   *pixel_buffer,
                                          int                   x,
@@ -440,8 +1116,10 @@ static void script_lib_sprite_draw_area (script_lib_display_t *display,
                                          int                   height)
 {
         ply_rectangle_t clip_area;
-        ply_list_node_t *node;
         sprite_t *sprite;
+        sprite_t **sprites;
+        int sprite_count, i;
+        int occluder_count = 0;
         script_lib_sprite_data_t *data = display->data;
 
         clip_area.x = x;
@@ -449,49 +1127,61 @@ static void script_lib_sprite_draw_area (script_lib_display_t *display,
         clip_area.width = width;
         clip_area.height = height;
 
-
-        node = ply_list_get_first_node (data->sprite_list);
-        sprite = ply_list_node_get_data (node);
-
-        /* Check If the first sprite should be rendered opaque */
-        if (sprite->image && !sprite->remove_me &&
-            ply_pixel_buffer_is_opaque (sprite->image) && sprite->opacity == 1.0)  {
-                int position_x = sprite->x - display->x;
-                int position_y = sprite->y - display->y;
-
-                /* In that case only draw the background if the sprite doesn't
-                 * cover the complete area */
-                if (position_x > x || position_y > y ||
-                    ((int)ply_pixel_buffer_get_width (sprite->image) + position_x) < (x + width) ||
-                    ((int)ply_pixel_buffer_get_height (sprite->image) + position_y) < (y + height))
-                        script_lib_draw_brackground (pixel_buffer, &clip_area, data);
-        } else {
-                script_lib_draw_brackground (pixel_buffer, &clip_area, data);
-        }
-
-        for (node = ply_list_get_first_node (data->sprite_list);
-             node;
-             node = ply_list_get_next_node (data->sprite_list, node)) {
-                int position_x, position_y;
-
-                sprite = ply_list_node_get_data (node);
+        /* Sprites changed since the last refresh may not be where the grid
+         * has them, so they are always looked at */
+        sprites = sprite_grid_find (data->grid,
+                                    data->dirty_sprites,
+                                    x + display->x,
+                                    y + display->y,
+                                    width,
+                                    height,
+                                    &sprite_count);
+
+        /* Going from the top down, the opaque sprites found so far cover
+         * part of the area, and anything under them that falls entirely
+         * inside that part is left out, background included */
+        for (i = sprite_count - 1; i >= 0; i--) {
+                ply_rectangle_t sprite_area;
+
+                sprite = sprites[i];
+                sprites[i] = NULL;
 
                 if (!sprite->image) continue;
                 if (sprite->remove_me) continue;
                 if (sprite->opacity < 0.011) continue;
 
-                position_x = sprite->x - display->x;
-                position_y = sprite->y - display->y;
+                sprite_area.x = sprite->x - display->x;
+                sprite_area.y = sprite->y - display->y;
+                sprite_area.width = ply_pixel_buffer_get_width (sprite->image);
+                sprite_area.height = ply_pixel_buffer_get_height (sprite->image);
+                ply_rectangle_intersect (&sprite_area, &clip_area, &sprite_area);
+                if (ply_rectangle_is_empty (&sprite_area)) continue;
+
+                if (occluder_count > 0 &&
+                    region_covers_area (data->covered_region, &sprite_area)) continue;
 
-                if (position_x >= (x + width)) continue;
-                if (position_y >= (y + height)) continue;
+                sprites[i] = sprite;
+
+                if (occluder_count < SPRITE_MAX_OCCLUDERS &&
+                    ply_pixel_buffer_is_opaque (sprite->image) && sprite->opacity >= 1.0) {
+                        ply_region_add_rectangle (data->covered_region, &sprite_area);
+                        occluder_count++;
+                }
+        }
+
+        if (occluder_count == 0 ||
+            !region_covers_area (data->covered_region, &clip_area))
+                script_lib_draw_brackground (pixel_buffer, &clip_area, data);
+        ply_region_clear (data->covered_region);
+
+        for (i = 0; i < sprite_count; i++) {
+                sprite = sprites[i];
+                if (!sprite) continue;
 
-                if ((position_x + (int) ply_pixel_buffer_get_width (sprite->image)) <= x) continue;
-                if ((position_y + (int) ply_pixel_buffer_get_height (sprite->image)) <= y) continue;
                 ply_pixel_buffer_fill_with_buffer_at_opacity_with_clip (pixel_buffer,
                                                                         sprite->image,
-                                                                        position_x,
-                                                                        position_y,
+                                                                        sprite->x - display->x,
+                                                                        sprite->y - display->y,
                                                                         &clip_area,
                                                                         sprite->opacity);
         }
@@ -517,17 +1207,31 @@ draw_area (script_lib_sprite_data_t *data,
                                              width,
                                              height);
         }
+
+        if (data->pixel_buffer != NULL) {
+                script_lib_display_t display = { NULL, data, 0, 0 };
+
+                script_lib_sprite_draw_area (&display, data->pixel_buffer,
+                                             x, y, width, height);
+        }
 }
 
-script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
-                                                   ply_list_t     *pixel_displays)
+script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t          *state,
+                                                   ply_list_t              *pixel_displays,
+                                                   script_lib_image_data_t *image_data)
 {
         ply_list_node_t *node;
         unsigned int max_width, max_height;
         script_lib_sprite_data_t *data = malloc (sizeof(script_lib_sprite_data_t));
 
         data->class = script_obj_native_class_new (sprite_free, "sprite", data);
+        data->animation_class = script_obj_native_class_new (sprite_animation_free,
+                                                             "sprite_animation",
+                                                             data);
+        data->image_class = image_data->class;
         data->sprite_list = ply_list_new ();
+        data->dirty_sprites = ply_list_new ();
+        data->animated_sprites = ply_list_new ();
         data->displays = ply_list_new ();
 
         max_width = 0;
@@ -558,6 +1262,11 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
 
                 ply_list_append_data (data->displays, script_display);
         }
+        data->grid = sprite_grid_new (max_width, max_height);
+        data->damaged_region = ply_region_new ();
+        data->covered_region = ply_region_new ();
+        data->pixel_buffer = NULL;
+        data->get_timestamp = ply_get_timestamp;
 
         script_obj_t *sprite_hash = script_obj_hash_get_element (state->global, "Sprite");
         script_add_native_function (sprite_hash,
@@ -620,8 +1329,69 @@ script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
                                     data,
                                     "value",
                                     NULL);
+        script_add_native_function (sprite_hash,
+                                    "SetPosition",
+                                    sprite_set_position,
+                                    data,
+                                    "x",
+                                    "y",
+                                    "z",
+                                    NULL);
+        script_add_native_function (sprite_hash,
+                                    "Set",
+                                    sprite_set,
+                                    data,
+                                    "properties",
+                                    NULL);
+        script_add_native_function (sprite_hash,
+                                    "SetAnimation",
+                                    sprite_set_animation,
+                                    data,
+                                    "animation",
+                                    NULL);
+        script_add_native_function (sprite_hash,
+                                    "_Flatten",
+                                    sprite_flatten,
+                                    data,
+                                    "sprites",
+                                    NULL);
+        script_add_native_function (sprite_hash,
+                                    "SetMany",
+                                    sprite_set_many,
+                                    data,
+                                    "sprites",
+                                    "x",
+                                    "y",
+                                    "z",
+                                    "opacity",
+                                    NULL);
         script_obj_unref (sprite_hash);
 
+        script_obj_t *animation_hash = script_obj_hash_get_element (state->global, "SpriteAnimation");
+        script_add_native_function (animation_hash,
+                                    "_New",
+                                    sprite_animation_new_from_frames,
+                                    data,
+                                    "frames",
+                                    "frame_rate",
+                                    NULL);
+        script_add_native_function (animation_hash,
+                                    "_NewFromSheet",
+                                    sprite_animation_new_from_sheet,
+                                    data,
+                                    "image",
+                                    "columns",
+                                    "rows",
+                                    "frame_rate",
+                                    "count",
+                                    NULL);
+        script_add_native_function (animation_hash,
+                                    "GetFrameCount",
+                                    sprite_animation_get_frame_count,
+                                    data,
+                                    NULL);
+        script_obj_unref (animation_hash);
+
 
         script_obj_t *window_hash = script_obj_hash_get_element (state->global, "Window");
         script_add_native_function (window_hash,
@@ -698,6 +1468,116 @@ sprite_compare_z (void *data_a, void *data_b)
         return sprite_a->z - sprite_b->z;
 }
 
+static int
+sprite_compare_sprite_order (void *data_a, void *data_b)
+{
+        sprite_t *sprite_a = data_a;
+        sprite_t *sprite_b = data_b;
+
+        return sprite_a->order - sprite_b->order;
+}
+
+/* Puts a sprite back in the list where a stable sort by z would have it.
+ * A sprite which moved down goes after others of the same z, one which
+ * moved up goes before them.
+ */
+static void
+sprite_list_insert_sorted (ply_list_t *sprite_list,
+                           sprite_t   *sprite,
+                           bool        moved_up)
+{
+        ply_list_node_t *node;
+        ply_list_node_t *node_before = NULL;
+
+        for (node = ply_list_get_first_node (sprite_list);
+             node;
+             node = ply_list_get_next_node (sprite_list, node)) {
+                sprite_t *other = ply_list_node_get_data (node);
+                if (other->z > sprite->z) break;
+                if (moved_up && other->z == sprite->z) break;
+                node_before = node;
+        }
+        sprite->node = ply_list_insert_data (sprite_list, sprite, node_before);
+        sprite->sorted_z = sprite->z;
+        sprite->is_sorted = true;
+}
+
+/* Rather than sorting every sprite on each refresh, only the dirty sprites
+ * whose z changed are taken out and put back in.  When many have changed
+ * the whole list is sorted instead.
+ */
+static void
+sprite_list_resort (script_lib_sprite_data_t *data)
+{
+        ply_list_node_t *node;
+        ply_list_t *moved_sprites;
+        ply_list_t *moved_up_sprites;
+        bool list_changed = false;
+        int order;
+
+        moved_sprites = ply_list_new ();
+        moved_up_sprites = ply_list_new ();
+        for (node = ply_list_get_first_node (data->dirty_sprites);
+             node;
+             node = ply_list_get_next_node (data->dirty_sprites, node)) {
+                sprite_t *sprite = ply_list_node_get_data (node);
+                if (sprite->remove_me) {
+                        ply_list_remove_node (data->sprite_list, sprite->node);
+                        sprite->node = NULL;
+                        list_changed = true;
+                        continue;
+                }
+                if (sprite->is_sorted && sprite->z == sprite->sorted_z) continue;
+                ply_list_append_data (moved_sprites, sprite);
+        }
+
+        if (ply_list_get_length (moved_sprites) > SPRITE_MAX_MOVED_BEFORE_SORT) {
+                ply_list_sort_stable (data->sprite_list, &sprite_compare_z);
+                list_changed = true;
+        } else if (ply_list_get_length (moved_sprites) > 0) {
+                /* Going down in the old order keeps sprites that move to the
+                 * same z in the order a stable sort would leave them */
+                ply_list_sort_stable (moved_sprites, &sprite_compare_sprite_order);
+                for (node = ply_list_get_first_node (moved_sprites);
+                     node;
+                     node = ply_list_get_next_node (moved_sprites, node)) {
+                        sprite_t *sprite = ply_list_node_get_data (node);
+                        ply_list_remove_node (data->sprite_list, sprite->node);
+                }
+                for (node = ply_list_get_first_node (moved_sprites);
+                     node;
+                     node = ply_list_get_next_node (moved_sprites, node)) {
+                        sprite_t *sprite = ply_list_node_get_data (node);
+                        if (!sprite->is_sorted || sprite->z < sprite->sorted_z)
+                                sprite_list_insert_sorted (data->sprite_list, sprite, false);
+                        else
+                                ply_list_prepend_data (moved_up_sprites, sprite);
+                }
+                for (node = ply_list_get_first_node (moved_up_sprites);
+                     node;
+                     node = ply_list_get_next_node (moved_up_sprites, node)) {
+                        sprite_t *sprite = ply_list_node_get_data (node);
+                        sprite_list_insert_sorted (data->sprite_list, sprite, true);
+                }
+                list_changed = true;
+        }
+        ply_list_free (moved_sprites);
+        ply_list_free (moved_up_sprites);
+
+        if (!list_changed) return;
+
+        order = 0;
+        for (node = ply_list_get_first_node (data->sprite_list);
+             node;
+             node = ply_list_get_next_node (data->sprite_list, node)) {
+                sprite_t *sprite = ply_list_node_get_data (node);
+                sprite->node = node;
+                sprite->order = order++;
+                sprite->sorted_z = sprite->z;
+                sprite->is_sorted = true;
+        }
+}
+
 static void
 region_add_area (ply_region_t *region,
                  long          x,
@@ -705,12 +1585,33 @@ region_add_area (ply_region_t *region,
                  unsigned long width,
                  unsigned long height)
 {
+        ply_list_t *rectangle_list = ply_region_get_rectangle_list (region);
+        ply_list_node_t *node;
         ply_rectangle_t rectangle;
+        long x2, y2;
 
         rectangle.x = x;
         rectangle.y = y;
         rectangle.width = width;
         rectangle.height = height;
+
+        if (ply_list_get_length (rectangle_list) >= SPRITE_MAX_DAMAGED_RECTANGLES) {
+                x2 = x + (long) width;
+                y2 = y + (long) height;
+                for (node = ply_list_get_first_node (rectangle_list);
+                     node;
+                     node = ply_list_get_next_node (rectangle_list, node)) {
+                        ply_rectangle_t *damaged = ply_list_node_get_data (node);
+
+                        rectangle.x = MIN (rectangle.x, damaged->x);
+                        rectangle.y = MIN (rectangle.y, damaged->y);
+                        x2 = MAX (x2, (long) (damaged->x + damaged->width));
+                        y2 = MAX (y2, (long) (damaged->y + damaged->height));
+                }
+                rectangle.width = x2 - rectangle.x;
+                rectangle.height = y2 - rectangle.y;
+                ply_region_clear (region);
+        }
         ply_region_add_rectangle (region, &rectangle);
 }
 
@@ -737,22 +1638,52 @@ void script_lib_sprite_pixel_display_removed (script_lib_sprite_data_t *data, pl
     }
 }
 
+/* Animations run on their own clock, so they keep going however often the
+ * script itself gets to run.  Only the area of the frame is damaged.
+ */
+static void
+sprite_advance_animations (script_lib_sprite_data_t *data)
+{
+        ply_list_node_t *node;
+        double now;
+
+        if (ply_list_get_length (data->animated_sprites) == 0) return;
+
+        now = data->get_timestamp ();
+        for (node = ply_list_get_first_node (data->animated_sprites);
+             node;
+             node = ply_list_get_next_node (data->animated_sprites, node)) {
+                sprite_t *sprite = ply_list_node_get_data (node);
+                sprite_animation_t *animation = script_obj_as_native_of_class (sprite->animation_obj,
+                                                                               data->animation_class);
+                int frame = sprite_animation_get_frame (animation,
+                                                        now - sprite->animation_start_time);
+
+                if (frame == sprite->animation_frame) continue;
+                sprite->animation_frame = frame;
+                sprite->image = animation->frames[frame];
+                sprite->refresh_me = true;
+                sprite_mark_dirty (data, sprite);
+        }
+}
+
+/* Brings the sprites up to date with what the script did, without drawing
+ * anything.  The areas that changed are kept until the next refresh, so
+ * drawing can be skipped when there is no time for it.
+ */
 void
-script_lib_sprite_refresh (script_lib_sprite_data_t *data)
+script_lib_sprite_update (script_lib_sprite_data_t *data)
 {
         ply_list_node_t *node;
         ply_region_t *region;
-        ply_list_t *rectable_list;
 
         if (!data)
             return;
 
-        region = ply_region_new ();
-
-        ply_list_sort_stable (data->sprite_list, &sprite_compare_z);
-
-        node = ply_list_get_first_node (data->sprite_list);
+        region = data->damaged_region;
 
+        sprite_advance_animations (data);
+        sprite_list_resort (data);
 
         if (data->full_refresh) {
                 for (node = ply_list_get_first_node (data->displays);
@@ -765,14 +1696,27 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
                                          ply_pixel_display_get_width (display->pixel_display),
                                          ply_pixel_display_get_height (display->pixel_display));
                 }
+                if (data->pixel_buffer != NULL)
+                        region_add_area (region,
+                                         0,
+                                         0,
+                                         ply_pixel_buffer_get_width (data->pixel_buffer),
+                                         ply_pixel_buffer_get_height (data->pixel_buffer));
 
                 data->full_refresh = false;
         }
 
+        /* Sprites which were not touched since the last refresh cannot
+         * have changed */
+        node = ply_list_get_first_node (data->dirty_sprites);
         while (node) {
                 sprite_t *sprite = ply_list_node_get_data (node);
-                ply_list_node_t *next_node = ply_list_get_next_node (data->sprite_list,
+                ply_list_node_t *next_node = ply_list_get_next_node (data->dirty_sprites,
                                                                      node);
+                ply_list_remove_node (data->dirty_sprites, node);
+                sprite->is_dirty = false;
+                node = next_node;
+
                 if (sprite->remove_me) {
                         if (sprite->image) {
                                 region_add_area (region,
@@ -781,17 +1725,13 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
                                                  sprite->old_width,
                                                  sprite->old_height);
                         }
-                        ply_list_remove_node (data->sprite_list, node);
+                        sprite_grid_remove (data->grid, sprite);
+                        sprite_stop_animation (data, sprite);
                         script_obj_unref (sprite->image_obj);
                         free (sprite);
+                        continue;
                 }
-                node = next_node;
-        }
 
-        for (node = ply_list_get_first_node (data->sprite_list);
-             node;
-             node = ply_list_get_next_node (data->sprite_list, node)) {
-                sprite_t *sprite = ply_list_node_get_data (node);
                 if (!sprite->image) continue;
                 if ((sprite->x != sprite->old_x)
                     || (sprite->y != sprite->old_y)
@@ -818,10 +1758,38 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
                         sprite->old_height = size.height;
                         sprite->old_opacity = sprite->opacity;
                         sprite->refresh_me = false;
+                        sprite_grid_update (data->grid, sprite);
                 }
         }
+}
+
+/* For running scripts without any displays, before any sprites are made.
+ * The buffer stands for a display at the origin.
+ */
+void
+script_lib_sprite_set_pixel_buffer (script_lib_sprite_data_t *data,
+                                    ply_pixel_buffer_t       *pixel_buffer)
+{
+        assert (ply_list_get_length (data->sprite_list) == 0);
+
+        data->pixel_buffer = pixel_buffer;
+        sprite_grid_free (data->grid);
+        data->grid = sprite_grid_new (ply_pixel_buffer_get_width (pixel_buffer),
+                                      ply_pixel_buffer_get_height (pixel_buffer));
+}
+
+void
+script_lib_sprite_refresh (script_lib_sprite_data_t *data)
+{
+        ply_list_node_t *node;
+        ply_list_t *rectable_list;
+
+        if (!data)
+            return;
+
+        script_lib_sprite_update (data);
 
-        rectable_list = ply_region_get_rectangle_list (region);
+        rectable_list = ply_region_get_rectangle_list (data->damaged_region);
 
         for (node = ply_list_get_first_node (rectable_list);
              node;
@@ -834,7 +1802,7 @@ script_lib_sprite_refresh (script_lib_sprite_data_t *data)
                            rectangle->height);
         }
 
-        ply_region_free (region);
+        ply_region_clear (data->damaged_region);
 }
 
 void script_lib_sprite_destroy (script_lib_sprite_data_t *data)
@@ -856,13 +1824,20 @@ void script_lib_sprite_destroy (script_lib_sprite_data_t *data)
                                                                      node);
                 ply_list_remove_node (data->sprite_list, node);
                 script_obj_unref (sprite->image_obj);
+                script_obj_unref (sprite->animation_obj);
                 free (sprite);
                 node = next_node;
         }
 
         ply_list_free (data->sprite_list);
+        ply_list_free (data->dirty_sprites);
+        ply_list_free (data->animated_sprites);
+        sprite_grid_free (data->grid);
+        ply_region_free (data->damaged_region);
+        ply_region_free (data->covered_region);
         script_parse_op_free (data->script_main_op);
         script_obj_native_class_destroy (data->class);
+        script_obj_native_class_destroy (data->animation_class);
         free (data);
         data = NULL;
 }
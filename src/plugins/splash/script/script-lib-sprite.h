@@ -25,12 +25,25 @@
 #include "script.h"
 #include "ply-pixel-buffer.h"
 #include "ply-pixel-display.h"
+#include "ply-region.h"
+#include "script-lib-image.h"
+
+typedef struct script_lib_sprite_grid_t script_lib_sprite_grid_t;
 
 typedef struct
 {
         ply_list_t                *displays;
-        ply_list_t                *sprite_list;
+        ply_list_t                *sprite_list;         /* kept in z order */
+        ply_list_t                *dirty_sprites;
+        ply_list_t                *animated_sprites;
+        script_lib_sprite_grid_t  *grid;
+        ply_region_t              *damaged_region;      /* not yet drawn */
+        ply_region_t              *covered_region;      /* used while drawing */
+        ply_pixel_buffer_t        *pixel_buffer;        /* drawn into as well as the displays */
+        double                    (*get_timestamp)(void); /* clock for animations */
         script_obj_native_class_t *class;
+        script_obj_native_class_t *animation_class;
+        script_obj_native_class_t *image_class;
         script_op_t               *script_main_op;
         uint32_t                   background_color_start;
         uint32_t                   background_color_end;
@@ -59,13 +72,32 @@ typedef struct
         double              old_opacity;
         bool                refresh_me;
         bool                remove_me;
+        bool                is_dirty;           /* in dirty_sprites */
+        bool                is_sorted;          /* placed in sprite_list by sorted_z */
+        int                 sorted_z;
+        int                 order;              /* index in sprite_list */
+        ply_list_node_t    *node;
+        bool                is_in_grid;         /* in cells from cell_x1,y1 to x2,y2 */
+        int                 cell_x1;
+        int                 cell_y1;
+        int                 cell_x2;
+        int                 cell_y2;
+        unsigned int        query_stamp;
         ply_pixel_buffer_t *image;
         script_obj_t       *image_obj;
+        script_obj_t       *animation_obj;      /* SpriteAnimation being shown */
+        ply_list_node_t    *animation_node;     /* in animated_sprites */
+        double              animation_start_time;
+        int                 animation_frame;
 } sprite_t;
 
-script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t *state,
-                                                   ply_list_t     *displays);
+script_lib_sprite_data_t *script_lib_sprite_setup (script_state_t          *state,
+                                                   ply_list_t              *displays,
+                                                   script_lib_image_data_t *image_data);
 void script_lib_sprite_pixel_display_removed (script_lib_sprite_data_t *data, ply_pixel_display_t *pixel_display);
+void script_lib_sprite_set_pixel_buffer (script_lib_sprite_data_t *data,
+                                         ply_pixel_buffer_t       *pixel_buffer);
+void script_lib_sprite_update (script_lib_sprite_data_t *data);
 void script_lib_sprite_refresh (script_lib_sprite_data_t *data);
 void script_lib_sprite_destroy (script_lib_sprite_data_t *data);
 
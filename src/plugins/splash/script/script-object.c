@@ -27,6 +27,7 @@
 #include "ply-hashtable.h"
 #include "ply-list.h"
 #include "ply-bitarray.h"
+#include "ply-utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -38,15 +39,145 @@
 #include <values.h>
 
 #include "script.h"
+#include "script-atom.h"
 #include "script-object.h"
 
 void script_obj_reset (script_obj_t *obj);
 
+/* Small hashes keep their elements in a plain array, with the keys held
+ * in a shape shared by every hash which gained the same keys in the same
+ * order.  Adding a key moves the hash on to a child shape.  Past
+ * SCRIPT_OBJ_HASH_INLINE_SIZE keys the elements move into a hashtable.
+ * Shapes live for as long as the plugin, so their number is capped.
+ */
+#define SCRIPT_OBJ_HASH_INLINE_SIZE 8
+#define SCRIPT_OBJ_SHAPE_MAX 4096
+
+typedef struct script_obj_shape_t
+{
+        struct script_obj_shape_t *children;
+        struct script_obj_shape_t *next_sibling;
+        int                        count;
+        const char                *atoms[SCRIPT_OBJ_HASH_INLINE_SIZE];
+} script_obj_shape_t;
+
+static script_obj_shape_t script_obj_shape_root;
+static int script_obj_shape_count = 0;
+
+/* Objects are carved out of slabs and recycled through a free list, as
+ * scripts create and drop numbers at a high rate.  Slabs are never handed
+ * back to the system.
+ */
+#define SCRIPT_OBJ_SLAB_SIZE 256
+
+static script_obj_t *script_obj_free_list = NULL;
+static unsigned long script_obj_allocations = 0;
+static unsigned long script_obj_live = 0;
+static unsigned long script_obj_live_high_water_mark = 0;
+
+/* Reference counting alone never frees objects that refer to each other,
+ * like a hash holding itself in a field.  Containers which lose a
+ * reference but stay alive are kept as possible roots of such cycles, and
+ * script_obj_collect_cycles later looks for groups of them only referenced
+ * from inside the group.  This is the trial deletion of Bacon and Rajan.
+ * Objects freed while kept as roots are only handed back to the free list
+ * once the collector has dropped them.
+ */
+typedef enum
+{
+        SCRIPT_OBJ_COLOR_BLACK,         /* in use, or not looked at */
+        SCRIPT_OBJ_COLOR_GRAY,          /* references from the group taken off */
+        SCRIPT_OBJ_COLOR_WHITE,         /* only referenced from the group */
+} script_obj_color_t;
+
+/* Roots looked at together, between checks of the time budget */
+#define SCRIPT_OBJ_CYCLE_ROOT_BATCH 64
+
+typedef struct
+{
+        script_obj_t **objs;
+        int            count;
+        int            capacity;
+} script_obj_stack_t;
+
+static script_obj_stack_t script_obj_cycle_roots;
+
+static script_obj_t *script_obj_alloc (void)
+{
+        script_obj_t *obj;
+
+        if (!script_obj_free_list) {
+                script_obj_t *slab = malloc (SCRIPT_OBJ_SLAB_SIZE * sizeof(script_obj_t));
+                int index;
+
+                for (index = 0; index < SCRIPT_OBJ_SLAB_SIZE; index++) {
+                        slab[index].data.obj = script_obj_free_list;
+                        script_obj_free_list = &slab[index];
+                }
+        }
+        obj = script_obj_free_list;
+        script_obj_free_list = obj->data.obj;
+        obj->color = SCRIPT_OBJ_COLOR_BLACK;
+        obj->is_buffered = false;
+        script_obj_allocations++;
+        script_obj_live++;
+        if (script_obj_live > script_obj_live_high_water_mark)
+                script_obj_live_high_water_mark = script_obj_live;
+        return obj;
+}
+
+static void script_obj_release (script_obj_t *obj)
+{
+        obj->data.obj = script_obj_free_list;
+        script_obj_free_list = obj;
+}
+
+static void script_obj_stack_push (script_obj_stack_t *stack,
+                                   script_obj_t       *obj)
+{
+        if (stack->count == stack->capacity) {
+                stack->capacity = stack->capacity ? stack->capacity * 2 : 64;
+                stack->objs = realloc (stack->objs, stack->capacity * sizeof(script_obj_t *));
+        }
+        stack->objs[stack->count++] = obj;
+}
+
+void script_obj_get_allocation_stats (unsigned long *allocations,
+                                      unsigned long *live)
+{
+        if (allocations) *allocations = script_obj_allocations;
+        if (live) *live = script_obj_live;
+}
+
+unsigned long script_obj_get_live_high_water_mark (void)
+{
+        return script_obj_live_high_water_mark;
+}
+
+/* Most roots are the hashes of function calls, which are freed soon after
+ * they are added, so the last few added are looked through first */
+#define SCRIPT_OBJ_CYCLE_ROOT_RECENT 4
+
 void script_obj_free (script_obj_t *obj)
 {
         assert (!obj->refcount);
         script_obj_reset (obj);
-        free (obj);
+        script_obj_live--;
+        if (obj->is_buffered) {
+                script_obj_stack_t *roots = &script_obj_cycle_roots;
+                int index;
+
+                for (index = roots->count - 1;
+                     index >= 0 && index >= roots->count - SCRIPT_OBJ_CYCLE_ROOT_RECENT;
+                     index--) {
+                        if (roots->objs[index] != obj) continue;
+                        roots->objs[index] = roots->objs[--roots->count];
+                        obj->is_buffered = false;
+                        break;
+                }
+        }
+        if (!obj->is_buffered)
+                script_obj_release (obj);
 }
 
 void script_obj_ref (script_obj_t *obj)
@@ -59,8 +190,222 @@ void script_obj_unref (script_obj_t *obj)
         if (!obj) return;
         assert (obj->refcount > 0);
         obj->refcount--;
-        if (obj->refcount <= 0)
+        if (obj->refcount <= 0) {
                 script_obj_free (obj);
+        } else if (!obj->is_buffered &&
+                   (obj->type == SCRIPT_OBJ_TYPE_HASH ||
+                    obj->type == SCRIPT_OBJ_TYPE_REF ||
+                    obj->type == SCRIPT_OBJ_TYPE_EXTEND)) {
+                obj->is_buffered = true;
+                script_obj_stack_push (&script_obj_cycle_roots, obj);
+        }
+}
+
+static void foreach_push_variable (void *key,
+                                   void *data,
+                                   void *user_data)
+{
+        script_variable_t *variable = data;
+
+        script_obj_stack_push (user_data, variable->object);
+}
+
+/* Pushes every object obj holds a reference to */
+static void script_obj_push_children (script_obj_t       *obj,
+                                      script_obj_stack_t *stack)
+{
+        int index;
+
+        switch (obj->type) {
+        case SCRIPT_OBJ_TYPE_REF:
+                script_obj_stack_push (stack, obj->data.obj);
+                break;
+        case SCRIPT_OBJ_TYPE_EXTEND:
+                script_obj_stack_push (stack, obj->data.dual_obj.obj_a);
+                script_obj_stack_push (stack, obj->data.dual_obj.obj_b);
+                break;
+        case SCRIPT_OBJ_TYPE_HASH:
+                if (obj->data.hash.shape) {
+                        for (index = 0; index < obj->data.hash.shape->count; index++)
+                                script_obj_stack_push (stack, obj->data.hash.storage.values[index]);
+                } else {
+                        ply_hashtable_foreach (obj->data.hash.storage.table,
+                                               foreach_push_variable,
+                                               stack);
+                }
+                break;
+        case SCRIPT_OBJ_TYPE_NULL:
+        case SCRIPT_OBJ_TYPE_NUMBER:
+        case SCRIPT_OBJ_TYPE_STRING:
+        case SCRIPT_OBJ_TYPE_FUNCTION:
+        case SCRIPT_OBJ_TYPE_NATIVE:
+                break;          /* natives keep their references to themselves */
+        }
+}
+
+/* Takes off the references held by everything reachable from root */
+static void script_obj_mark_gray (script_obj_t       *root,
+                                  script_obj_stack_t *stack,
+                                  script_obj_stack_t *children)
+{
+        if (root->color == SCRIPT_OBJ_COLOR_GRAY) return;
+        root->color = SCRIPT_OBJ_COLOR_GRAY;
+        script_obj_stack_push (stack, root);
+
+        while (stack->count > 0) {
+                script_obj_t *obj = stack->objs[--stack->count];
+
+                script_obj_push_children (obj, children);
+                while (children->count > 0) {
+                        script_obj_t *child = children->objs[--children->count];
+                        child->refcount--;
+                        if (child->color != SCRIPT_OBJ_COLOR_GRAY) {
+                                child->color = SCRIPT_OBJ_COLOR_GRAY;
+                                script_obj_stack_push (stack, child);
+                        }
+                }
+        }
+}
+
+/* Puts back the references held by everything reachable from root, which
+ * is referenced from outside the group */
+static void script_obj_scan_black (script_obj_t       *root,
+                                   script_obj_stack_t *stack,
+                                   script_obj_stack_t *children)
+{
+        root->color = SCRIPT_OBJ_COLOR_BLACK;
+        script_obj_stack_push (stack, root);
+
+        while (stack->count > 0) {
+                script_obj_t *obj = stack->objs[--stack->count];
+
+                script_obj_push_children (obj, children);
+                while (children->count > 0) {
+                        script_obj_t *child = children->objs[--children->count];
+                        child->refcount++;
+                        if (child->color != SCRIPT_OBJ_COLOR_BLACK) {
+                                child->color = SCRIPT_OBJ_COLOR_BLACK;
+                                script_obj_stack_push (stack, child);
+                        }
+                }
+        }
+}
+
+static void script_obj_scan (script_obj_t       *root,
+                             script_obj_stack_t *stack,
+                             script_obj_stack_t *black_stack,
+                             script_obj_stack_t *children)
+{
+        script_obj_stack_push (stack, root);
+
+        while (stack->count > 0) {
+                script_obj_t *obj = stack->objs[--stack->count];
+
+                if (obj->color != SCRIPT_OBJ_COLOR_GRAY) continue;
+                if (obj->refcount > 0) {
+                        script_obj_scan_black (obj, black_stack, children);
+                } else {
+                        obj->color = SCRIPT_OBJ_COLOR_WHITE;
+                        script_obj_push_children (obj, stack);
+                }
+        }
+}
+
+/* Gathers the white objects reachable from root as garbage.  Those still
+ * on the list of roots are kept apart, as they can only be handed back
+ * once the list drops them.  Every one is marked as buffered so that
+ * nothing adds it to the list while it is being freed.
+ */
+static void script_obj_collect_white (script_obj_t       *root,
+                                      script_obj_stack_t *stack,
+                                      script_obj_stack_t *garbage,
+                                      script_obj_stack_t *buffered_garbage)
+{
+        script_obj_stack_push (stack, root);
+
+        while (stack->count > 0) {
+                script_obj_t *obj = stack->objs[--stack->count];
+
+                if (obj->color != SCRIPT_OBJ_COLOR_WHITE) continue;
+                obj->color = SCRIPT_OBJ_COLOR_BLACK;
+                script_obj_stack_push (obj->is_buffered ? buffered_garbage : garbage, obj);
+                obj->is_buffered = true;
+                script_obj_push_children (obj, stack);
+        }
+}
+
+/* Looks at the possible roots of cycles a batch at a time until none are
+ * left or time_budget seconds have gone, and frees the objects found to
+ * only be referenced from each other.  Returns how many were freed.
+ */
+unsigned long script_obj_collect_cycles (double time_budget)
+{
+        script_obj_stack_t stack = { NULL, 0, 0 };
+        script_obj_stack_t black_stack = { NULL, 0, 0 };
+        script_obj_stack_t children = { NULL, 0, 0 };
+        script_obj_stack_t garbage = { NULL, 0, 0 };
+        script_obj_stack_t buffered_garbage = { NULL, 0, 0 };
+        script_obj_t *roots[SCRIPT_OBJ_CYCLE_ROOT_BATCH];
+        double start_time = ply_get_timestamp ();
+        unsigned long collected = 0;
+        int root_count, index;
+
+        while (script_obj_cycle_roots.count > 0) {
+                root_count = 0;
+                while (root_count < SCRIPT_OBJ_CYCLE_ROOT_BATCH &&
+                       script_obj_cycle_roots.count > 0) {
+                        script_obj_t *obj = script_obj_cycle_roots.objs[--script_obj_cycle_roots.count];
+
+                        obj->is_buffered = false;
+                        if (obj->refcount == 0)
+                                script_obj_release (obj);
+                        else
+                                roots[root_count++] = obj;
+                }
+
+                for (index = 0; index < root_count; index++)
+                        script_obj_mark_gray (roots[index], &stack, &children);
+                for (index = 0; index < root_count; index++)
+                        script_obj_scan (roots[index], &stack, &black_stack, &children);
+                for (index = 0; index < root_count; index++)
+                        script_obj_collect_white (roots[index], &stack, &garbage, &buffered_garbage);
+
+                /* The garbage gets back the references it holds, and one
+                 * more to keep it around while the rest is reset */
+                for (index = 0; index < garbage.count + buffered_garbage.count; index++) {
+                        script_obj_t *obj = index < garbage.count ?
+                                            garbage.objs[index] :
+                                            buffered_garbage.objs[index - garbage.count];
+                        script_obj_push_children (obj, &children);
+                        while (children.count > 0)
+                                children.objs[--children.count]->refcount++;
+                        obj->refcount++;
+                }
+                for (index = 0; index < garbage.count; index++)
+                        script_obj_reset (garbage.objs[index]);
+                for (index = 0; index < buffered_garbage.count; index++)
+                        script_obj_reset (buffered_garbage.objs[index]);
+                for (index = 0; index < garbage.count; index++) {
+                        garbage.objs[index]->is_buffered = false;
+                        script_obj_unref (garbage.objs[index]);
+                }
+                for (index = 0; index < buffered_garbage.count; index++)
+                        script_obj_unref (buffered_garbage.objs[index]);
+
+                collected += garbage.count + buffered_garbage.count;
+                garbage.count = 0;
+                buffered_garbage.count = 0;
+
+                if (ply_get_timestamp () - start_time > time_budget)
+                        break;
+        }
+
+        free (stack.objs);
+        free (black_stack.objs);
+        free (children.objs);
+        free (garbage.objs);
+        free (buffered_garbage.objs);
+        return collected;
 }
 
 static void foreach_free_variable (void *key,
@@ -70,7 +415,7 @@ static void foreach_free_variable (void *key,
         script_variable_t *variable = data;
 
         script_obj_unref (variable->object);
-        free (variable->name);
+        script_atom_unref (variable->name);
         free (variable);
 }
 
@@ -94,8 +439,15 @@ void script_obj_reset (script_obj_t *obj)
                 break;
 
         case SCRIPT_OBJ_TYPE_HASH:              /* FIXME nightmare */
-                ply_hashtable_foreach (obj->data.hash, foreach_free_variable, NULL);
-                ply_hashtable_free (obj->data.hash);
+                if (obj->data.hash.shape) {
+                        int index;
+                        for (index = 0; index < obj->data.hash.shape->count; index++)
+                                script_obj_unref (obj->data.hash.storage.values[index]);
+                        free (obj->data.hash.storage.values);
+                } else {
+                        ply_hashtable_foreach (obj->data.hash.storage.table, foreach_free_variable, NULL);
+                        ply_hashtable_free (obj->data.hash.storage.table);
+                }
                 break;
 
         case SCRIPT_OBJ_TYPE_FUNCTION:
@@ -109,9 +461,10 @@ void script_obj_reset (script_obj_t *obj)
                                      ply_list_get_next_node (obj->data.function->parameters,
                                                              node)) {
                                 char *operand = ply_list_node_get_data (node);
-                                free (operand);
+                                script_atom_unref (operand);
                         }
                         ply_list_free (obj->data.function->parameters);
+                        script_atom_unref (obj->data.function->name);
                         free (obj->data.function);
                 }
         }
@@ -148,7 +501,7 @@ void script_obj_deref (script_obj_t **obj_ptr)
 
 script_obj_t *script_obj_new_null (void)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj->type = SCRIPT_OBJ_TYPE_NULL;
         obj->refcount = 1;
@@ -157,7 +510,7 @@ script_obj_t *script_obj_new_null (void)
 
 script_obj_t *script_obj_new_number (script_number_t number)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj->type = SCRIPT_OBJ_TYPE_NUMBER;
         obj->refcount = 1;
@@ -168,7 +521,7 @@ script_obj_t *script_obj_new_number (script_number_t number)
 script_obj_t *script_obj_new_string (const char *string)
 {
         if (!string) return script_obj_new_null ();
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
         obj->type = SCRIPT_OBJ_TYPE_STRING;
         obj->refcount = 1;
         obj->data.string = strdup (string);
@@ -177,18 +530,18 @@ script_obj_t *script_obj_new_string (const char *string)
 
 script_obj_t *script_obj_new_hash (void)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj->type = SCRIPT_OBJ_TYPE_HASH;
-        obj->data.hash = ply_hashtable_new (ply_hashtable_string_hash,
-                                            ply_hashtable_string_compare);
+        obj->data.hash.shape = &script_obj_shape_root;
+        obj->data.hash.storage.values = NULL;
         obj->refcount = 1;
         return obj;
 }
 
 script_obj_t *script_obj_new_function (script_function_t *function)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj->type = SCRIPT_OBJ_TYPE_FUNCTION;
         obj->data.function = function;
@@ -198,7 +551,7 @@ script_obj_t *script_obj_new_function (script_function_t *function)
 
 script_obj_t *script_obj_new_ref (script_obj_t *sub_obj)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         sub_obj = script_obj_deref_direct (sub_obj);
         script_obj_ref (sub_obj);
@@ -210,7 +563,7 @@ script_obj_t *script_obj_new_ref (script_obj_t *sub_obj)
 
 script_obj_t *script_obj_new_extend (script_obj_t *obj_a, script_obj_t *obj_b)
 {
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
 
         obj_a = script_obj_deref_direct (obj_a);
         obj_b = script_obj_deref_direct (obj_b);
@@ -227,7 +580,7 @@ script_obj_t *script_obj_new_native (void                      *object_data,
                                      script_obj_native_class_t *class)
 {
         if (!object_data) return script_obj_new_null ();
-        script_obj_t *obj = malloc (sizeof(script_obj_t));
+        script_obj_t *obj = script_obj_alloc ();
         obj->type = SCRIPT_OBJ_TYPE_NATIVE;
         obj->data.native.class = class;
         obj->data.native.object_data = object_data;
@@ -406,36 +759,125 @@ void script_obj_assign (script_obj_t *obj_a,
         obj_a->data.obj = obj_b;
 }
 
+/* Same as assigning a new number object, but reuses the number obj refers
+ * to when nothing else can see it.
+ */
+void script_obj_assign_number (script_obj_t   *obj,
+                               script_number_t number)
+{
+        script_obj_t *number_obj;
+
+        if (obj->type == SCRIPT_OBJ_TYPE_REF &&
+            obj->data.obj->type == SCRIPT_OBJ_TYPE_NUMBER &&
+            obj->data.obj->refcount == 1) {
+                obj->data.obj->data.number = number;
+                return;
+        }
+        number_obj = script_obj_new_number (number);
+        script_obj_assign (obj, number_obj);
+        script_obj_unref (number_obj);
+}
+
+static int script_obj_shape_find (const script_obj_shape_t *shape,
+                                  const char               *atom)
+{
+        int index;
+
+        for (index = 0; index < shape->count; index++) {
+                if (shape->atoms[index] == atom)
+                        return index;
+        }
+        return -1;
+}
+
+static script_obj_shape_t *script_obj_shape_add (script_obj_shape_t *shape,
+                                                 const char         *atom)
+{
+        script_obj_shape_t *child;
+
+        for (child = shape->children; child; child = child->next_sibling) {
+                if (child->atoms[shape->count] == atom)
+                        return child;
+        }
+        if (shape->count == SCRIPT_OBJ_HASH_INLINE_SIZE ||
+            script_obj_shape_count == SCRIPT_OBJ_SHAPE_MAX)
+                return NULL;
+
+        child = calloc (1, sizeof(script_obj_shape_t));
+        memcpy (child->atoms, shape->atoms, shape->count * sizeof(const char *));
+        child->atoms[shape->count] = script_atom_ref (atom);
+        child->count = shape->count + 1;
+        child->next_sibling = shape->children;
+        shape->children = child;
+        script_obj_shape_count++;
+        return child;
+}
+
+static void script_obj_hash_move_to_table (script_obj_t *hash)
+{
+        script_obj_shape_t *shape = hash->data.hash.shape;
+        script_obj_t **values = hash->data.hash.storage.values;
+        ply_hashtable_t *table = ply_hashtable_new (script_atom_hash, NULL);   /* keyed by atom */
+        int index;
+
+        for (index = 0; index < shape->count; index++) {
+                script_variable_t *variable = malloc (sizeof(script_variable_t));
+                variable->name = script_atom_ref (shape->atoms[index]);
+                variable->object = values[index];
+                ply_hashtable_insert (table, (void *) variable->name, variable);
+        }
+        free (values);
+        hash->data.hash.shape = NULL;
+        hash->data.hash.storage.table = table;
+}
+
 static void *script_obj_direct_as_hash_element (script_obj_t *obj,
                                                 void         *user_data)
 {
-        const char *name = user_data;
+        const char *atom = user_data;
 
         if (obj->type == SCRIPT_OBJ_TYPE_HASH) {
-                script_variable_t *variable = ply_hashtable_lookup (obj->data.hash, (void *) name);
-                if (variable)
-                        return variable->object;
+                if (obj->data.hash.shape) {
+                        int index = script_obj_shape_find (obj->data.hash.shape, atom);
+                        if (index >= 0)
+                                return obj->data.hash.storage.values[index];
+                } else {
+                        script_variable_t *variable = ply_hashtable_lookup (obj->data.hash.storage.table,
+                                                                            (void *) atom);
+                        if (variable)
+                                return variable->object;
+                }
         }
         return NULL;
 }
 
-script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
-                                            const char   *name)
+script_obj_t *script_obj_hash_peek_element_atom (script_obj_t *hash,
+                                                 const char   *atom)
 {
         script_obj_t *object;
 
-        if (!name) return script_obj_new_null ();
         object = script_obj_as_custom (hash,
                                        script_obj_direct_as_hash_element,
-                                       (void *) name);
+                                       (void *) atom);
         if (object) script_obj_ref (object);
         return object;
 }
 
-script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
-                                           const char   *name)
+script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
+                                            const char   *name)
+{
+        const char *atom;
+
+        if (!name) return script_obj_new_null ();
+        atom = script_atom_lookup (name);
+        if (!atom) return NULL;       /* Never seen, so no hash can hold it */
+        return script_obj_hash_peek_element_atom (hash, atom);
+}
+
+script_obj_t *script_obj_hash_get_element_atom (script_obj_t *hash,
+                                                const char   *atom)
 {
-        script_obj_t *obj = script_obj_hash_peek_element (hash, name);
+        script_obj_t *obj = script_obj_hash_peek_element_atom (hash, atom);
 
         if (obj) return obj;
         script_obj_t *realhash = script_obj_as_obj_type (hash, SCRIPT_OBJ_TYPE_HASH);
@@ -443,12 +885,96 @@ script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
                 realhash = script_obj_new_hash (); /* If it wasn't a hash then make it into one */
                 script_obj_assign (hash, realhash);
         }
+        obj = script_obj_new_null ();
+        script_obj_ref (obj);
+        if (realhash->data.hash.shape) {
+                script_obj_shape_t *shape = realhash->data.hash.shape;
+                script_obj_shape_t *new_shape = script_obj_shape_add (shape, atom);
+
+                if (new_shape) {
+                        int count = shape->count;
+                        if (count == 0 || (count >= 2 && !(count & (count - 1))))
+                                realhash->data.hash.storage.values = realloc (realhash->data.hash.storage.values,
+                                                                              (count ? count * 2 : 2) * sizeof(script_obj_t *));
+                        realhash->data.hash.storage.values[count] = obj;
+                        realhash->data.hash.shape = new_shape;
+                        return obj;
+                }
+                script_obj_hash_move_to_table (realhash);
+        }
         script_variable_t *variable = malloc (sizeof(script_variable_t));
-        variable->name = strdup (name);
-        variable->object = script_obj_new_null ();
-        ply_hashtable_insert (realhash->data.hash, variable->name, variable);
-        script_obj_ref (variable->object);
-        return variable->object;
+        variable->name = script_atom_ref (atom);
+        variable->object = obj;
+        ply_hashtable_insert (realhash->data.hash.storage.table, (void *) variable->name, variable);
+        return obj;
+}
+
+/* A hit needs "hash" itself (after references) to be the hash holding the
+ * element, which is also where the uncached lookup looks first.
+ */
+static script_obj_t *script_obj_hash_cache_lookup (script_obj_t            *hash,
+                                                   script_obj_hash_cache_t *cache)
+{
+        hash = script_obj_deref_direct (hash);
+        if (hash->type == SCRIPT_OBJ_TYPE_HASH &&
+            hash->data.hash.shape &&
+            hash->data.hash.shape == cache->shape)
+                return hash->data.hash.storage.values[cache->index];
+        return NULL;
+}
+
+static void script_obj_hash_cache_update (script_obj_t            *hash,
+                                          const char              *atom,
+                                          script_obj_hash_cache_t *cache)
+{
+        hash = script_obj_deref_direct (hash);
+        if (hash->type != SCRIPT_OBJ_TYPE_HASH || !hash->data.hash.shape)
+                return;
+        int index = script_obj_shape_find (hash->data.hash.shape, atom);
+        if (index < 0)
+                return;
+        cache->shape = hash->data.hash.shape;
+        cache->index = index;
+}
+
+script_obj_t *script_obj_hash_peek_element_cached (script_obj_t            *hash,
+                                                   const char              *atom,
+                                                   script_obj_hash_cache_t *cache)
+{
+        script_obj_t *obj = script_obj_hash_cache_lookup (hash, cache);
+
+        if (obj) {
+                script_obj_ref (obj);
+                return obj;
+        }
+        obj = script_obj_hash_peek_element_atom (hash, atom);
+        if (obj) script_obj_hash_cache_update (hash, atom, cache);
+        return obj;
+}
+
+script_obj_t *script_obj_hash_get_element_cached (script_obj_t            *hash,
+                                                  const char              *atom,
+                                                  script_obj_hash_cache_t *cache)
+{
+        script_obj_t *obj = script_obj_hash_cache_lookup (hash, cache);
+
+        if (obj) {
+                script_obj_ref (obj);
+                return obj;
+        }
+        obj = script_obj_hash_get_element_atom (hash, atom);
+        script_obj_hash_cache_update (hash, atom, cache);
+        return obj;
+}
+
+script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
+                                           const char   *name)
+{
+        const char *atom = script_atom_get (name);
+        script_obj_t *obj = script_obj_hash_get_element_atom (hash, atom);
+
+        script_atom_unref (atom);
+        return obj;
 }
 
 script_number_t script_obj_hash_get_number (script_obj_t *hash,
@@ -503,6 +1029,44 @@ void *script_obj_hash_get_native_of_class_name (script_obj_t *hash,
         return reply;
 }
 
+typedef struct
+{
+        script_obj_hash_foreach_func_t func;
+        void                          *user_data;
+} script_obj_hash_foreach_closure_t;
+
+static void foreach_hash_variable (void *key,
+                                   void *data,
+                                   void *user_data)
+{
+        script_variable_t *variable = data;
+        script_obj_hash_foreach_closure_t *closure = user_data;
+
+        closure->func (variable->name, variable->object, closure->user_data);
+}
+
+/* Calls func with the name and value of every element, in no set order */
+void script_obj_hash_foreach (script_obj_t                  *hash,
+                              script_obj_hash_foreach_func_t func,
+                              void                          *user_data)
+{
+        script_obj_hash_foreach_closure_t closure = { func, user_data };
+        int index;
+
+        hash = script_obj_as_obj_type (hash, SCRIPT_OBJ_TYPE_HASH);
+        if (!hash) return;
+        if (hash->data.hash.shape) {
+                for (index = 0; index < hash->data.hash.shape->count; index++)
+                        func (hash->data.hash.shape->atoms[index],
+                              hash->data.hash.storage.values[index],
+                              user_data);
+        } else {
+                ply_hashtable_foreach (hash->data.hash.storage.table,
+                                       foreach_hash_variable,
+                                       &closure);
+        }
+}
+
 void script_obj_hash_add_element (script_obj_t *hash,
                                   script_obj_t *element,
                                   const char   *name)
@@ -513,6 +1077,16 @@ void script_obj_hash_add_element (script_obj_t *hash,
         script_obj_unref (obj);
 }
 
+void script_obj_hash_add_element_atom (script_obj_t *hash,
+                                       script_obj_t *element,
+                                       const char   *atom)
+{
+        script_obj_t *obj = script_obj_hash_get_element_atom (hash, atom);
+
+        script_obj_assign (obj, element);
+        script_obj_unref (obj);
+}
+
 script_obj_t *script_obj_plus (script_obj_t *script_obj_a,
                                script_obj_t *script_obj_b)
 {
@@ -37,8 +37,26 @@ typedef enum
 
 typedef void *(*script_obj_direct_func_t)(script_obj_t *,
                                           void         *);
+typedef void (*script_obj_hash_foreach_func_t)(const char   *name,
+                                               script_obj_t *obj,
+                                               void         *user_data);
 
+/* Where a key was last found from one place in a script.  While the hash
+ * keeps the same shape the element can be fetched without a search.
+ */
+typedef struct
+{
+        const struct script_obj_shape_t *shape;
+        int                              index;
+} script_obj_hash_cache_t;
+
+/* Time given to freeing cycles between two ticks, at most */
+#define SCRIPT_OBJ_CYCLE_COLLECTION_BUDGET 0.002
 
+void script_obj_get_allocation_stats (unsigned long *allocations,
+                                      unsigned long *live);
+unsigned long script_obj_get_live_high_water_mark (void);
+unsigned long script_obj_collect_cycles (double time_budget);
 void script_obj_free (script_obj_t *obj);
 void script_obj_ref (script_obj_t *obj);
 void script_obj_unref (script_obj_t *obj);
@@ -80,10 +98,22 @@ bool script_obj_is_native_of_class_name (script_obj_t *obj,
                                          const char   *class_name);
 void script_obj_assign (script_obj_t *obj_a,
                         script_obj_t *obj_b);
+void script_obj_assign_number (script_obj_t   *obj,
+                               script_number_t number);
 script_obj_t *script_obj_hash_peek_element (script_obj_t *hash,
                                             const char   *name);
 script_obj_t *script_obj_hash_get_element (script_obj_t *hash,
                                            const char   *name);
+script_obj_t *script_obj_hash_peek_element_atom (script_obj_t *hash,
+                                                 const char   *atom);
+script_obj_t *script_obj_hash_get_element_atom (script_obj_t *hash,
+                                                const char   *atom);
+script_obj_t *script_obj_hash_peek_element_cached (script_obj_t            *hash,
+                                                   const char              *atom,
+                                                   script_obj_hash_cache_t *cache);
+script_obj_t *script_obj_hash_get_element_cached (script_obj_t            *hash,
+                                                  const char              *atom,
+                                                  script_obj_hash_cache_t *cache);
 script_number_t script_obj_hash_get_number (script_obj_t *hash,
                                             const char   *name);
 bool script_obj_hash_get_bool (script_obj_t *hash,
@@ -96,9 +126,15 @@ void *script_obj_hash_get_native_of_class (script_obj_t              *hash,
 void *script_obj_hash_get_native_of_class_name (script_obj_t *hash,
                                                 const char   *name,
                                                 const char   *class_name);
+void script_obj_hash_foreach (script_obj_t                  *hash,
+                              script_obj_hash_foreach_func_t func,
+                              void                          *user_data);
 void script_obj_hash_add_element (script_obj_t *hash,
                                   script_obj_t *element,
                                   const char   *name);
+void script_obj_hash_add_element_atom (script_obj_t *hash,
+                                       script_obj_t *element,
+                                       const char   *atom);
 script_obj_t *script_obj_plus (script_obj_t *script_obj_a_in,
                                script_obj_t *script_obj_b_in);
 script_obj_t *script_obj_minus (script_obj_t *script_obj_a_in,
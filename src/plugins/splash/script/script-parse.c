@@ -37,7 +37,11 @@
 #include <string.h>
 #include <stdbool.h>
 
+#include "script-atom.h"
+#include "script-cache.h"
+#include "script-compile.h"
 #include "script-debug.h"
+#include "script-lib-math.h"
 #include "script-scan.h"
 #include "script-parse.h"
 
@@ -50,6 +54,9 @@ typedef struct
         int               presedence;
 }script_parse_operator_table_entry_t;
 
+static script_cache_t *script_parse_cache = NULL;
+static bool script_parse_should_optimize = true;
+
 static script_op_t *script_parse_op (script_scan_t *scan);
 static script_exp_t *script_parse_exp (script_scan_t *scan);
 static ply_list_t *script_parse_op_list (script_scan_t *scan);
@@ -102,7 +109,7 @@ static script_exp_t *script_parse_new_exp_string (char                    *strin
 {
         script_exp_t *exp = script_parse_new_exp (SCRIPT_EXP_TYPE_TERM_STRING, location);
 
-        exp->data.string = strdup (string);
+        exp->data.string = (char *) script_atom_get (string);
         return exp;
 }
 
@@ -111,7 +118,7 @@ static script_exp_t *script_parse_new_exp_var (char                    *string,
 {
         script_exp_t *exp = script_parse_new_exp (SCRIPT_EXP_TYPE_TERM_VAR, location);
 
-        exp->data.string = strdup (string);
+        exp->data.string = (char *) script_atom_get (string);
         return exp;
 }
 
@@ -240,7 +247,7 @@ free_parameter_list (script_scan_t *scan,
 
                         parameter = ply_list_node_get_data (node);
                         next_node = ply_list_get_next_node (parameter_list, node);
-                        free (parameter);
+                        script_atom_unref (parameter);
                         ply_list_remove_node (parameter_list, node);
 
                         node = next_node;
@@ -269,7 +276,7 @@ static script_function_t *script_parse_function_def (script_scan_t *scan)
                                             "Function declaration parameters must be valid identifiers");
                         goto out;
                 }
-                char *parameter = strdup (curtoken->data.string);
+                char *parameter = (char *) script_atom_get (curtoken->data.string);
                 ply_list_append_data (parameter_list, parameter);
 
                 curtoken = script_scan_get_next_token (scan);
@@ -955,12 +962,13 @@ static void script_parse_exp_free (script_exp_t *exp)
         {
                 if (exp->data.function_def->type == SCRIPT_FUNCTION_TYPE_SCRIPT)
                         script_parse_op_free (exp->data.function_def->data.script);
+                script_code_free (exp->data.function_def->code);
                 ply_list_node_t *node;
                 for (node = ply_list_get_first_node (exp->data.function_def->parameters);
                      node;
                      node = ply_list_get_next_node (exp->data.function_def->parameters, node)) {
                         char *arg = ply_list_node_get_data (node);
-                        free (arg);
+                        script_atom_unref (arg);
                 }
                 ply_list_free (exp->data.function_def->parameters);
                 free (exp->data.function_def);
@@ -969,7 +977,7 @@ static void script_parse_exp_free (script_exp_t *exp)
 
         case SCRIPT_EXP_TYPE_TERM_STRING:
         case SCRIPT_EXP_TYPE_TERM_VAR:
-                free (exp->data.string);
+                script_atom_unref (exp->data.string);
                 break;
         }
         script_debug_remove_element (exp);
@@ -1024,8 +1032,476 @@ static void script_parse_op_list_free (ply_list_t *op_list)
         return;
 }
 
+/* After parsing, expressions made only of literals are replaced with their
+ * value, and branches and loops whose conditions are literals are reduced
+ * to what would run.  Replacement nodes keep the location of the node they
+ * replace, so errors still point at the original source.
+ */
+static bool script_parse_exp_is_literal (script_exp_t *exp)
+{
+        return exp->type == SCRIPT_EXP_TYPE_TERM_NUMBER ||
+               exp->type == SCRIPT_EXP_TYPE_TERM_STRING ||
+               exp->type == SCRIPT_EXP_TYPE_TERM_NULL;
+}
+
+static bool script_parse_literal_as_bool (script_exp_t *exp)
+{
+        if (exp->type == SCRIPT_EXP_TYPE_TERM_NUMBER) {
+                int num_type = fpclassify (exp->data.number);
+                return num_type != FP_ZERO && num_type != FP_NAN;
+        }
+        if (exp->type == SCRIPT_EXP_TYPE_TERM_STRING)
+                return *exp->data.string;
+        return false;
+}
+
+static script_exp_t *script_parse_replace_exp (script_exp_t *exp,
+                                               script_exp_t *replacement)
+{
+        if (replacement != exp)
+                script_parse_exp_free (exp);
+        return replacement;
+}
+
+static script_exp_t *script_parse_fold_number (script_exp_t   *exp,
+                                               script_number_t number)
+{
+        script_debug_location_t location = *script_debug_lookup_element (exp);
+
+        return script_parse_replace_exp (exp, script_parse_new_exp_number (number, &location));
+}
+
+static script_exp_t *script_parse_fold_dual (script_exp_t *exp)
+{
+        script_exp_t *sub_a = exp->data.dual.sub_a;
+        script_exp_t *sub_b = exp->data.dual.sub_b;
+        script_number_t number_a = sub_a->data.number;
+        script_number_t number_b = sub_b->data.number;
+        int cmp = 0;
+
+        if (exp->type == SCRIPT_EXP_TYPE_AND || exp->type == SCRIPT_EXP_TYPE_OR) {
+                bool value = script_parse_literal_as_bool (sub_a);
+                script_exp_t *result = (value == (exp->type == SCRIPT_EXP_TYPE_OR)) ? sub_a : sub_b;
+                if (result == sub_a) exp->data.dual.sub_a = NULL;
+                else exp->data.dual.sub_b = NULL;
+                return script_parse_replace_exp (exp, result);
+        }
+        if (!script_parse_exp_is_literal (sub_b))
+                return exp;
+
+        if (sub_a->type == SCRIPT_EXP_TYPE_TERM_NUMBER &&
+            sub_b->type == SCRIPT_EXP_TYPE_TERM_NUMBER) {
+                if (exp->type == SCRIPT_EXP_TYPE_PLUS)
+                        return script_parse_fold_number (exp, number_a + number_b);
+                if (exp->type == SCRIPT_EXP_TYPE_MINUS)
+                        return script_parse_fold_number (exp, number_a - number_b);
+                if (exp->type == SCRIPT_EXP_TYPE_MUL)
+                        return script_parse_fold_number (exp, number_a * number_b);
+                if (exp->type == SCRIPT_EXP_TYPE_DIV)
+                        return script_parse_fold_number (exp, number_a / number_b);
+                if (exp->type == SCRIPT_EXP_TYPE_MOD)
+                        return script_parse_fold_number (exp, fmodl (number_a, number_b));
+                cmp = number_a < number_b ? -1 : number_a > number_b ? 1 : number_a == number_b ? 0 : 2;
+        } else if (exp->type == SCRIPT_EXP_TYPE_PLUS &&
+                   sub_a->type != SCRIPT_EXP_TYPE_TERM_NULL &&
+                   sub_b->type != SCRIPT_EXP_TYPE_TERM_NULL) {
+                /* At least one is a string, which makes this a concatenation */
+                script_debug_location_t location = *script_debug_lookup_element (exp);
+                char *string_a;
+                char *string_b;
+                char *string;
+
+                if (sub_a->type == SCRIPT_EXP_TYPE_TERM_NUMBER) asprintf (&string_a, "%g", number_a);
+                else string_a = strdup (sub_a->data.string);
+                if (sub_b->type == SCRIPT_EXP_TYPE_TERM_NUMBER) asprintf (&string_b, "%g", number_b);
+                else string_b = strdup (sub_b->data.string);
+                asprintf (&string, "%s%s", string_a, string_b);
+                free (string_a);
+                free (string_b);
+                exp = script_parse_replace_exp (exp, script_parse_new_exp_string (string, &location));
+                free (string);
+                return exp;
+        } else if (sub_a->type == SCRIPT_EXP_TYPE_TERM_STRING &&
+                   sub_b->type == SCRIPT_EXP_TYPE_TERM_STRING) {
+                cmp = strcmp (sub_a->data.string, sub_b->data.string);
+                cmp = cmp < 0 ? -1 : cmp > 0 ? 1 : 0;
+        } else if (sub_a->type == SCRIPT_EXP_TYPE_TERM_NULL &&
+                   sub_b->type == SCRIPT_EXP_TYPE_TERM_NULL) {
+                cmp = 0;
+        } else {
+                cmp = 2;        /* Different types are never equal or ordered */
+        }
+
+        if (exp->type == SCRIPT_EXP_TYPE_EQ)
+                return script_parse_fold_number (exp, cmp == 0);
+        if (exp->type == SCRIPT_EXP_TYPE_NE)
+                return script_parse_fold_number (exp, cmp != 0);
+        if (exp->type == SCRIPT_EXP_TYPE_GT)
+                return script_parse_fold_number (exp, cmp == 1);
+        if (exp->type == SCRIPT_EXP_TYPE_GE)
+                return script_parse_fold_number (exp, cmp == 1 || cmp == 0);
+        if (exp->type == SCRIPT_EXP_TYPE_LT)
+                return script_parse_fold_number (exp, cmp == -1);
+        if (exp->type == SCRIPT_EXP_TYPE_LE)
+                return script_parse_fold_number (exp, cmp == -1 || cmp == 0);
+        return exp;
+}
+
+static script_exp_t *script_parse_optimize_exp (script_exp_t *exp,
+                                                bool          math_is_constant);
+static void script_parse_optimize_op (script_op_t *op,
+                                      bool         math_is_constant);
+
+static void script_parse_optimize_exp_list (ply_list_t *list,
+                                            bool        math_is_constant)
+{
+        ply_list_node_t *node;
+
+        for (node = ply_list_get_first_node (list);
+             node;
+             node = ply_list_get_next_node (list, node)) {
+                script_exp_t *sub = ply_list_node_get_data (node);
+                script_exp_t *new_sub = script_parse_optimize_exp (sub, math_is_constant);
+
+                if (new_sub != sub) {
+                        ply_list_node_t *new_node = ply_list_insert_data (list, new_sub, node);
+                        ply_list_remove_node (list, node);
+                        node = new_node;
+                }
+        }
+}
+
+static script_exp_t *script_parse_optimize_exp (script_exp_t *exp,
+                                                bool          math_is_constant)
+{
+        script_number_t number;
+
+        if (!exp) return NULL;
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+                exp->data.dual.sub_a = script_parse_optimize_exp (exp->data.dual.sub_a, math_is_constant);
+                exp->data.dual.sub_b = script_parse_optimize_exp (exp->data.dual.sub_b, math_is_constant);
+                if (script_parse_exp_is_literal (exp->data.dual.sub_a))
+                        return script_parse_fold_dual (exp);
+                return exp;
+
+        case SCRIPT_EXP_TYPE_HASH:
+                if (math_is_constant &&
+                    exp->data.dual.sub_a->type == SCRIPT_EXP_TYPE_TERM_VAR &&
+                    exp->data.dual.sub_b->type == SCRIPT_EXP_TYPE_TERM_STRING &&
+                    !strcmp (exp->data.dual.sub_a->data.string, "Math") &&
+                    script_lib_math_get_constant (exp->data.dual.sub_b->data.string, &number))
+                        return script_parse_fold_number (exp, number);
+        /* fall through */
+        case SCRIPT_EXP_TYPE_EXTEND:
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                exp->data.dual.sub_a = script_parse_optimize_exp (exp->data.dual.sub_a, math_is_constant);
+                exp->data.dual.sub_b = script_parse_optimize_exp (exp->data.dual.sub_b, math_is_constant);
+                return exp;
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+                exp->data.sub = script_parse_optimize_exp (exp->data.sub, math_is_constant);
+                if (!script_parse_exp_is_literal (exp->data.sub))
+                        return exp;
+                if (exp->type == SCRIPT_EXP_TYPE_NOT)
+                        return script_parse_fold_number (exp, !script_parse_literal_as_bool (exp->data.sub));
+                if (exp->type == SCRIPT_EXP_TYPE_POS) {
+                        script_exp_t *sub = exp->data.sub;
+                        exp->data.sub = NULL;
+                        return script_parse_replace_exp (exp, sub);
+                }
+                if (exp->data.sub->type == SCRIPT_EXP_TYPE_TERM_NUMBER)
+                        return script_parse_fold_number (exp, -exp->data.sub->data.number);
+                return exp;     /* Leave the error to be reported when run */
+
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                exp->data.sub = script_parse_optimize_exp (exp->data.sub, math_is_constant);
+                return exp;
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                script_parse_optimize_exp_list (exp->data.parameters, math_is_constant);
+                return exp;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                exp->data.function_exe.name = script_parse_optimize_exp (exp->data.function_exe.name,
+                                                                         math_is_constant);
+                script_parse_optimize_exp_list (exp->data.function_exe.parameters, math_is_constant);
+                return exp;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                if (exp->data.function_def->type == SCRIPT_FUNCTION_TYPE_SCRIPT)
+                        script_parse_optimize_op (exp->data.function_def->data.script, math_is_constant);
+                return exp;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                return exp;
+        }
+        return exp;
+}
+
+/* Turns op into a block running only the given op, which may be NULL */
+static void script_parse_reduce_op (script_op_t *op,
+                                    script_op_t *kept)
+{
+        ply_list_t *list = ply_list_new ();
+
+        script_parse_exp_free (op->data.cond_op.cond);
+        if (op->data.cond_op.op1 != kept) script_parse_op_free (op->data.cond_op.op1);
+        if (op->data.cond_op.op2 != kept) script_parse_op_free (op->data.cond_op.op2);
+        if (kept) ply_list_append_data (list, kept);
+        op->type = SCRIPT_OP_TYPE_OP_BLOCK;
+        op->data.list = list;
+}
+
+static void script_parse_optimize_op (script_op_t *op,
+                                      bool         math_is_constant)
+{
+        ply_list_node_t *node;
+
+        if (!op) return;
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        case SCRIPT_OP_TYPE_RETURN:
+                op->data.exp = script_parse_optimize_exp (op->data.exp, math_is_constant);
+                break;
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node)) {
+                        script_parse_optimize_op (ply_list_node_get_data (node), math_is_constant);
+                }
+                break;
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                op->data.cond_op.cond = script_parse_optimize_exp (op->data.cond_op.cond, math_is_constant);
+                script_parse_optimize_op (op->data.cond_op.op1, math_is_constant);
+                script_parse_optimize_op (op->data.cond_op.op2, math_is_constant);
+                if (!script_parse_exp_is_literal (op->data.cond_op.cond))
+                        break;
+                if (op->type == SCRIPT_OP_TYPE_IF) {
+                        if (script_parse_literal_as_bool (op->data.cond_op.cond))
+                                script_parse_reduce_op (op, op->data.cond_op.op1);
+                        else
+                                script_parse_reduce_op (op, op->data.cond_op.op2);
+                } else if (op->type != SCRIPT_OP_TYPE_DO_WHILE &&
+                           !script_parse_literal_as_bool (op->data.cond_op.cond)) {
+                        script_parse_reduce_op (op, NULL);
+                }
+                break;
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                break;
+        }
+}
+
+/* Math members may only be folded if nothing in the script could change
+ * them.  That is taken to mean "Math" is only ever read as "Math.<name>",
+ * and never named as a string or bound as a local, such as a function
+ * parameter, which would hide the global one.
+ */
+static bool script_parse_math_check_op (script_op_t *op);
+
+static bool script_parse_math_check_exp (script_exp_t *exp,
+                                         bool          modified)
+{
+        ply_list_node_t *node;
+
+        if (!exp) return true;
+        switch (exp->type) {
+        case SCRIPT_EXP_TYPE_TERM_VAR:
+        case SCRIPT_EXP_TYPE_TERM_STRING:
+                return strcmp (exp->data.string, "Math");
+
+        case SCRIPT_EXP_TYPE_HASH:
+                if (exp->data.dual.sub_a->type == SCRIPT_EXP_TYPE_TERM_VAR &&
+                    exp->data.dual.sub_b->type == SCRIPT_EXP_TYPE_TERM_STRING &&
+                    !strcmp (exp->data.dual.sub_a->data.string, "Math"))
+                        return !modified;
+                /* Indexing turns whatever is indexed into a hash */
+                return script_parse_math_check_exp (exp->data.dual.sub_a, true) &&
+                       script_parse_math_check_exp (exp->data.dual.sub_b, false);
+
+        case SCRIPT_EXP_TYPE_ASSIGN:
+        case SCRIPT_EXP_TYPE_ASSIGN_PLUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MINUS:
+        case SCRIPT_EXP_TYPE_ASSIGN_MUL:
+        case SCRIPT_EXP_TYPE_ASSIGN_DIV:
+        case SCRIPT_EXP_TYPE_ASSIGN_MOD:
+        case SCRIPT_EXP_TYPE_ASSIGN_EXTEND:
+                return script_parse_math_check_exp (exp->data.dual.sub_a, true) &&
+                       script_parse_math_check_exp (exp->data.dual.sub_b, false);
+
+        case SCRIPT_EXP_TYPE_PLUS:
+        case SCRIPT_EXP_TYPE_MINUS:
+        case SCRIPT_EXP_TYPE_MUL:
+        case SCRIPT_EXP_TYPE_DIV:
+        case SCRIPT_EXP_TYPE_MOD:
+        case SCRIPT_EXP_TYPE_EQ:
+        case SCRIPT_EXP_TYPE_NE:
+        case SCRIPT_EXP_TYPE_GT:
+        case SCRIPT_EXP_TYPE_GE:
+        case SCRIPT_EXP_TYPE_LT:
+        case SCRIPT_EXP_TYPE_LE:
+        case SCRIPT_EXP_TYPE_AND:
+        case SCRIPT_EXP_TYPE_OR:
+        case SCRIPT_EXP_TYPE_EXTEND:
+                return script_parse_math_check_exp (exp->data.dual.sub_a, false) &&
+                       script_parse_math_check_exp (exp->data.dual.sub_b, false);
+
+        case SCRIPT_EXP_TYPE_NOT:
+        case SCRIPT_EXP_TYPE_POS:
+        case SCRIPT_EXP_TYPE_NEG:
+                return script_parse_math_check_exp (exp->data.sub, false);
+
+        case SCRIPT_EXP_TYPE_PRE_INC:
+        case SCRIPT_EXP_TYPE_PRE_DEC:
+        case SCRIPT_EXP_TYPE_POST_INC:
+        case SCRIPT_EXP_TYPE_POST_DEC:
+                return script_parse_math_check_exp (exp->data.sub, true);
+
+        case SCRIPT_EXP_TYPE_TERM_SET:
+                for (node = ply_list_get_first_node (exp->data.parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.parameters, node)) {
+                        if (!script_parse_math_check_exp (ply_list_node_get_data (node), false))
+                                return false;
+                }
+                return true;
+
+        case SCRIPT_EXP_TYPE_FUNCTION_EXE:
+                for (node = ply_list_get_first_node (exp->data.function_exe.parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.function_exe.parameters, node)) {
+                        if (!script_parse_math_check_exp (ply_list_node_get_data (node), false))
+                                return false;
+                }
+                return script_parse_math_check_exp (exp->data.function_exe.name, false);
+
+        case SCRIPT_EXP_TYPE_FUNCTION_DEF:
+                for (node = ply_list_get_first_node (exp->data.function_def->parameters);
+                     node;
+                     node = ply_list_get_next_node (exp->data.function_def->parameters, node)) {
+                        if (!strcmp (ply_list_node_get_data (node), "Math"))
+                                return false;
+                }
+                if (exp->data.function_def->type == SCRIPT_FUNCTION_TYPE_SCRIPT)
+                        return script_parse_math_check_op (exp->data.function_def->data.script);
+                return true;
+
+        case SCRIPT_EXP_TYPE_TERM_NULL:
+        case SCRIPT_EXP_TYPE_TERM_NUMBER:
+        case SCRIPT_EXP_TYPE_TERM_LOCAL:
+        case SCRIPT_EXP_TYPE_TERM_GLOBAL:
+        case SCRIPT_EXP_TYPE_TERM_THIS:
+                return true;
+        }
+        return true;
+}
+
+static bool script_parse_math_check_op (script_op_t *op)
+{
+        ply_list_node_t *node;
+
+        if (!op) return true;
+        switch (op->type) {
+        case SCRIPT_OP_TYPE_EXPRESSION:
+        case SCRIPT_OP_TYPE_RETURN:
+                return script_parse_math_check_exp (op->data.exp, false);
+
+        case SCRIPT_OP_TYPE_OP_BLOCK:
+                for (node = ply_list_get_first_node (op->data.list);
+                     node;
+                     node = ply_list_get_next_node (op->data.list, node)) {
+                        if (!script_parse_math_check_op (ply_list_node_get_data (node)))
+                                return false;
+                }
+                return true;
+
+        case SCRIPT_OP_TYPE_IF:
+        case SCRIPT_OP_TYPE_WHILE:
+        case SCRIPT_OP_TYPE_DO_WHILE:
+        case SCRIPT_OP_TYPE_FOR:
+                return script_parse_math_check_exp (op->data.cond_op.cond, false) &&
+                       script_parse_math_check_op (op->data.cond_op.op1) &&
+                       script_parse_math_check_op (op->data.cond_op.op2);
+
+        case SCRIPT_OP_TYPE_FAIL:
+        case SCRIPT_OP_TYPE_BREAK:
+        case SCRIPT_OP_TYPE_CONTINUE:
+                return true;
+        }
+        return true;
+}
+
+static void script_parse_optimize (script_op_t *op)
+{
+        if (!script_parse_should_optimize) return;
+        script_parse_optimize_op (op, script_parse_math_check_op (op));
+}
+
+/* Scripts parsed with optimizing turned off are kept exactly as written,
+ * to check the optimized ones against.
+ */
+void script_parse_set_optimize (bool optimize)
+{
+        script_parse_should_optimize = optimize;
+}
+
+/* While a cache is set, scripts found in it with a matching source are
+ * taken from it rather than parsed.
+ */
+void script_parse_set_cache (script_cache_t *cache)
+{
+        script_parse_cache = cache;
+}
+
 script_op_t *script_parse_file (const char *filename)
 {
+        if (script_parse_cache) {
+                char *source = script_cache_read_file (filename);
+                script_op_t *op = NULL;
+
+                if (source)
+                        op = script_cache_lookup (script_parse_cache, filename, source);
+                free (source);
+                if (op) return op;
+        }
+
         script_scan_t *scan = script_scan_file (filename);
 
         if (!scan) {
@@ -1044,12 +1520,19 @@ script_op_t *script_parse_file (const char *filename)
         }
         script_op_t *op = script_parse_new_op_block (list, &location);
         script_scan_free (scan);
+        script_parse_optimize (op);
         return op;
 }
 
 script_op_t *script_parse_string (const char *string,
                                   const char *name)
 {
+        if (script_parse_cache) {
+                script_op_t *op = script_cache_lookup (script_parse_cache, name, string);
+
+                if (op) return op;
+        }
+
         script_scan_t *scan = script_scan_string (string, name);
 
         if (!scan) {
@@ -1068,5 +1551,6 @@ script_op_t *script_parse_string (const char *string,
         }
         script_op_t *op = script_parse_new_op_block (list, &location);
         script_scan_free (scan);
+        script_parse_optimize (op);
         return op;
 }
@@ -23,10 +23,13 @@
 #define SCRIPT_PARSE_H
 
 #include "script.h"
+#include "script-cache.h"
 
 script_op_t *script_parse_file (const char *filename);
 script_op_t *script_parse_string (const char *string,
                                   const char *name);
 void script_parse_op_free (script_op_t *op);
+void script_parse_set_cache (script_cache_t *cache);
+void script_parse_set_optimize (bool optimize);
 
 #endif /* SCRIPT_PARSE_H */
@@ -0,0 +1,438 @@
+/* script-profile.c - time spent in script functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ply-hashtable.h"
+#include "ply-list.h"
+#include "ply-utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script.h"
+#include "script-debug.h"
+#include "script-profile.h"
+
+typedef enum
+{
+        SCRIPT_PROFILE_ENTRY_TYPE_SCRIPT,
+        SCRIPT_PROFILE_ENTRY_TYPE_NATIVE,
+        SCRIPT_PROFILE_ENTRY_TYPE_SECTION,
+} script_profile_entry_type_t;
+
+typedef struct
+{
+        char                       *label;
+        script_profile_entry_type_t type;
+        unsigned long               calls;
+        double                      inclusive_time;
+        double                      exclusive_time;
+        int                         depth;      /* so recursion is only counted once */
+} script_profile_entry_t;
+
+/* One node for every distinct stack of entries, for the collapsed stacks */
+typedef struct script_profile_node_t
+{
+        script_profile_entry_t       *entry;
+        struct script_profile_node_t *parent;
+        ply_list_t                   *children;
+        double                        exclusive_time;
+} script_profile_node_t;
+
+typedef struct
+{
+        script_profile_node_t *node;
+        double                 start_time;
+        double                 child_time;
+} script_profile_frame_t;
+
+/* Time spent running the code of one line, leaving out the functions it
+ * calls */
+typedef struct
+{
+        char         *label;
+        unsigned long entries;
+        double        time;
+} script_profile_line_t;
+
+struct script_profile_t
+{
+        ply_hashtable_t        *entries_by_key;     /* function or section name */
+        ply_hashtable_t        *entries_by_label;
+        ply_list_t             *entries;
+        script_profile_node_t  *root;
+        script_profile_node_t  *current;
+        script_profile_frame_t *frames;
+        int                     frame_count;
+        int                     frame_capacity;
+
+        ply_hashtable_t        *lines_by_element;   /* parsed op or expression */
+        ply_hashtable_t        *lines_by_label;
+        ply_list_t             *lines;
+        script_profile_line_t  *current_line;
+        double                  line_start_time;
+};
+
+static script_profile_node_t *script_profile_node_new (script_profile_entry_t *entry,
+                                                       script_profile_node_t  *parent)
+{
+        script_profile_node_t *node = calloc (1, sizeof(script_profile_node_t));
+
+        node->entry = entry;
+        node->parent = parent;
+        node->children = ply_list_new ();
+        return node;
+}
+
+static void script_profile_node_free (script_profile_node_t *node)
+{
+        ply_list_node_t *list_node;
+
+        for (list_node = ply_list_get_first_node (node->children);
+             list_node;
+             list_node = ply_list_get_next_node (node->children, list_node))
+                script_profile_node_free (ply_list_node_get_data (list_node));
+        ply_list_free (node->children);
+        free (node);
+}
+
+script_profile_t *script_profile_new (void)
+{
+        script_profile_t *profile = calloc (1, sizeof(script_profile_t));
+
+        profile->entries_by_key = ply_hashtable_new (NULL, NULL);
+        profile->entries_by_label = ply_hashtable_new (ply_hashtable_string_hash,
+                                                       ply_hashtable_string_compare);
+        profile->entries = ply_list_new ();
+        profile->root = script_profile_node_new (NULL, NULL);
+        profile->current = profile->root;
+        profile->lines_by_element = ply_hashtable_new (NULL, NULL);
+        profile->lines_by_label = ply_hashtable_new (ply_hashtable_string_hash,
+                                                     ply_hashtable_string_compare);
+        profile->lines = ply_list_new ();
+        return profile;
+}
+
+void script_profile_free (script_profile_t *profile)
+{
+        ply_list_node_t *node;
+
+        if (!profile) return;
+        for (node = ply_list_get_first_node (profile->entries);
+             node;
+             node = ply_list_get_next_node (profile->entries, node)) {
+                script_profile_entry_t *entry = ply_list_node_get_data (node);
+                free (entry->label);
+                free (entry);
+        }
+        ply_list_free (profile->entries);
+        ply_hashtable_free (profile->entries_by_key);
+        ply_hashtable_free (profile->entries_by_label);
+        for (node = ply_list_get_first_node (profile->lines);
+             node;
+             node = ply_list_get_next_node (profile->lines, node)) {
+                script_profile_line_t *line = ply_list_node_get_data (node);
+                free (line->label);
+                free (line);
+        }
+        ply_list_free (profile->lines);
+        ply_hashtable_free (profile->lines_by_element);
+        ply_hashtable_free (profile->lines_by_label);
+        script_profile_node_free (profile->root);
+        free (profile->frames);
+        free (profile);
+}
+
+static script_profile_entry_t *script_profile_get_entry (script_profile_t           *profile,
+                                                         void                       *key,
+                                                         char                       *label,
+                                                         script_profile_entry_type_t type)
+{
+        script_profile_entry_t *entry = ply_hashtable_lookup (profile->entries_by_label, label);
+
+        if (entry) {
+                free (label);
+        } else {
+                entry = calloc (1, sizeof(script_profile_entry_t));
+                entry->label = label;
+                entry->type = type;
+                ply_hashtable_insert (profile->entries_by_label, entry->label, entry);
+                ply_list_append_data (profile->entries, entry);
+        }
+        ply_hashtable_insert (profile->entries_by_key, key, entry);
+        return entry;
+}
+
+/* Stops counting time against the line being run, until the next one */
+static void script_profile_stop_line (script_profile_t *profile,
+                                      double            now)
+{
+        if (!profile->current_line) return;
+        profile->current_line->time += now - profile->line_start_time;
+        profile->current_line = NULL;
+}
+
+static void script_profile_enter (script_profile_t       *profile,
+                                  script_profile_entry_t *entry)
+{
+        script_profile_node_t *node = NULL;
+        script_profile_frame_t *frame;
+        ply_list_node_t *list_node;
+
+        for (list_node = ply_list_get_first_node (profile->current->children);
+             list_node;
+             list_node = ply_list_get_next_node (profile->current->children, list_node)) {
+                node = ply_list_node_get_data (list_node);
+                if (node->entry == entry) break;
+                node = NULL;
+        }
+        if (!node) {
+                node = script_profile_node_new (entry, profile->current);
+                ply_list_append_data (profile->current->children, node);
+        }
+        profile->current = node;
+
+        if (profile->frame_count == profile->frame_capacity) {
+                profile->frame_capacity = profile->frame_capacity ? profile->frame_capacity * 2 : 64;
+                profile->frames = realloc (profile->frames,
+                                           profile->frame_capacity * sizeof(script_profile_frame_t));
+        }
+        frame = &profile->frames[profile->frame_count++];
+        frame->node = node;
+        frame->child_time = 0;
+
+        entry->calls++;
+        entry->depth++;
+        frame->start_time = ply_get_timestamp ();
+        script_profile_stop_line (profile, frame->start_time);
+}
+
+void script_profile_enter_function (script_profile_t  *profile,
+                                    script_function_t *function)
+{
+        script_profile_entry_t *entry = ply_hashtable_lookup (profile->entries_by_key, function);
+        script_debug_location_t *location;
+        char *label;
+
+        if (!entry) {
+                if (function->type == SCRIPT_FUNCTION_TYPE_NATIVE) {
+                        asprintf (&label, "%s [native]", function->name ? function->name : "?");
+                        entry = script_profile_get_entry (profile, function, label,
+                                                          SCRIPT_PROFILE_ENTRY_TYPE_NATIVE);
+                } else {
+                        location = script_debug_lookup_element (function->data.script);
+                        if (location)
+                                asprintf (&label, "%s:%d:%d",
+                                          location->name,
+                                          location->line_index,
+                                          location->column_index);
+                        else
+                                label = strdup ("?");
+                        entry = script_profile_get_entry (profile, function, label,
+                                                          SCRIPT_PROFILE_ENTRY_TYPE_SCRIPT);
+                }
+        }
+        script_profile_enter (profile, entry);
+}
+
+void script_profile_enter_section (script_profile_t *profile,
+                                   const char       *name)
+{
+        script_profile_entry_t *entry = ply_hashtable_lookup (profile->entries_by_key, (void *) name);
+
+        if (!entry)
+                entry = script_profile_get_entry (profile, (void *) name, strdup (name),
+                                                  SCRIPT_PROFILE_ENTRY_TYPE_SECTION);
+        script_profile_enter (profile, entry);
+}
+
+void script_profile_leave (script_profile_t *profile)
+{
+        script_profile_frame_t *frame;
+        script_profile_entry_t *entry;
+        double elapsed;
+        double now;
+
+        if (profile->frame_count == 0) return;
+        frame = &profile->frames[--profile->frame_count];
+        entry = frame->node->entry;
+        now = ply_get_timestamp ();
+        script_profile_stop_line (profile, now);
+        elapsed = now - frame->start_time;
+
+        frame->node->exclusive_time += elapsed - frame->child_time;
+        entry->exclusive_time += elapsed - frame->child_time;
+        entry->depth--;
+        if (entry->depth == 0)
+                entry->inclusive_time += elapsed;
+        if (profile->frame_count > 0)
+                profile->frames[profile->frame_count - 1].child_time += elapsed;
+        profile->current = frame->node->parent;
+}
+
+/* Called with the op or expression about to be run.  Only a change of
+ * line is timed, so running on within one line costs a lookup.
+ */
+void script_profile_enter_line (script_profile_t *profile,
+                                void             *element)
+{
+        script_profile_line_t *line = ply_hashtable_lookup (profile->lines_by_element, element);
+        script_debug_location_t *location;
+        double now;
+        char *label;
+
+        if (!line) {
+                location = script_debug_lookup_element (element);
+                if (!location) return;
+                asprintf (&label, "%s:%d", location->name, location->line_index);
+                line = ply_hashtable_lookup (profile->lines_by_label, label);
+                if (line) {
+                        free (label);
+                } else {
+                        line = calloc (1, sizeof(script_profile_line_t));
+                        line->label = label;
+                        ply_hashtable_insert (profile->lines_by_label, line->label, line);
+                        ply_list_append_data (profile->lines, line);
+                }
+                ply_hashtable_insert (profile->lines_by_element, element, line);
+        }
+        if (line == profile->current_line) return;
+
+        now = ply_get_timestamp ();
+        script_profile_stop_line (profile, now);
+        profile->current_line = line;
+        profile->line_start_time = now;
+        line->entries++;
+}
+
+void script_profile_leave_line (script_profile_t *profile)
+{
+        script_profile_stop_line (profile, ply_get_timestamp ());
+}
+
+static int script_profile_compare_lines (void *element_a,
+                                         void *element_b)
+{
+        script_profile_line_t *line_a = element_a;
+        script_profile_line_t *line_b = element_b;
+
+        if (line_a->time > line_b->time) return -1;
+        if (line_a->time < line_b->time) return 1;
+        return 0;
+}
+
+static int script_profile_compare_entries (void *element_a,
+                                           void *element_b)
+{
+        script_profile_entry_t *entry_a = element_a;
+        script_profile_entry_t *entry_b = element_b;
+
+        if (entry_a->exclusive_time > entry_b->exclusive_time) return -1;
+        if (entry_a->exclusive_time < entry_b->exclusive_time) return 1;
+        return 0;
+}
+
+static void script_profile_save_node (script_profile_node_t *node,
+                                      ply_list_t            *stack,
+                                      FILE                  *file)
+{
+        ply_list_node_t *list_node;
+        unsigned long microseconds;
+
+        if (node->entry)
+                ply_list_append_data (stack, node->entry->label);
+
+        microseconds = node->exclusive_time * 1000000;
+        if (node->entry && microseconds > 0) {
+                for (list_node = ply_list_get_first_node (stack);
+                     list_node;
+                     list_node = ply_list_get_next_node (stack, list_node))
+                        fprintf (file, "%s%s",
+                                 (char *) ply_list_node_get_data (list_node),
+                                 ply_list_get_next_node (stack, list_node) ? ";" : " ");
+                fprintf (file, "%lu\n", microseconds);
+        }
+
+        for (list_node = ply_list_get_first_node (node->children);
+             list_node;
+             list_node = ply_list_get_next_node (node->children, list_node))
+                script_profile_save_node (ply_list_node_get_data (list_node), stack, file);
+
+        if (node->entry)
+                ply_list_remove_node (stack, ply_list_get_last_node (stack));
+}
+
+/* Writes a flat table of every function and one of every line to
+ * filename, and the time spent in each distinct stack to filename.folded,
+ * in the collapsed format read by flame graph tools.  Times are in
+ * milliseconds and microseconds.
+ */
+bool script_profile_save (script_profile_t *profile,
+                          const char       *filename)
+{
+        ply_list_node_t *node;
+        ply_list_t *stack;
+        char *folded_filename;
+        double native_time = 0;
+        FILE *file;
+
+        file = fopen (filename, "w");
+        if (!file) return false;
+
+        ply_list_sort_stable (profile->entries, script_profile_compare_entries);
+        fprintf (file, "# %10s %12s %12s  %s\n", "calls", "inclusive", "exclusive", "function");
+        for (node = ply_list_get_first_node (profile->entries);
+             node;
+             node = ply_list_get_next_node (profile->entries, node)) {
+                script_profile_entry_t *entry = ply_list_node_get_data (node);
+                fprintf (file, "  %10lu %12.3f %12.3f  %s\n",
+                         entry->calls,
+                         entry->inclusive_time * 1000,
+                         entry->exclusive_time * 1000,
+                         entry->label);
+                if (entry->type == SCRIPT_PROFILE_ENTRY_TYPE_NATIVE)
+                        native_time += entry->inclusive_time;
+        }
+        fprintf (file, "# %.3f ms in native functions\n", native_time * 1000);
+
+        ply_list_sort_stable (profile->lines, script_profile_compare_lines);
+        fprintf (file, "\n# %10s %12s  %s\n", "entries", "time", "line");
+        for (node = ply_list_get_first_node (profile->lines);
+             node;
+             node = ply_list_get_next_node (profile->lines, node)) {
+                script_profile_line_t *line = ply_list_node_get_data (node);
+                fprintf (file, "  %10lu %12.3f  %s\n",
+                         line->entries,
+                         line->time * 1000,
+                         line->label);
+        }
+        fclose (file);
+
+        asprintf (&folded_filename, "%s.folded", filename);
+        file = fopen (folded_filename, "w");
+        free (folded_filename);
+        if (!file) return false;
+
+        stack = ply_list_new ();
+        script_profile_save_node (profile->root, stack, file);
+        ply_list_free (stack);
+        fclose (file);
+        return true;
+}
@@ -0,0 +1,47 @@
+/* script-profile.h - time spent in script functions
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA
+ * 02111-1307, USA.
+ */
+#ifndef SCRIPT_PROFILE_H
+#define SCRIPT_PROFILE_H
+
+#include <stdbool.h>
+#include "script.h"
+
+/* A profile counts the calls to each function and the time spent in it,
+ * both including and excluding the functions it calls.  Script functions
+ * are told apart by the location they were defined at and natives by the
+ * name they were added with.  Other work, like redrawing sprites, can be
+ * measured as a named section.  The time spent running each line of
+ * script code is kept too, leaving out the functions it calls.
+ */
+
+typedef struct script_profile_t script_profile_t;
+
+script_profile_t *script_profile_new (void);
+void script_profile_free (script_profile_t *profile);
+void script_profile_enter_function (script_profile_t  *profile,
+                                    script_function_t *function);
+void script_profile_enter_section (script_profile_t *profile,
+                                   const char       *name);
+void script_profile_leave (script_profile_t *profile);
+void script_profile_enter_line (script_profile_t *profile,
+                                void             *element);
+void script_profile_leave_line (script_profile_t *profile);
+bool script_profile_save (script_profile_t *profile,
+                          const char       *filename);
+
+#endif /* SCRIPT_PROFILE_H */
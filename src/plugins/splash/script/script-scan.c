@@ -33,6 +33,7 @@
 #include <limits.h>
 
 #include "ply-bitarray.h"
+#include "ply-readahead.h"
 #include "script-scan.h"
 
 #define COLUMN_START_INDEX 0
@@ -71,6 +72,7 @@ script_scan_t *script_scan_file (const char *filename)
         int fd = open (filename, O_RDONLY | O_CLOEXEC);
 
         if (fd < 0) return NULL;
+        ply_readahead_record_file (filename);
         script_scan_t *scan = script_scan_new ();
         scan->name = strdup (filename);
         scan->source.fd = fd;
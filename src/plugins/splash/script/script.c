@@ -37,6 +37,7 @@
 #include <stdarg.h>
 
 #include "script.h"
+#include "script-atom.h"
 #include "script-parse.h"
 #include "script-object.h"
 
@@ -49,6 +50,8 @@ script_function_t *script_function_script_new (script_op_t *script,
         function->type = SCRIPT_FUNCTION_TYPE_SCRIPT;
         function->parameters = parameter_list;
         function->data.script = script;
+        function->code = NULL;
+        function->name = NULL;
         function->freeable = false;
         function->user_data = user_data;
         return function;
@@ -63,6 +66,8 @@ script_function_t *script_function_native_new (script_native_function_t native_f
         function->type = SCRIPT_FUNCTION_TYPE_NATIVE;
         function->parameters = parameter_list;
         function->data.native = native_function;
+        function->code = NULL;
+        function->name = NULL;
         function->freeable = true;
         function->user_data = user_data;
         return function;
@@ -82,7 +87,7 @@ void script_add_native_function (script_obj_t            *hash,
         arg = first_arg;
         va_start (args, first_arg);
         while (arg) {
-                ply_list_append_data (parameter_list, strdup (arg));
+                ply_list_append_data (parameter_list, (char *) script_atom_get (arg));
                 arg = va_arg (args, const char *);
         }
         va_end (args);
@@ -90,6 +95,7 @@ void script_add_native_function (script_obj_t            *hash,
         script_function_t *function = script_function_native_new (native_function,
                                                                   user_data,
                                                                   parameter_list);
+        function->name = script_atom_get (name);
         script_obj_t *obj = script_obj_new_function (function);
         script_obj_hash_add_element (hash, obj, name);
         script_obj_unref (obj);
@@ -36,6 +36,7 @@ typedef enum                        /* FIXME add _t to all types */
 } script_return_type_t;
 
 struct script_obj_t;
+struct script_code_t;
 
 typedef struct
 {
@@ -63,13 +64,15 @@ typedef script_return_t (*script_native_function_t)(script_state_t *,
 typedef struct script_function_t
 {
         script_function_type_t type;
-        ply_list_t            *parameters; /*  list of char* typedef names */
+        ply_list_t            *parameters; /*  list of char* typedef names, as atoms */
         void                  *user_data;
         union
         {
                 script_native_function_t native;
                 struct script_op_t      *script;
         } data;
+        struct script_code_t  *code;       /* compiled on first call */
+        const char            *name;       /* atom, natives added by name only */
         bool                   freeable;
 } script_function_t;
 
@@ -104,7 +107,9 @@ typedef enum
 
 typedef struct script_obj_t
 {
-        script_obj_type_t type;
+        script_obj_type_t type : 8;
+        unsigned int      color : 2;        /* used by the cycle collector */
+        unsigned int      is_buffered : 1;  /* a possible root of a cycle */
         int               refcount;
         union
         {
@@ -117,7 +122,15 @@ typedef struct script_obj_t
                         struct script_obj_t *obj_b;
                 } dual_obj;
                 script_function_t   *function;
-                ply_hashtable_t     *hash;
+                struct
+                {
+                        struct script_obj_shape_t *shape;  /* NULL once moved to a table */
+                        union
+                        {
+                                struct script_obj_t **values;
+                                ply_hashtable_t      *table;
+                        } storage;
+                } hash;
                 script_obj_native_t  native;
         } data;
 } script_obj_t;
@@ -220,7 +233,7 @@ typedef struct script_op_t
 
 typedef struct
 {
-        char         *name;
+        const char   *name;     /* atom */
         script_obj_t *object;
 } script_variable_t;
 
@@ -0,0 +1,29 @@
+#!/bin/sh
+# Runs a script for a few ticks with the tree walker on the script as
+# written, with the bytecode interpreter on the optimized script, and with
+# the bytecode interpreter after a round trip through a script cache.
+# Fails unless all three runs succeed and end in the same state.
+#
+# usage: check-script.sh SCRIPT-BENCHMARK IMAGE-DIR SCRIPT-FILE
+
+benchmark="$1"
+image_dir="$2"
+script="$3"
+tree_results=$(mktemp)
+bytecode_results=$(mktemp)
+cache_results=$(mktemp)
+trap 'rm -f "$tree_results" "$bytecode_results" "$cache_results"' EXIT
+
+"$benchmark" -r -t 20 -i tree -n "$image_dir" "$script" > "$tree_results" || exit 1
+"$benchmark" -r -t 20 -i bytecode "$image_dir" "$script" > "$bytecode_results" || exit 1
+"$benchmark" -r -t 20 -i bytecode -c "$image_dir" "$script" > "$cache_results" || exit 1
+
+if ! diff -u "$tree_results" "$bytecode_results"; then
+        echo "$script: the optimized bytecode run disagrees with the tree walker" >&2
+        exit 1
+fi
+
+if ! diff -u "$bytecode_results" "$cache_results"; then
+        echo "$script: the cached script behaves differently" >&2
+        exit 1
+fi